@@ -9,11 +9,11 @@
 #include "align-2d.h"
 
 #include "align-3d.h"
-#include "buffer.h"
 #include "guide.h"
 #include "ioseq.h"
 #include "matrix.h"
 #include "structure.h"
+#include "thread-pool.h"
 #include "utils.h"
 
 #include <boost/algorithm/string.hpp>
@@ -331,51 +331,19 @@ float calculateDistance(const entry& a, const entry& b)
   return result;
 }
 
-// we use as many threads as is useful to do the distance calculation
-// which is quite easy to do using a thread safe queue
-typedef buffer<tr1::tuple<uint32,uint32> >   distance_queue;
-const tr1::tuple<uint32,uint32>  kSentinel = tr1::make_tuple(numeric_limits<uint32>::max(), 0);
-
-void calculateDistance(distance_queue& queue, symmetric_matrix<float>& d, vector<entry>& data,
-  progress& pr)
-{
-  for (;;)
-  {
-    uint32 a, b;
-    tr1::tie(a, b) = queue.get();
-
-    if (a == numeric_limits<uint32>::max()) // sentinel found, quit loop
-      break;
-
-    d(a, b) = calculateDistance(data[a], data[b]);
-    pr.step();
-  }
-
-  queue.put(kSentinel);
-}
-
+// we use as many threads as is useful to do the distance calculation,
+// each row of the matrix is a separate piece of work for the thread pool
 void calculateDistanceMatrix(symmetric_matrix<float>& d, vector<entry>& data)
 {
   progress pr("calculating guide tree", (data.size() * (data.size() - 1)) / 2);
-  distance_queue queue;
-
-  boost::thread_group t;
-
-  uint32 nr_of_threads = boost::thread::hardware_concurrency();
 
-  for (uint32 ti = 0; ti < nr_of_threads; ++ti)
-    t.create_thread(boost::bind(&calculateDistance,
-      boost::ref(queue), boost::ref(d), boost::ref(data), boost::ref(pr)));
-
-  for (uint32 a = 0; a < data.size() - 1; ++a)
-  {
+  ParallelFor(data.size() - 1, [&d, &data, &pr](uint32 a) {
     for (uint32 b = a + 1; b < data.size(); ++b)
-      queue.put(tr1::make_tuple(a, b));
-  }
-
-  queue.put(kSentinel);
-
-  t.join_all();
+    {
+      d(a, b) = calculateDistance(data[a], data[b]);
+      pr.step();
+    }
+  });
 }
 
 // --------------------------------------------------------------------
@@ -954,23 +922,23 @@ void createAlignment(joined_node* node, vector<entry*>& alignment,
 {
   vector<entry*> a, b;
 
-  boost::thread_group t;
+  MTaskGroup t;
 
   if (dynamic_cast<leaf_node*>(node->left()) != NULL)
     a.push_back(&static_cast<leaf_node*>(node->left())->m_entry);
   else
-    t.create_thread(boost::bind(&createAlignment,
+    t.Run(boost::bind(&createAlignment,
       static_cast<joined_node*>(node->left()), boost::ref(a), boost::ref(mat), gop, gep, magic,
       boost::ref(pr)));
 
   if (dynamic_cast<leaf_node*>(node->right()) != NULL)
     b.push_back(&static_cast<leaf_node*>(node->right())->m_entry);
   else
-    t.create_thread(boost::bind(&createAlignment,
+    t.Run(boost::bind(&createAlignment,
       static_cast<joined_node*>(node->right()), boost::ref(b), boost::ref(mat), gop, gep, magic,
       boost::ref(pr)));
 
-  t.join_all();
+  t.Wait();
 
   align(node, a, b, alignment, mat, gop, gep, magic, false);
 
@@ -0,0 +1,134 @@
+// Copyright Maarten L. Hekkelman, Radboud University 2008-2011.
+// Copyright Coos Baakman, Jon Black, Wouter G. Touw & Gert Vriend, Radboud university medical center 2015.
+//   Distributed under the Boost Software License, Version 1.0.
+//       (See accompanying file LICENSE_1_0.txt or copy at
+//             http://www.boost.org/LICENSE_1_0.txt)
+//
+// arena hands out memory from large blocks and releases all of it at once
+// when it is destroyed. It does not run destructors, whoever creates an
+// object in an arena destroys it. An arena is not thread safe.
+//
+// arena_allocator lets the standard containers allocate in an arena, a
+// default constructed arena_allocator uses the free store instead.
+
+#ifndef XSSP_ARENA_H
+#define XSSP_ARENA_H
+
+#pragma once
+
+#include "mas.h"
+
+#include <cstddef>
+#include <new>
+#include <vector>
+
+class arena
+{
+  public:
+
+  static const std::size_t kBlockSize = 64 * 1024;
+
+            arena() : m_next(nullptr), m_end(nullptr) {}
+            ~arena();
+
+  void*        allocate(std::size_t inSize);
+
+  // room for n objects of type T
+  template<class T>
+  T*          allocate(std::size_t n = 1)
+              {
+                return static_cast<T*>(allocate(n * sizeof(T)));
+              }
+
+  private:
+            arena(const arena&);
+  arena&        operator=(const arena&);
+
+  // everything handed out is aligned like operator new aligns
+  static const std::size_t kAlignment = 16;
+
+  std::vector<char*>  m_blocks;
+  char*        m_next;
+  char*        m_end;
+};
+
+inline
+arena::~arena()
+{
+  for (std::vector<char*>::iterator b = m_blocks.begin(); b != m_blocks.end();
+       ++b)
+    ::operator delete(*b);
+}
+
+inline
+void* arena::allocate(std::size_t inSize)
+{
+  inSize = (inSize + kAlignment - 1) & ~(kAlignment - 1);
+
+  // large requests get a block of their own, so they do not waste what is
+  // left of the current one
+  if (inSize > kBlockSize / 4)
+  {
+    m_blocks.push_back(static_cast<char*>(::operator new(inSize)));
+    return m_blocks.back();
+  }
+
+  if (inSize > static_cast<std::size_t>(m_end - m_next))
+  {
+    m_blocks.push_back(static_cast<char*>(::operator new(kBlockSize)));
+    m_next = m_blocks.back();
+    m_end = m_next + kBlockSize;
+  }
+
+  void* result = m_next;
+  m_next += inSize;
+  return result;
+}
+
+// --------------------------------------------------------------------
+
+template<class T>
+class arena_allocator
+{
+  public:
+  typedef T        value_type;
+
+            arena_allocator(arena* inArena = nullptr) : m_arena(inArena) {}
+
+  template<class U>
+            arena_allocator(const arena_allocator<U>& rhs)
+              : m_arena(rhs.get_arena()) {}
+
+  T*          allocate(std::size_t n)
+              {
+                if (m_arena != nullptr)
+                  return m_arena->allocate<T>(n);
+                return static_cast<T*>(::operator new(n * sizeof(T)));
+              }
+
+  // memory in an arena is only released with the arena itself
+  void        deallocate(T* p, std::size_t)
+              {
+                if (m_arena == nullptr)
+                  ::operator delete(p);
+              }
+
+  arena*        get_arena() const        { return m_arena; }
+
+  private:
+  arena*        m_arena;
+};
+
+template<class T, class U>
+inline bool operator==(const arena_allocator<T>& a, const arena_allocator<U>& b)
+{
+  return a.get_arena() == b.get_arena();
+}
+
+template<class T, class U>
+inline bool operator!=(const arena_allocator<T>& a, const arena_allocator<U>& b)
+{
+  return a.get_arena() != b.get_arena();
+}
+
+#endif
@@ -9,17 +9,25 @@
 #include "matrix.h"
 #include "utils.h"
 #include "progress.h"
+#include "thread-pool.h"
 
 #include <boost/algorithm/string.hpp>
-#include <boost/detail/atomic_count.hpp>
+#include <boost/filesystem/fstream.hpp>
+#include <boost/filesystem/operations.hpp>
 #include <boost/foreach.hpp>
 #include <boost/format.hpp>
 #include <boost/iostreams/device/mapped_file.hpp>
+#include <boost/ptr_container/ptr_vector.hpp>
 #include <boost/regex.hpp>
 
 #include <limits>
 #include <numeric>
 
+#if defined(__GNUC__) and (defined(__x86_64__) or defined(__i386__)) and defined(__SSE2__)
+#include <emmintrin.h>
+#define XSSP_SIMD_GAPPED 1
+#endif
+
 namespace ba = boost::algorithm;
 namespace fs = boost::filesystem;
 namespace io = boost::iostreams;
@@ -1049,6 +1057,11 @@ struct DiscardTraceBack
   }
 
   void Set(uint32 inI, uint32 inJ, int16 inD) {}
+
+#if XSSP_SIMD_GAPPED
+  void Set(uint32 inI, uint32 inJ, __m128i inB, __m128i inIx, __m128i inIy,
+           uint32 inCount) {}
+#endif
 };
 
 struct RecordTraceBack
@@ -1080,6 +1093,23 @@ struct RecordTraceBack
 
   void Set(uint32 inI, uint32 inJ, int16 inD) { mTraceBack(inI, inJ) = inD; }
 
+#if XSSP_SIMD_GAPPED
+  // record the directions for inCount cells starting at (inI, inJ)
+  void Set(uint32 inI, uint32 inJ, __m128i inB, __m128i inIx, __m128i inIy,
+           uint32 inCount)
+  {
+    // 0 if B is the maximum, else 1 if Ix is at least Iy, else -1
+    __m128i b = _mm_or_si128(_mm_cmplt_epi16(inB, inIx),
+                             _mm_cmplt_epi16(inB, inIy));
+    __m128i x = _mm_cmplt_epi16(inIx, inIy);
+    __m128i d = _mm_and_si128(b, _mm_or_si128(x, _mm_set1_epi16(1)));
+
+    int16 t[8];
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(t), d);
+    std::copy(t, t + inCount, &mTraceBack(inI, inJ));
+  }
+#endif
+
   DPData&  mTraceBack;
 };
 
@@ -1116,6 +1146,240 @@ inline void ReadEntry(const char*& inFasta, const char* inEnd,
   }
 }
 
+// --------------------------------------------------------------------
+// An encoded databank holds the residue numbers of the sequences in a FastA
+// databank packed one after the other, followed by an index and the
+// definition lines. Sequences a search would skip are left out. Numbers are
+// stored in native byte order.
+//
+//   header | residues | index, count + 1 entries | definition lines
+
+const char kEncodedDatabankSignature[8] = {
+  'x', 's', 's', 'p', 'd', 'b', '0', '1'
+};
+
+struct EncodedDatabankHeader
+{
+  char  mSignature[8];
+  uint32  mCount;      // number of sequences
+  uint32  mUnused;
+  int64  mLength;      // total number of residues
+  int64  mIndex;      // file offset of the index
+  int64  mDefLines;    // file offset of the definition lines
+};
+
+struct EncodedDatabankEntry
+{
+  int64  mResidues;    // offset of the residues, from the end of the header
+  int64  mDefLine;    // offset of the definition line, from mDefLines
+};
+
+class EncodedDatabank
+{
+  public:
+    EncodedDatabank(const fs::path& inFile);
+
+  static bool IsEncoded(const fs::path& inFile);
+
+  uint32 GetCount() const { return mHeader->mCount; }
+  int64 GetLength() const { return mHeader->mLength; }
+
+  // returns the definition line, which ends with a newline just like in a
+  // FastA file, and the number of bytes in the file used by this entry
+  const char* GetEntry(uint32 inIndex, sequence& outTarget,
+                       size_t& outSize) const;
+
+  private:
+    io::mapped_file mFile;
+    const char* mData;
+    const EncodedDatabankHeader* mHeader;
+    const EncodedDatabankEntry* mIndex;
+};
+
+EncodedDatabank::EncodedDatabank(const fs::path& inFile)
+  : mFile(inFile.string().c_str(), io::mapped_file::readonly)
+{
+  if (not mFile.is_open())
+    throw mas_exception(boost::format("Databank %s not open") % inFile);
+
+  mData = mFile.const_data();
+  mHeader = reinterpret_cast<const EncodedDatabankHeader*>(mData);
+
+  // The signature carries the format version. All offsets are checked
+  // against the size of the file here, so that a truncated or stale
+  // databank is reported instead of read out of bounds later on.
+  const int64 size = mFile.size();
+  const int64 headerSize = sizeof(EncodedDatabankHeader);
+  const int64 indexSize =
+    (static_cast<int64>(mHeader->mCount) + 1) * sizeof(EncodedDatabankEntry);
+
+  if (size < headerSize or
+      memcmp(mHeader->mSignature, kEncodedDatabankSignature,
+             sizeof(kEncodedDatabankSignature)) != 0 or
+      mHeader->mLength < 0 or
+      mHeader->mIndex < headerSize + mHeader->mLength or
+      mHeader->mIndex > size or
+      mHeader->mIndex % sizeof(int64) != 0 or
+      mHeader->mDefLines != mHeader->mIndex + indexSize or
+      mHeader->mDefLines > size)
+    throw mas_exception(boost::format("Databank %s is corrupt") % inFile);
+
+  mIndex = reinterpret_cast<const EncodedDatabankEntry*>(
+    mData + mHeader->mIndex);
+
+  // the entries must follow each other, every definition line ends with a
+  // newline and the last entry ends where the residues and the file do
+  const int64 defLinesSize = size - mHeader->mDefLines;
+  const char* defLines = mData + mHeader->mDefLines;
+
+  if (mIndex[0].mResidues != 0 or mIndex[0].mDefLine != 0 or
+      mIndex[mHeader->mCount].mResidues != mHeader->mLength or
+      mIndex[mHeader->mCount].mDefLine != defLinesSize)
+    throw mas_exception(boost::format("Databank %s is corrupt") % inFile);
+
+  for (uint32 i = 0; i < mHeader->mCount; ++i)
+  {
+    const EncodedDatabankEntry& e = mIndex[i];
+    const EncodedDatabankEntry& next = mIndex[i + 1];
+
+    if (next.mResidues <= e.mResidues or next.mDefLine <= e.mDefLine or
+        defLines[next.mDefLine - 1] != '\n')
+      throw mas_exception(boost::format("Databank %s is corrupt, entry %d") %
+                          inFile % i);
+  }
+}
+
+bool EncodedDatabank::IsEncoded(const fs::path& inFile)
+{
+  char signature[sizeof(kEncodedDatabankSignature)] = {};
+
+  fs::ifstream file(inFile, std::ios::binary);
+  file.read(signature, sizeof(signature));
+
+  return file and memcmp(signature, kEncodedDatabankSignature,
+                         sizeof(signature)) == 0;
+}
+
+const char* EncodedDatabank::GetEntry(uint32 inIndex, sequence& outTarget,
+                                      size_t& outSize) const
+{
+  const EncodedDatabankEntry& e = mIndex[inIndex];
+  const EncodedDatabankEntry& next = mIndex[inIndex + 1];
+
+  const uint8* residues = reinterpret_cast<const uint8*>(
+    mData + sizeof(EncodedDatabankHeader) + e.mResidues);
+  outTarget.assign(residues, residues + (next.mResidues - e.mResidues));
+
+  outSize = (next.mResidues - e.mResidues) + (next.mDefLine - e.mDefLine) +
+            sizeof(EncodedDatabankEntry);
+
+  return mData + mHeader->mDefLines + e.mDefLine;
+}
+
+void BuildEncodedDatabank(std::istream& inFastA, const fs::path& inDatabank)
+{
+  // The index and the definition lines are collected in two temporary
+  // files, they are appended to the residues at the end.
+  fs::path indexFile(inDatabank.string() + ".index");
+  fs::path defLineFile(inDatabank.string() + ".deflines");
+
+  fs::ofstream out(inDatabank, std::ios::binary | std::ios::trunc);
+  fs::ofstream index(indexFile, std::ios::binary | std::ios::trunc);
+  fs::ofstream defLines(defLineFile, std::ios::binary | std::ios::trunc);
+  if (not out.is_open() or not index.is_open() or not defLines.is_open())
+    throw mas_exception(boost::format("Could not create databank %s") %
+                        inDatabank);
+
+  EncodedDatabankHeader header = {};
+  memcpy(header.mSignature, kEncodedDatabankSignature,
+         sizeof(kEncodedDatabankSignature));
+  out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+  EncodedDatabankEntry entry = {};
+  std::string defLine, line;
+  sequence target;
+
+  // sequences that are empty or too long are never searched
+  auto addEntry = [&]() {
+    if (defLine.empty() or target.empty() or
+        target.length() > kMaxSequenceLength)
+      return;
+
+    index.write(reinterpret_cast<const char*>(&entry), sizeof(entry));
+    out.write(reinterpret_cast<const char*>(target.c_str()), target.length());
+    defLines << defLine << '\n';
+
+    entry.mResidues += target.length();
+    entry.mDefLine += defLine.length() + 1;
+
+    header.mCount += 1;
+    header.mLength += target.length();
+  };
+
+  while (getline(inFastA, line))
+  {
+    if (ba::starts_with(line, ">"))
+    {
+      addEntry();
+      defLine = line;
+      target.clear();
+    }
+    else if (not defLine.empty())
+    {
+      foreach (char ch, line)
+      {
+        uint8 rn = ResidueNr(ch);
+        if (rn < kResCount)
+          target += rn;
+      }
+    }
+  }
+
+  addEntry();
+
+  // the end of the last entry
+  index.write(reinterpret_cast<const char*>(&entry), sizeof(entry));
+
+  index.close();
+  defLines.close();
+
+  // align the index
+  int64 offset = sizeof(header) + entry.mResidues;
+  while (offset % sizeof(int64) != 0)
+  {
+    out.put(0);
+    ++offset;
+  }
+
+  header.mIndex = offset;
+  header.mDefLines =
+    offset + (header.mCount + 1) * sizeof(EncodedDatabankEntry);
+
+  fs::ifstream indexIn(indexFile, std::ios::binary);
+  out << indexIn.rdbuf();
+  indexIn.close();
+
+  fs::ifstream defLinesIn(defLineFile, std::ios::binary);
+  if (entry.mDefLine > 0)
+    out << defLinesIn.rdbuf();
+  defLinesIn.close();
+
+  out.seekp(0);
+  out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  out.close();
+
+  fs::remove(indexFile);
+  fs::remove(defLineFile);
+
+  if (not out)
+    throw mas_exception(boost::format("Error writing databank %s") %
+                        inDatabank);
+
+  if (VERBOSE)
+    std::cerr << "Wrote " << header.mCount << " sequences with "
+              << header.mLength << " residues to " << inDatabank << std::endl;
+}
+
 // --------------------------------------------------------------------
 
 struct Hsp
@@ -1243,11 +1507,32 @@ class BlastQuery
     void Search(const std::vector<fs::path>& inDatabanks,
                 MProgress& inProgress, uint32 inNrOfThreads);
     void WriteAsFasta(std::ostream& inStream);
+    void GetHits(std::vector<BlastHit>& outHits);
+
+    // Search for several queries at once. Each target sequence is read only
+    // once and then compared with all the queries while still in cache.
+    static void Search(const std::vector<BlastQuery*>& inQueries,
+                       const std::vector<fs::path>& inDatabanks,
+                       MProgress& inProgress, uint32 inNrOfThreads);
 
   private:
-    void SearchPart(const char* inFasta, size_t inLength,
-                    MProgress& inProgress, uint32& outDbCount,
-                    int64& outDbLength, std::vector<HitPtr>& outHits) const;
+    typedef WordHitIterator<WORDSIZE> IWordHitIterator;
+    typedef typename IWordHitIterator::WordHitIteratorStaticData StaticData;
+    typedef std::vector<std::vector<HitPtr> > HitLists;
+
+    static void SearchPart(const std::vector<BlastQuery*>& inQueries,
+                           const char* inFasta, size_t inLength,
+                           MProgress& inProgress, uint32& outDbCount,
+                           int64& outDbLength, HitLists& outHits);
+    static void SearchPart(const std::vector<BlastQuery*>& inQueries,
+                           const EncodedDatabank& inDatabank, uint32 inFirst,
+                           uint32 inLast, MProgress& inProgress,
+                           HitLists& outHits);
+    void Finish(uint32 inNrOfThreads);
+
+    HitPtr SearchTarget(const char* inEntry, const sequence& inTarget,
+                        IWordHitIterator& inIter,
+                        DiagonalStartTable& inDiagonals) const;
 
     int32 Extend(int32& ioQueryStart, const sequence& inTarget,
                       int32& ioTargetStart, int32& ioDistance) const;
@@ -1256,15 +1541,20 @@ class BlastQuery
                       Iterator2 inTargetBegin, Iterator2 inTargetEnd,
                       TraceBack& inTraceBack, int32 inDropOff,
                       uint32& outBestX, uint32& outBestY) const;
+#if XSSP_SIMD_GAPPED
+    template<class Iterator1, class Iterator2, class TraceBack>
+    bool AlignGappedSIMD(Iterator1 inQueryBegin, Iterator1 inQueryEnd,
+                         Iterator2 inTargetBegin, Iterator2 inTargetEnd,
+                         TraceBack& inTraceBack, int32 inDropOff,
+                         int32& outScore, uint32& outBestX,
+                         uint32& outBestY) const;
+#endif
 
     int32 AlignGappedFirst(const sequence& inTarget, Hsp& ioHsp) const;
     int32 AlignGappedSecond(const sequence& inTarget, Hsp& ioHsp) const;
 
     void AddHit(HitPtr inHit, std::vector<HitPtr>& inHitList) const;
 
-    typedef WordHitIterator<WORDSIZE> IWordHitIterator;
-    typedef typename IWordHitIterator::WordHitIteratorStaticData StaticData;
-
     std::string mUnfiltered;
     sequence mQuery;
     Matrix mMatrix;
@@ -1285,6 +1575,9 @@ class BlastQuery
     std::vector<HitPtr> mHits;
 
     StaticData mWordHitData;
+
+    // the scoring matrix as a full square, one row per residue
+    int16 mProfile[kResCount * kResCount];
 };
 
 template<int WORDSIZE>
@@ -1333,6 +1626,12 @@ BlastQuery<WORDSIZE>::BlastQuery(const std::string& inQuery, bool inFilter,
       (kLn2 * kGapTrigger + log(mMatrix.GappedKappa())) / mMatrix.GappedLambda());
 
   IWordHitIterator::Init(mQuery, mMatrix, kThreshold, mWordHitData);
+
+  for (uint8 a = 0; a < kResCount; ++a)
+  {
+    for (uint8 b = 0; b < kResCount; ++b)
+      mProfile[a * kResCount + b] = mMatrix(a, b);
+  }
 }
 
 template<int WORDSIZE>
@@ -1344,8 +1643,59 @@ template<int WORDSIZE>
 void BlastQuery<WORDSIZE>::Search(const std::vector<fs::path>& inDatabanks,
                                   MProgress& inProgress, uint32 inNrOfThreads)
 {
+  std::vector<BlastQuery*> queries(1, this);
+  Search(queries, inDatabanks, inProgress, inNrOfThreads);
+}
+
+template<int WORDSIZE>
+void BlastQuery<WORDSIZE>::Search(const std::vector<BlastQuery*>& inQueries,
+                                  const std::vector<fs::path>& inDatabanks,
+                                  MProgress& inProgress, uint32 inNrOfThreads)
+{
+  uint32 dbCount = 0;
+  int64 dbLength = 0;
+  HitLists hits(inQueries.size());
+
+  boost::mutex m;
+  auto merge = [&m, &hits](HitLists& inHits) {
+    boost::mutex::scoped_lock lock(m);
+    for (uint32 q = 0; q < hits.size(); ++q)
+      hits[q].insert(hits[q].end(), inHits[q].begin(), inHits[q].end());
+  };
+
   foreach (const fs::path& p, inDatabanks)
   {
+    if (EncodedDatabank::IsEncoded(p))
+    {
+      EncodedDatabank db(p);
+
+      dbCount += db.GetCount();
+      dbLength += db.GetLength();
+
+      if (inNrOfThreads <= 1)
+        SearchPart(inQueries, db, 0, db.GetCount(), inProgress, hits);
+      else
+      {
+        MTaskGroup t;
+
+        uint32 n = db.GetCount() / inNrOfThreads + 1;
+        for (uint32 first = 0; first < db.GetCount(); first += n)
+        {
+          uint32 last = std::min(first + n, db.GetCount());
+
+          t.Run([&inQueries, &db, first, last, &inProgress, &merge]() {
+            HitLists partHits(inQueries.size());
+            SearchPart(inQueries, db, first, last, inProgress, partHits);
+            merge(partHits);
+          });
+        }
+
+        t.Wait();
+      }
+
+      continue;
+    }
+
     io::mapped_file file(p.string().c_str(), io::mapped_file::readonly);
     if (not file.is_open())
       throw mas_exception(boost::format("FastA file %s not open") % p);
@@ -1354,11 +1704,10 @@ void BlastQuery<WORDSIZE>::Search(const std::vector<fs::path>& inDatabanks,
     size_t length = file.size();
 
     if (inNrOfThreads <= 1)
-      SearchPart(data, length, inProgress, mDbCount, mDbLength, mHits);
+      SearchPart(inQueries, data, length, inProgress, dbCount, dbLength, hits);
     else
     {
-      boost::thread_group t;
-      boost::mutex m;
+      MTaskGroup t;
 
       size_t k = length / inNrOfThreads;
       for (uint32 i = 0; i < inNrOfThreads and length > 0; ++i)
@@ -1370,27 +1719,41 @@ void BlastQuery<WORDSIZE>::Search(const std::vector<fs::path>& inDatabanks,
         while (n < length and *end != '>')
           ++end, ++n;
 
-        t.create_thread([data, n, &m, &inProgress, this]() {
-          uint32 dbCount = 0;
-          int64 dbLength = 0;
-          std::vector<HitPtr> hits;
+        t.Run([&inQueries, data, n, &m, &inProgress, &merge, &dbCount,
+               &dbLength]() {
+          uint32 partCount = 0;
+          int64 partLength = 0;
+          HitLists partHits(inQueries.size());
 
-          this->SearchPart(data, n, inProgress, dbCount, dbLength, hits);
+          SearchPart(inQueries, data, n, inProgress, partCount, partLength,
+                     partHits);
+          merge(partHits);
 
           boost::mutex::scoped_lock lock(m);
-          mDbCount += dbCount;
-          mDbLength += dbLength;
-          this->mHits.insert(mHits.end(), hits.begin(), hits.end());
+          dbCount += partCount;
+          dbLength += partLength;
         });
 
         data += n;
         length -= n;
       }
 
-      t.join_all();
+      t.Wait();
     }
   }
 
+  for (uint32 q = 0; q < inQueries.size(); ++q)
+  {
+    inQueries[q]->mDbCount += dbCount;
+    inQueries[q]->mDbLength += dbLength;
+    inQueries[q]->mHits.swap(hits[q]);
+    inQueries[q]->Finish(inNrOfThreads);
+  }
+}
+
+template<int WORDSIZE>
+void BlastQuery<WORDSIZE>::Finish(uint32 inNrOfThreads)
+{
   int32 lengthAdjustment = ncbi::BlastComputeLengthAdjustment(
       mMatrix, static_cast<uint32>(mQuery.length()), mDbLength, mDbCount);
 
@@ -1399,34 +1762,17 @@ void BlastQuery<WORDSIZE>::Search(const std::vector<fs::path>& inDatabanks,
 
   mSearchSpace = effectiveDbLength * effectiveQueryLength;
 
-  if (not mHits.empty())
-  {
-    boost::thread_group t;
-    boost::detail::atomic_count ix(-1);
+  double lambda = mMatrix.GappedLambda();
+  double logK = log(mMatrix.GappedKappa());
 
-    for (uint32 i = 0; i < inNrOfThreads; ++i)
-    {
-      t.create_thread([this, &ix]() {
-        double lambda = mMatrix.GappedLambda();
-        double logK = log(mMatrix.GappedKappa());
+  ParallelFor(mHits.size(), [this, lambda, logK](uint32 i) {
+    HitPtr hit = mHits[i];
 
-        for (;;)
-        {
-          uint32 next = ++ix;
-          if (next >= mHits.size())
-            break;
-
-          HitPtr hit = mHits[next];
+    foreach (Hsp& hsp, hit->mHsps)
+      hsp.mScore = this->AlignGappedSecond(hit->mTarget, hsp);
 
-          foreach (Hsp& hsp, hit->mHsps)
-            hsp.mScore = this->AlignGappedSecond(hit->mTarget, hsp);
-
-          hit->Cleanup(mSearchSpace, lambda, logK, mExpect);
-        }
-      });
-    }
-    t.join_all();
-  }
+    hit->Cleanup(mSearchSpace, lambda, logK, mExpect);
+  }, inNrOfThreads);
 
   mHits.erase(
     remove_if(mHits.begin(), mHits.end(),
@@ -1463,30 +1809,91 @@ void BlastQuery<WORDSIZE>::WriteAsFasta(std::ostream& inStream)
   }
 }
 
+// Split the id of a FastA definition line into an id and an accession
+// number. For UniProt ids, like sp|P12345|NAME_HUMAN, these are the last two
+// fields. For other ids with up to four fields after the databank name, both
+// are the part following that name.
+void ParseFastAId(const std::string& inId, std::string& outId,
+                  std::string& outAcc)
+{
+  outId = outAcc = inId;
+
+  std::string::size_type n = 0;
+  while (n < inId.length() and
+         (isalnum(static_cast<unsigned char>(inId[n])) or inId[n] == '_'))
+    ++n;
+
+  if (n == 0 or n == inId.length() or inId[n] != '|')
+    return;
+
+  std::vector<std::string> fields;
+  ba::split(fields, inId.substr(n + 1), ba::is_any_of("|"));
+
+  if (fields.size() > 4 or
+      find_if(fields.begin() + 1, fields.end(),
+              [](const std::string& f) -> bool { return f.empty(); }) !=
+        fields.end())
+    return;
+
+  std::string db = inId.substr(0, n);
+  if (db == "sp" or db == "tr")
+  {
+    outAcc = fields[0];
+    outId = fields.size() > 1 ? fields[1] : std::string();
+  }
+  else
+    outId = outAcc = inId.substr(n);
+}
+
+template<int WORDSIZE>
+void BlastQuery<WORDSIZE>::GetHits(std::vector<BlastHit>& outHits)
+{
+  outHits.clear();
+  outHits.reserve(mHits.size());
+
+  foreach (HitPtr hit, mHits)
+  {
+    outHits.push_back(BlastHit());
+    BlastHit& result = outHits.back();
+
+    std::string::size_type b = ba::starts_with(hit->mDefLine, ">") ? 1 : 0;
+    std::string::size_type s = hit->mDefLine.find(' ', b);
+
+    ParseFastAId(hit->mDefLine.substr(b, s == std::string::npos ? s : s - b),
+                 result.mId, result.mAcc);
+    if (s != std::string::npos)
+      result.mDef = hit->mDefLine.substr(s + 1);
+
+    result.mTarget = hit->mTarget;
+
+    foreach (const Hsp& hsp, hit->mHsps)
+    {
+      BlastHsp h = { hsp.mQueryStart, hsp.mQueryEnd,
+                     hsp.mTargetStart, hsp.mTargetEnd };
+      result.mHsps.push_back(h);
+    }
+  }
+}
+
 template<int WORDSIZE>
-void BlastQuery<WORDSIZE>::SearchPart(const char* inFasta, size_t inLength,
+void BlastQuery<WORDSIZE>::SearchPart(const std::vector<BlastQuery*>& inQueries,
+                                      const char* inFasta, size_t inLength,
                                       MProgress& inProgress,
-  uint32& outDbCount, int64& outDbLength, std::vector<HitPtr>& outHits) const
+                                      uint32& outDbCount, int64& outDbLength,
+                                      HitLists& outHits)
 {
   const char* end = inFasta + inLength;
-  int32 queryLength = static_cast<int32>(mQuery.length());
 
-  IWordHitIterator iter(mWordHitData);
+  std::vector<IWordHitIterator> iters;
+  foreach (const BlastQuery* q, inQueries)
+    iters.push_back(IWordHitIterator(q->mWordHitData));
+
   DiagonalStartTable diagonals;
   sequence target;
   target.reserve(kMaxSequenceLength);
 
-  int64 hitsToDb = 0, extensions = 0, successfulExtensions = 0;
-  HitPtr hit;
-
   while (inFasta != end)
   {
-    if (hit)
-    {
-      AddHit(hit, outHits);
-      hit.reset();
-    }
-
     const char* entry = inFasta;
     ReadEntry(inFasta, end, target);
 
@@ -1498,69 +1905,111 @@ void BlastQuery<WORDSIZE>::SearchPart(const char* inFasta, size_t inLength,
     outDbCount += 1;
     outDbLength += target.length();
 
-    iter.Reset(target);
-    diagonals.Reset(queryLength, static_cast<int32>(target.length()));
-
-    uint16 queryOffset, targetOffset;
-    while (iter.Next(queryOffset, targetOffset))
+    for (uint32 q = 0; q < inQueries.size(); ++q)
     {
-      ++hitsToDb;
+      HitPtr hit = inQueries[q]->SearchTarget(entry, target, iters[q],
+                                              diagonals);
+      if (hit)
+        inQueries[q]->AddHit(hit, outHits[q]);
+    }
+  }
+}
 
-      int32& ds = diagonals(queryOffset, targetOffset);
-      int32 distance = queryOffset - ds;
+template<int WORDSIZE>
+void BlastQuery<WORDSIZE>::SearchPart(const std::vector<BlastQuery*>& inQueries,
+                                      const EncodedDatabank& inDatabank,
+                                      uint32 inFirst, uint32 inLast,
+                                      MProgress& inProgress, HitLists& outHits)
+{
+  std::vector<IWordHitIterator> iters;
+  foreach (const BlastQuery* q, inQueries)
+    iters.push_back(IWordHitIterator(q->mWordHitData));
 
-      if (distance >= kHitWindow)
-        ds = queryOffset;
-      else if (distance > WORDSIZE)
-      {
-        int32 queryStart = ds;
-        int32 targetStart = targetOffset - distance;
-        int32 alignmentDistance = distance + WORDSIZE;
+  DiagonalStartTable diagonals;
+  sequence target;
+  target.reserve(kMaxSequenceLength);
 
-        if (targetStart < 0 or queryStart < 0)
-          continue;
+  for (uint32 i = inFirst; i < inLast; ++i)
+  {
+    size_t size;
+    const char* entry = inDatabank.GetEntry(i, target, size);
 
-        ++extensions;
+    inProgress.Consumed(size);
 
-        int32 score = Extend(queryStart, target, targetStart,
-                             alignmentDistance);
+    for (uint32 q = 0; q < inQueries.size(); ++q)
+    {
+      HitPtr hit = inQueries[q]->SearchTarget(entry, target, iters[q],
+                                              diagonals);
+      if (hit)
+        inQueries[q]->AddHit(hit, outHits[q]);
+    }
+  }
+}
 
-        if (score >= mS1)
-        {
-          ++successfulExtensions;
+template<int WORDSIZE>
+HitPtr BlastQuery<WORDSIZE>::SearchTarget(const char* inEntry,
+                                          const sequence& inTarget,
+                                          IWordHitIterator& inIter,
+                                          DiagonalStartTable& inDiagonals) const
+{
+  int32 queryLength = static_cast<int32>(mQuery.length());
+  HitPtr hit;
 
-          Hsp hsp;
+  inIter.Reset(inTarget);
+  inDiagonals.Reset(queryLength, static_cast<int32>(inTarget.length()));
 
-          // extension results, to be updated later
-          hsp.mQueryStart = queryStart;
-          hsp.mQueryEnd = queryStart + alignmentDistance;
-          hsp.mTargetStart = targetStart;
-          hsp.mTargetEnd = targetStart + alignmentDistance;
+  uint16 queryOffset, targetOffset;
+  while (inIter.Next(queryOffset, targetOffset))
+  {
+    int32& ds = inDiagonals(queryOffset, targetOffset);
+    int32 distance = queryOffset - ds;
 
-          if (not hit)
-            hit.reset(new Hit(entry, target));
+    if (distance >= kHitWindow)
+      ds = queryOffset;
+    else if (distance > WORDSIZE)
+    {
+      int32 queryStart = ds;
+      int32 targetStart = targetOffset - distance;
+      int32 alignmentDistance = distance + WORDSIZE;
 
-          if (mGapped)
-            hsp.mScore = AlignGappedFirst(target, hsp);
-          else
-          {
-            hsp.mScore = score;
-            hsp.mAlignedQuery = mQuery.substr(
-                hsp.mQueryStart, hsp.mQueryEnd - hsp.mQueryStart);
-            hsp.mAlignedTarget = hit->mTarget.substr(
-                hsp.mTargetStart, hsp.mTargetEnd - hsp.mTargetStart);
-          }
+      if (targetStart < 0 or queryStart < 0)
+        continue;
+
+      int32 score = Extend(queryStart, inTarget, targetStart,
+                           alignmentDistance);
 
-          hit->AddHsp(hsp);
+      if (score >= mS1)
+      {
+        Hsp hsp;
+
+        // extension results, to be updated later
+        hsp.mQueryStart = queryStart;
+        hsp.mQueryEnd = queryStart + alignmentDistance;
+        hsp.mTargetStart = targetStart;
+        hsp.mTargetEnd = targetStart + alignmentDistance;
+
+        if (not hit)
+          hit.reset(new Hit(inEntry, inTarget));
+
+        if (mGapped)
+          hsp.mScore = AlignGappedFirst(inTarget, hsp);
+        else
+        {
+          hsp.mScore = score;
+          hsp.mAlignedQuery = mQuery.substr(
+              hsp.mQueryStart, hsp.mQueryEnd - hsp.mQueryStart);
+          hsp.mAlignedTarget = hit->mTarget.substr(
+              hsp.mTargetStart, hsp.mTargetEnd - hsp.mTargetStart);
         }
 
-        ds = queryStart + alignmentDistance;
+        hit->AddHsp(hsp);
       }
+
+      ds = queryStart + alignmentDistance;
     }
   }
 
-  if (hit)
-    AddHit(hit, outHits);
+  return hit;
 }
 
 template<int WORDSIZE>
@@ -1627,6 +2076,13 @@ int32 BlastQuery<WORDSIZE>::AlignGapped(
     Iterator2 inTargetEnd, TraceBack& inTraceBack, int32 inDropOff,
     uint32& outBestX, uint32& outBestY) const
 {
+#if XSSP_SIMD_GAPPED
+  int32 result;
+  if (AlignGappedSIMD(inQueryBegin, inQueryEnd, inTargetBegin, inTargetEnd,
+                      inTraceBack, inDropOff, result, outBestX, outBestY))
+    return result;
+#endif
+
   const Matrix& s = mMatrix;  // for readability
   TraceBack& tb_max = inTraceBack;
   int32 d = s.OpenCost();
@@ -1771,6 +2227,235 @@ int32 BlastQuery<WORDSIZE>::AlignGapped(
   return bestScore;
 }
 
+#if XSSP_SIMD_GAPPED
+
+// The same extension as AlignGapped, computing the cells of a column eight
+// at a time in 16 bit lanes, and keeping only the previous column. The
+// values of the match and gap states do not depend on the running best score,
+// only the band limits and the drop off tests do. Those are checked per
+// block, and cell by cell only when a block contains a new best score or a
+// cell below the drop off. Returns false, and the caller falls back to the
+// scalar code, when scores get close to the lower limit of an int16.
+
+template<int WORDSIZE>
+template<class Iterator1, class Iterator2, class TraceBack>
+bool BlastQuery<WORDSIZE>::AlignGappedSIMD(
+    Iterator1 inQueryBegin, Iterator1 inQueryEnd, Iterator2 inTargetBegin,
+    Iterator2 inTargetEnd, TraceBack& inTraceBack, int32 inDropOff,
+    int32& outScore, uint32& outBestX, uint32& outBestY) const
+{
+  const int16 kFloor = -30000;
+
+  int32 d = mMatrix.OpenCost();
+  int32 e = mMatrix.ExtendCost();
+
+  uint32 dimX = static_cast<uint32>(inQueryEnd - inQueryBegin);
+  uint32 dimY = static_cast<uint32>(inTargetEnd - inTargetBegin);
+
+  if (dimX == 0 or dimY == 0)
+    return false;
+
+  // two columns of B and Ix, indexed by j and padded for a full block
+  std::vector<int16> data(4 * (dimY + 9));
+  int16* lastB = &data[0];
+  int16* lastIx = lastB + dimY + 9;
+  int16* curB = lastIx + dimY + 9;
+  int16* curIx = curB + dimY + 9;
+
+  int32 bestScore;
+  uint32 bestX, bestY;
+  uint32 colStart = 1;
+  uint32 lastColStart = 1;
+  uint32 colEnd = dimY;
+
+  // first column, as in AlignGapped
+  Iterator1 x = inQueryBegin;
+
+  int32 M = mProfile[*x * kResCount + *inTargetBegin];
+  (void)inTraceBack(M, kSentinalScore, kSentinalScore, 1, 1);
+  bestScore = curB[1] = M;
+  bestX = bestY = 1;
+  curIx[1] = M - d;
+
+  int32 Iy = M - d;
+  for (uint32 j = 2; j <= dimY; ++j)
+  {
+    int32 Bij = curB[j] = Iy;
+    inTraceBack.Set(1, j, -1);
+    curIx[j] = kSentinalScore;
+    Iy -= e;
+
+    if (Bij < bestScore - inDropOff)
+    {
+      colEnd = j;
+      break;
+    }
+  }
+
+  // kFirst[n] has the first n lanes set
+  __m128i kFirst[9];
+  for (int n = 0; n <= 8; ++n)
+  {
+    int16 m[8] = {};
+    std::fill(m, m + n, -1);
+    kFirst[n] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(m));
+  }
+
+  const __m128i sentinel = _mm_set1_epi16(kSentinalScore);
+  const __m128i lowest = _mm_set1_epi16(kFloor);
+  const __m128i open = _mm_set1_epi16(d);
+  const __m128i extend1 = _mm_set1_epi16(e);
+  const __m128i extend2 = _mm_set1_epi16(2 * e);
+  const __m128i extend4 = _mm_set1_epi16(4 * e);
+  const __m128i extendN = _mm_set_epi16(8 * e, 7 * e, 6 * e, 5 * e,
+                                        4 * e, 3 * e, 2 * e, e);
+  // fill values for lanes shifted in at the low end
+  const __m128i low1 = _mm_set_epi16(0, 0, 0, 0, 0, 0, 0, -32768);
+  const __m128i low2 = _mm_set_epi16(0, 0, 0, 0, 0, 0, -32768, -32768);
+  const __m128i low4 = _mm_set_epi16(0, 0, 0, 0,
+                                     -32768, -32768, -32768, -32768);
+
+  // remaining columns
+  ++x;
+  for (uint32 i = 2; x != inQueryEnd and colEnd >= colStart; ++i, ++x)
+  {
+    std::swap(lastB, curB);
+    std::swap(lastIx, curIx);
+
+    const int16* scores = mProfile + *x * kResCount;
+    uint32 newColStart = colStart;
+    bool beforeFirstRow = true;
+    bool done = false;
+
+    // the band of the previous column
+    int32 firstM = static_cast<int32>(lastColStart) + 1;
+    int32 lastM = static_cast<int32>(colEnd);
+
+    int16 carry = kSentinalScore;
+
+    for (uint32 j = colStart; j <= dimY and not done; j += 8)
+    {
+      uint32 n = std::min(dimY + 1 - j, 8U);
+
+      int16 s[8] = {};
+      for (uint32 k = 0; k < n; ++k)
+        s[k] = scores[inTargetBegin[j + k - 1]];
+
+      int32 jj = static_cast<int32>(j);
+      __m128i maskM = _mm_andnot_si128(
+        kFirst[std::min(std::max(firstM - jj, 0), 8)],
+        kFirst[std::min(std::max(lastM + 1 - jj, 0), 8)]);
+      __m128i maskIx = kFirst[std::min(std::max(lastM - jj, 0), 8)];
+
+      // (1)
+      __m128i m = _mm_adds_epi16(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(lastB + j - 1)),
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(s)));
+      m = _mm_or_si128(_mm_and_si128(maskM, m),
+                       _mm_andnot_si128(maskM, sentinel));
+
+      __m128i ix1 = _mm_loadu_si128(
+        reinterpret_cast<const __m128i*>(lastIx + j));
+      ix1 = _mm_or_si128(_mm_and_si128(maskIx, ix1),
+                         _mm_andnot_si128(maskIx, sentinel));
+
+      // (3)
+      __m128i mOpen = _mm_subs_epi16(m, open);
+      __m128i ix = _mm_max_epi16(mOpen, _mm_subs_epi16(ix1, extend1));
+
+      // (4), Iy(j) = max(M(j) - d, Iy(j - 1) - e) as a running maximum
+      __m128i iy = mOpen;
+      iy = _mm_max_epi16(iy, _mm_subs_epi16(
+        _mm_or_si128(_mm_slli_si128(iy, 2), low1), extend1));
+      iy = _mm_max_epi16(iy, _mm_subs_epi16(
+        _mm_or_si128(_mm_slli_si128(iy, 4), low2), extend2));
+      iy = _mm_max_epi16(iy, _mm_subs_epi16(
+        _mm_or_si128(_mm_slli_si128(iy, 8), low4), extend4));
+      iy = _mm_max_epi16(iy, _mm_subs_epi16(_mm_set1_epi16(carry), extendN));
+
+      __m128i iy1 = _mm_insert_epi16(_mm_slli_si128(iy, 2), carry, 0);
+      carry = static_cast<int16>(_mm_extract_epi16(iy, 7));
+
+      // (2)
+      __m128i b = _mm_max_epi16(_mm_max_epi16(m, ix1), iy1);
+
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(curB + j), b);
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(curIx + j), ix);
+      inTraceBack.Set(i, j, m, ix1, iy1, n);
+
+      uint32 valid = (1U << (2 * n)) - 1;
+
+      __m128i low = _mm_min_epi16(_mm_min_epi16(b, ix), iy);
+      if (_mm_movemask_epi8(_mm_cmplt_epi16(low, lowest)) & valid)
+        return false;
+
+      __m128i best = _mm_set1_epi16(bestScore);
+      __m128i dropOff = _mm_set1_epi16(
+        std::max(bestScore - inDropOff, -32768));
+
+      if ((_mm_movemask_epi8(_mm_or_si128(_mm_cmpgt_epi16(b, best),
+                                          _mm_cmplt_epi16(b, dropOff))) &
+           valid) == 0)
+      {
+        // all cells are within the drop off and none is a new best
+        beforeFirstRow = false;
+        if (j + n - 1 > colEnd)
+          colEnd = j + n - 1;
+        continue;
+      }
+
+      for (uint32 k = 0; k < n; ++k)
+      {
+        uint32 jk = j + k;
+        int32 Bij = curB[jk];
+
+        if (Bij > bestScore)
+        {
+          bestScore = Bij;
+          bestX = i;
+          bestY = jk;
+          beforeFirstRow = false;
+        }
+        else if (Bij < bestScore - inDropOff)
+        {
+          if (beforeFirstRow)
+          {
+            newColStart = jk;
+            if (newColStart > colEnd)
+            {
+              done = true;
+              break;
+            }
+          }
+          else if (jk > bestY + 1)
+          {
+            colEnd = jk;
+            done = true;
+            break;
+          }
+        }
+        else
+        {
+          beforeFirstRow = false;
+          if (jk > colEnd)
+            colEnd = jk;
+        }
+      }
+    }
+
+    lastColStart = colStart;
+    colStart = newColStart;
+  }
+
+  outScore = bestScore;
+  outBestX = bestX;
+  outBestY = bestY;
+
+  return true;
+}
+
+#endif
+
 template<int WORDSIZE>
 int32 BlastQuery<WORDSIZE>::AlignGappedFirst(const sequence& inTarget,
                                              Hsp& ioHsp) const
@@ -1940,84 +2625,149 @@ void BlastQuery<WORDSIZE>::AddHit(HitPtr inHit,
 }
 
 
-void SearchAndWriteResultsAsFastA(
-    std::ostream& inOutFile, const std::vector<fs::path>& inDatabanks,
-    const std::string& inQuery, const std::string& inProgram,
-    const std::string& inMatrix, uint32 inWordSize, double inExpect,
-    bool inFilter, bool inGapped, int32 inGapOpen, int32 inGapExtend,
-    uint32 inReportLimit, uint32 inThreads)
+// strip the FastA header, if any, from a query
+std::string QuerySequence(const std::string& inQuery)
 {
-  if (inProgram != "blastp")
-    throw mas_exception(boost::format("Unsupported program %s") % inProgram);
-
-  if (inGapped)
-  {
-    if (inGapOpen == -1) inGapOpen = 11;
-    if (inGapExtend == -1) inGapExtend = 1;
-  }
-
-  if (inWordSize == 0) inWordSize = 3;
-
-  std::string query(inQuery), queryID("query"), queryDef;
+  std::string query(inQuery);
 
   if (ba::starts_with(inQuery, ">"))
   {
     boost::smatch m;
     if (regex_search(inQuery, m, kFastARE, boost::match_not_dot_newline))
-    {
-      queryID = m[4];
-      if (queryID.empty())
-        queryID = m[2];
-      queryDef = m[7];
       query = m.suffix();
-    }
     else
-    {
-      queryID = inQuery.substr(1, inQuery.find('\n') - 1);
-      query = inQuery.substr(queryID.length() + 2, std::string::npos);
-
-      std::string::size_type s = queryID.find(' ');
-      if (s != std::string::npos)
-      {
-        queryDef = queryID.substr(s + 1);
-        queryID.erase(s, std::string::npos);
-      }
-    }
+      query = inQuery.substr(inQuery.find('\n') + 1, std::string::npos);
   }
 
+  return query;
+}
+
+// Search for all queries in a single pass over the databanks, then write
+// the hits as FastA to inOutFiles and/or return them in outHits, whichever
+// is not null.
+template<int WORDSIZE>
+void SearchQueries(const std::vector<fs::path>& inDatabanks,
+    const std::vector<std::string>& inQueries, const std::string& inMatrix,
+    double inExpect, bool inFilter, bool inGapped, int32 inGapOpen,
+    int32 inGapExtend, uint32 inReportLimit, uint32 inThreads,
+    const std::vector<std::ostream*>* inOutFiles,
+    std::vector<std::vector<BlastHit> >* outHits)
+{
   int64 totalLength = accumulate(inDatabanks.begin(), inDatabanks.end(), 0LL,
     [](int64 l, const fs::path& p) -> int64 { return l + fs::file_size(p); });
 
   MProgress progress(totalLength, "blast");
 
+  boost::ptr_vector<BlastQuery<WORDSIZE> > queries;
+  std::vector<BlastQuery<WORDSIZE>*> queryPtrs;
+
+  foreach (const std::string& query, inQueries)
+  {
+    queries.push_back(new BlastQuery<WORDSIZE>(QuerySequence(query), inFilter,
+      inExpect, inMatrix, inGapped, inGapOpen, inGapExtend, inReportLimit));
+    queryPtrs.push_back(&queries.back());
+  }
+
+  BlastQuery<WORDSIZE>::Search(queryPtrs, inDatabanks, progress, inThreads);
+
+  if (inOutFiles != nullptr)
+  {
+    for (uint32 i = 0; i < queries.size(); ++i)
+      queries[i].WriteAsFasta(*(*inOutFiles)[i]);
+  }
+
+  if (outHits != nullptr)
+  {
+    outHits->resize(queries.size());
+    for (uint32 i = 0; i < queries.size(); ++i)
+      queries[i].GetHits((*outHits)[i]);
+  }
+}
+
+void SearchQueries(const std::vector<fs::path>& inDatabanks,
+    const std::vector<std::string>& inQueries, const std::string& inProgram,
+    const std::string& inMatrix, uint32 inWordSize, double inExpect,
+    bool inFilter, bool inGapped, int32 inGapOpen, int32 inGapExtend,
+    uint32 inReportLimit, uint32 inThreads,
+    const std::vector<std::ostream*>* inOutFiles,
+    std::vector<std::vector<BlastHit> >* outHits)
+{
+  if (inProgram != "blastp")
+    throw mas_exception(boost::format("Unsupported program %s") % inProgram);
+
+  if (inGapped)
+  {
+    if (inGapOpen == -1) inGapOpen = 11;
+    if (inGapExtend == -1) inGapExtend = 1;
+  }
+
+  if (inWordSize == 0) inWordSize = 3;
+
   switch (inWordSize)
   {
     case 2:
-    {
-      BlastQuery<2> q(query, inFilter, inExpect, inMatrix, inGapped, inGapOpen,
-                      inGapExtend, inReportLimit);
-      q.Search(inDatabanks, progress, inThreads);
-      q.WriteAsFasta(inOutFile);
+      SearchQueries<2>(inDatabanks, inQueries, inMatrix, inExpect, inFilter,
+        inGapped, inGapOpen, inGapExtend, inReportLimit, inThreads,
+        inOutFiles, outHits);
       break;
-    }
+
     case 3:
-    {
-      BlastQuery<3> q(query, inFilter, inExpect, inMatrix, inGapped, inGapOpen,
-                      inGapExtend, inReportLimit);
-      q.Search(inDatabanks, progress, inThreads);
-      q.WriteAsFasta(inOutFile);
+      SearchQueries<3>(inDatabanks, inQueries, inMatrix, inExpect, inFilter,
+        inGapped, inGapOpen, inGapExtend, inReportLimit, inThreads,
+        inOutFiles, outHits);
       break;
-    }
+
     case 4:
-    {
-      BlastQuery<4> q(query, inFilter, inExpect, inMatrix, inGapped, inGapOpen,
-                      inGapExtend, inReportLimit);
-      q.Search(inDatabanks, progress, inThreads);
-      q.WriteAsFasta(inOutFile);
+      SearchQueries<4>(inDatabanks, inQueries, inMatrix, inExpect, inFilter,
+        inGapped, inGapOpen, inGapExtend, inReportLimit, inThreads,
+        inOutFiles, outHits);
       break;
-    }
+
     default:
       throw mas_exception(
           boost::format("Unsupported word size %d") % inWordSize);
   }
 }
+
+void SearchAndWriteResultsAsFastA(
+    const std::vector<std::ostream*>& inOutFiles,
+    const std::vector<fs::path>& inDatabanks,
+    const std::vector<std::string>& inQueries, const std::string& inProgram,
+    const std::string& inMatrix, uint32 inWordSize, double inExpect,
+    bool inFilter, bool inGapped, int32 inGapOpen, int32 inGapExtend,
+    uint32 inReportLimit, uint32 inThreads)
+{
+  if (inOutFiles.size() != inQueries.size())
+    throw mas_exception("Need an output stream for every query");
+
+  SearchQueries(inDatabanks, inQueries, inProgram, inMatrix, inWordSize,
+    inExpect, inFilter, inGapped, inGapOpen, inGapExtend, inReportLimit,
+    inThreads, &inOutFiles, nullptr);
+}
+
+void SearchForHits(std::vector<std::vector<BlastHit> >& outHits,
+    const std::vector<fs::path>& inDatabanks,
+    const std::vector<std::string>& inQueries, const std::string& inProgram,
+    const std::string& inMatrix, uint32 inWordSize, double inExpect,
+    bool inFilter, bool inGapped, int32 inGapOpen, int32 inGapExtend,
+    uint32 inReportLimit, uint32 inThreads)
+{
+  SearchQueries(inDatabanks, inQueries, inProgram, inMatrix, inWordSize,
+    inExpect, inFilter, inGapped, inGapOpen, inGapExtend, inReportLimit,
+    inThreads, nullptr, &outHits);
+}
+
+void SearchAndWriteResultsAsFastA(
+    std::ostream& inOutFile, const std::vector<fs::path>& inDatabanks,
+    const std::string& inQuery, const std::string& inProgram,
+    const std::string& inMatrix, uint32 inWordSize, double inExpect,
+    bool inFilter, bool inGapped, int32 inGapOpen, int32 inGapExtend,
+    uint32 inReportLimit, uint32 inThreads)
+{
+  std::vector<std::ostream*> outFiles(1, &inOutFile);
+  std::vector<std::string> queries(1, inQuery);
+
+  SearchAndWriteResultsAsFastA(outFiles, inDatabanks, queries, inProgram,
+    inMatrix, inWordSize, inExpect, inFilter, inGapped, inGapOpen,
+    inGapExtend, inReportLimit, inThreads);
+}
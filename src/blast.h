@@ -18,19 +18,26 @@
 
 #include <vector>
 
-//struct BlastHit
-//{
-//  std::string  id;
-//  std::string  acc;
-//  std::string  def;
-//  float    score;
-//  sequence  seq;
-//};
-//
-//// blast with default parameters
-//void Blast(const std::string& seq,
-//  const std::vector<boost::filesystem::path>& db,
-//  uint32 inReportLimit, std::vector<BlastHit>& outHits);
+// Convert a FastA databank into the binary format a search can map directly.
+// Search accepts such databanks wherever a FastA databank is accepted.
+void BuildEncodedDatabank(std::istream& inFastA,
+  const boost::filesystem::path& inDatabank);
+
+// The stretch of query and target covered by a high scoring pair, the end
+// positions are exclusive.
+struct BlastHsp
+{
+  uint32 mQueryStart, mQueryEnd;
+  uint32 mTargetStart, mTargetEnd;
+};
+
+// A hit as found by a search, with its HSPs sorted by score, best first.
+struct BlastHit
+{
+  std::string mId, mAcc, mDef;
+  sequence mTarget;
+  std::vector<BlastHsp> mHsps;
+};
 
 void SearchAndWriteResultsAsFastA(std::ostream& inOutFile,
   const std::vector<boost::filesystem::path>& inDatabanks,
@@ -39,4 +46,23 @@ void SearchAndWriteResultsAsFastA(std::ostream& inOutFile,
   bool inFilter, bool inGapped, int32 inGapOpen, int32 inGapExtend,
   uint32 inReportLimit, uint32 inThreads);
 
+// As above, for several queries at once. The databanks are scanned only
+// once, the hits for inQueries[i] are written to inOutFiles[i].
+void SearchAndWriteResultsAsFastA(
+  const std::vector<std::ostream*>& inOutFiles,
+  const std::vector<boost::filesystem::path>& inDatabanks,
+  const std::vector<std::string>& inQueries, const std::string& inProgram,
+  const std::string& inMatrix, uint32 inWordSize, double inExpect,
+  bool inFilter, bool inGapped, int32 inGapOpen, int32 inGapExtend,
+  uint32 inReportLimit, uint32 inThreads);
+
+// As above, but the hits for inQueries[i] are returned in outHits[i], in the
+// order they would have been written.
+void SearchForHits(std::vector<std::vector<BlastHit> >& outHits,
+  const std::vector<boost::filesystem::path>& inDatabanks,
+  const std::vector<std::string>& inQueries, const std::string& inProgram,
+  const std::string& inMatrix, uint32 inWordSize, double inExpect,
+  bool inFilter, bool inGapped, int32 inGapOpen, int32 inGapExtend,
+  uint32 inReportLimit, uint32 inThreads);
+
 #endif
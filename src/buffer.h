@@ -4,7 +4,8 @@
 //       (See accompanying file LICENSE_1_0.txt or copy at
 //             http://www.boost.org/LICENSE_1_0.txt)
 //
-// buffer is a thread safe queue
+// buffer is a thread safe queue, lockfree_buffer is a lock free bounded
+// queue with the same interface.
 
 #ifndef XSSP_BUFFER_H
 #define XSSP_BUFFER_H
@@ -15,7 +16,10 @@
 
 #include <boost/thread/mutex.hpp>
 #include <boost/thread/condition.hpp>
+#include <boost/thread/thread.hpp>
 
+#include <atomic>
+#include <cstddef>
 #include <deque>
 
 template<class T, uint32 N = 100>
@@ -66,4 +70,138 @@ T buffer<T,N>::get()
   return result;
 }
 
+// --------------------------------------------------------------------
+// lockfree_buffer is a ring of N cells for multiple producers and multiple
+// consumers (D. Vyukov's bounded MPMC queue). Every cell carries a sequence
+// number telling whether it is ready to be written or read for the current
+// lap, producers and consumers claim a position with a compare and swap on
+// their own counter. put and get spin and then yield while the buffer is
+// full or empty, they never block on a lock.
+
+template<class T, uint32 N = 100>
+class lockfree_buffer
+{
+  public:
+
+            lockfree_buffer();
+
+  void        put(T inValue);
+  T          get();
+
+  bool        try_put(const T& inValue);
+  bool        try_get(T& outValue);
+
+  private:
+            lockfree_buffer(const lockfree_buffer&);
+  lockfree_buffer&  operator=(const lockfree_buffer&);
+
+  static void      backoff(uint32& ioSpins);
+
+  struct cell
+  {
+    std::atomic<size_t>  m_sequence;
+    T          m_value;
+  };
+
+  // keep the counters of producers and consumers on separate cache lines
+  char        m_pad0[64];
+  cell        m_cells[N];
+  char        m_pad1[64];
+  std::atomic<size_t>  m_put;
+  char        m_pad2[64];
+  std::atomic<size_t>  m_get;
+  char        m_pad3[64];
+};
+
+template<class T, uint32 N>
+lockfree_buffer<T,N>::lockfree_buffer()
+  : m_put(0)
+  , m_get(0)
+{
+  for (uint32 i = 0; i < N; ++i)
+    m_cells[i].m_sequence.store(i, std::memory_order_relaxed);
+}
+
+template<class T, uint32 N>
+bool lockfree_buffer<T,N>::try_put(const T& inValue)
+{
+  size_t pos = m_put.load(std::memory_order_relaxed);
+
+  for (;;)
+  {
+    cell& c = m_cells[pos % N];
+    size_t seq = c.m_sequence.load(std::memory_order_acquire);
+    ptrdiff_t diff = static_cast<ptrdiff_t>(seq) - static_cast<ptrdiff_t>(pos);
+
+    if (diff == 0)
+    {
+      if (m_put.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+      {
+        c.m_value = inValue;
+        c.m_sequence.store(pos + 1, std::memory_order_release);
+        return true;
+      }
+    }
+    else if (diff < 0)  // the cell still holds the value of the previous lap
+      return false;
+    else
+      pos = m_put.load(std::memory_order_relaxed);
+  }
+}
+
+template<class T, uint32 N>
+bool lockfree_buffer<T,N>::try_get(T& outValue)
+{
+  size_t pos = m_get.load(std::memory_order_relaxed);
+
+  for (;;)
+  {
+    cell& c = m_cells[pos % N];
+    size_t seq = c.m_sequence.load(std::memory_order_acquire);
+    ptrdiff_t diff =
+      static_cast<ptrdiff_t>(seq) - static_cast<ptrdiff_t>(pos + 1);
+
+    if (diff == 0)
+    {
+      if (m_get.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+      {
+        outValue = c.m_value;
+        c.m_sequence.store(pos + N, std::memory_order_release);
+        return true;
+      }
+    }
+    else if (diff < 0)  // nothing written in this cell yet
+      return false;
+    else
+      pos = m_get.load(std::memory_order_relaxed);
+  }
+}
+
+template<class T, uint32 N>
+void lockfree_buffer<T,N>::backoff(uint32& ioSpins)
+{
+  if (++ioSpins > 64)
+    boost::this_thread::yield();
+}
+
+template<class T, uint32 N>
+void lockfree_buffer<T,N>::put(T inValue)
+{
+  uint32 spins = 0;
+  while (not try_put(inValue))
+    backoff(spins);
+}
+
+template<class T, uint32 N>
+T lockfree_buffer<T,N>::get()
+{
+  T result;
+
+  uint32 spins = 0;
+  while (not try_get(result))
+    backoff(spins);
+
+  return result;
+}
+
 #endif
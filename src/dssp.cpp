@@ -7,13 +7,13 @@
 #include "mas.h"
 
 #include "dssp.h"
+#include "format.h"
 #include "structure.h"
 
 #include <boost/bind.hpp>
 #include <boost/date_time/date_clock_device.hpp>
 #include <boost/date_time/gregorian/gregorian.hpp>
 #include <boost/foreach.hpp>
-#include <boost/format.hpp>
 
 #if defined(_MSC_VER)
 #include <conio.h>
@@ -25,23 +25,12 @@
 #define foreach BOOST_FOREACH
 
 
-std::string ResidueToDSSPLine(const MResidue& residue)
+namespace
 {
-/*
-  This is the header line for the residue lines in a DSSP file:
-
-  #  RESIDUE AA STRUCTURE BP1 BP2  ACC     N-H-->O    O-->H-N    N-H-->O    O-->H-N    TCO  KAPPA ALPHA  PHI   PSI    X-CA   Y-CA   Z-CA           CHAIN
- */
-  boost::format kDSSPResidueLine(
-  "%5.5d%5.5d%1.1s%1.1s %c  %c %c%c%c%c%c%c%c%4.4d%4.4d%c%4.4d %11s%11s%11s%11s %6.3f%6.1f%6.1f%6.1f%6.1f %6.1f %6.1f %6.1f           %4.4s");
-
-  const MAtom& ca = residue.GetCAlpha();
-
-  char code = kResidueInfo[residue.GetType()].code;
-  if (residue.GetType() == kCysteine and residue.GetSSBridgeNr() != 0)
-    code = 'a' + ((residue.GetSSBridgeNr() - 1) % 26);
 
-  char ss;
+char SecondaryStructureCode(const MResidue& residue)
+{
+  char ss = ' ';
   switch (residue.GetSecondaryStructure())
   {
     case alphahelix:  ss = 'H'; break;
@@ -53,6 +42,37 @@ std::string ResidueToDSSPLine(const MResidue& residue)
     case bend:      ss = 'S'; break;
     case loop:      ss = ' '; break;
   }
+  return ss;
+}
+
+// the residues of all chains, sorted by the residue number assigned while
+// reading the structure
+void GetResidues(const MProtein& protein,
+                 std::vector<const MResidue*>& residues)
+{
+  foreach (const MChain* chain, protein.GetChains())
+  {
+    foreach (const MResidue* residue, chain->GetResidues())
+      residues.push_back(residue);
+  }
+
+  sort(residues.begin(), residues.end(), boost::bind(&MResidue::GetNumber, _1) < boost::bind(&MResidue::GetNumber, _2));
+}
+
+void WriteResidueLine(format_buffer& b, const MResidue& residue)
+{
+/*
+  This is the header line for the residue lines in a DSSP file:
+
+  #  RESIDUE AA STRUCTURE BP1 BP2  ACC     N-H-->O    O-->H-N    N-H-->O    O-->H-N    TCO  KAPPA ALPHA  PHI   PSI    X-CA   Y-CA   Z-CA           CHAIN
+ */
+  const MAtom& ca = residue.GetCAlpha();
+
+  char code = kResidueInfo[residue.GetType()].code;
+  if (residue.GetType() == kCysteine and residue.GetSSBridgeNr() != 0)
+    code = 'a' + ((residue.GetSSBridgeNr() - 1) % 26);
+
+  char ss = SecondaryStructureCode(residue);
 
   char helix[3];
   for (uint32 stride = 3; stride <= 5; ++stride)
@@ -94,29 +114,9 @@ std::string ResidueToDSSPLine(const MResidue& residue)
   if (residue.GetSheet() != 0)
     sheet = 'A' + (residue.GetSheet() - 1) % 26;
 
-  std::string NHO[2], ONH[2];
-  const HBond* acceptors = residue.Acceptor();
-  const HBond* donors = residue.Donor();
-  for (uint32 i = 0; i < 2; ++i)
-  {
-    NHO[i] = ONH[i] = "0, 0.0";
-
-    if (acceptors[i].residue != nullptr)
-    {
-      int32 d = acceptors[i].residue->GetNumber() - residue.GetNumber();
-      NHO[i] = (boost::format("%d,%3.1f") % d % acceptors[i].energy).str();
-    }
-
-    if (donors[i].residue != nullptr)
-    {
-      int32 d = donors[i].residue->GetNumber() - residue.GetNumber();
-      ONH[i] = (boost::format("%d,%3.1f") % d % donors[i].energy).str();
-    }
-  }
-
   std::string chainChar = ca.mChainID,
                           long_ChainID = "";
-  if (ca.mChainID.length () > 1)
+  if (ca.mChainID.str().length() > 1)
   {
     // For mmCIF compatibility
 
@@ -124,18 +124,58 @@ std::string ResidueToDSSPLine(const MResidue& residue)
     long_ChainID = ca.mChainID;
   }
 
-  return (kDSSPResidueLine % residue.GetNumber() % ca.mResSeq % ca.mICode % chainChar % code %
-    ss % helix[0] % helix[1] % helix[2] % bend % chirality % bridgelabel[0] % bridgelabel[1] %
-    bp[0] % bp[1] % sheet % floor(residue.Accessibility() + 0.5) %
-    NHO[0] % ONH[0] % NHO[1] % ONH[1] %
-    residue.TCO() % residue.Kappa() % alpha % residue.Phi() % residue.Psi() %
-    ca.mLoc.mX % ca.mLoc.mY % ca.mLoc.mZ % long_ChainID).str();
+  b.integer(residue.GetNumber(), 5).integer(ca.mResSeq, 5)
+   .string(ca.mICode, 1, 1).string(chainChar, 1, 1)
+   .put(' ').put(code).put("  ").put(ss).put(' ')
+   .put(helix[0]).put(helix[1]).put(helix[2]).put(bend).put(chirality)
+   .put(bridgelabel[0]).put(bridgelabel[1])
+   .integer(bp[0], 4).integer(bp[1], 4).put(sheet)
+   .general(floor(residue.Accessibility() + 0.5), 4, 4).put(' ');
+
+  // the N-H-->O and O-->H-N columns, alternating acceptors and donors
+  const HBond* hbonds[2] = { residue.Acceptor(), residue.Donor() };
+  for (uint32 i = 0; i < 4; ++i)
+  {
+    const HBond& hbond = hbonds[i % 2][i / 2];
+    std::string::size_type start = b.size();
+
+    if (hbond.residue == nullptr)
+      b.put("0, 0.0");
+    else
+    {
+      int32 d = hbond.residue->GetNumber() - residue.GetNumber();
+      b.integer(d).put(',').fixed(hbond.energy, 3, 1);
+    }
+
+    b.align(start, 11);
+  }
+
+  b.put(' ').fixed(residue.TCO(), 6, 3).fixed(residue.Kappa(), 6, 1)
+   .fixed(alpha, 6, 1).fixed(residue.Phi(), 6, 1).fixed(residue.Psi(), 6, 1)
+   .put(' ').fixed(ca.mLoc.mX, 6, 1).put(' ').fixed(ca.mLoc.mY, 6, 1)
+   .put(' ').fixed(ca.mLoc.mZ, 6, 1).put(' ', 11).string(long_ChainID, 4, 4);
+}
+
+// a line of the header, with a dot in column 128 unless the text itself
+// spans lines
+void WriteHeaderLine(format_buffer& b, const std::string& text)
+{
+  std::string::size_type start = b.size();
+  b.put(text).put(' ').tab(127, start).put(".\n");
+}
+
+}
+
+std::string ResidueToDSSPLine(const MResidue& residue)
+{
+  format_buffer b;
+  WriteResidueLine(b, residue);
+  return b.str();
 }
 
 void WriteDSSP(MProtein& protein, std::ostream& os)
 {
   const std::string kFirstLine("==== Secondary Structure Definition by the program DSSP, CMBI version 2.0                          ==== ");
-  boost::format kHeaderLine("%1% %|127t|%2%");
 
   using namespace boost::gregorian;
 
@@ -146,15 +186,17 @@ void WriteDSSP(MProtein& protein, std::ostream& os)
 
   date today = day_clock::local_day();
 
-  os << kHeaderLine % (kFirstLine + "DATE=" + to_iso_extended_string(today)) % '.' << std::endl;
-  os << kHeaderLine % "REFERENCE W. KABSCH AND C.SANDER, BIOPOLYMERS 22 (1983) 2577-2637" % '.' << std::endl;
-  os << kHeaderLine % protein.GetHeader() % '.' << std::endl;
+  format_buffer b;
+
+  WriteHeaderLine(b, kFirstLine + "DATE=" + to_iso_extended_string(today));
+  WriteHeaderLine(b, "REFERENCE W. KABSCH AND C.SANDER, BIOPOLYMERS 22 (1983) 2577-2637");
+  WriteHeaderLine(b, protein.GetHeader());
   if (not protein.GetCompound().empty())
-    os << kHeaderLine % protein.GetCompound() % '.' << std::endl;
+    WriteHeaderLine(b, protein.GetCompound());
   if (not protein.GetSource().empty())
-    os << kHeaderLine % protein.GetSource() % '.' << std::endl;
+    WriteHeaderLine(b, protein.GetSource());
   if (not protein.GetAuthor().empty())
-    os << kHeaderLine % protein.GetAuthor() % '.' << std::endl;
+    WriteHeaderLine(b, protein.GetAuthor());
 
   double accessibleSurface = 0;  // calculate accessibility as
   foreach (const MChain* chain, protein.GetChains())
@@ -163,73 +205,73 @@ void WriteDSSP(MProtein& protein, std::ostream& os)
       accessibleSurface += residue->Accessibility();
   }
 
-  os << boost::format("%5.5d%3.3d%3.3d%3.3d%3.3d TOTAL NUMBER OF RESIDUES, NUMBER OF CHAINS, NUMBER OF SS-BRIDGES(TOTAL,INTRACHAIN,INTERCHAIN) %|127t|%c") %
-       nrOfResidues % nrOfChains % nrOfSSBridges % nrOfIntraChainSSBridges % (nrOfSSBridges - nrOfIntraChainSSBridges) % '.' << std::endl;
-     os << kHeaderLine % (boost::format("%8.1f   ACCESSIBLE SURFACE OF PROTEIN (ANGSTROM**2)") % accessibleSurface) % '.' << std::endl;
+  b.integer(nrOfResidues, 5).integer(nrOfChains, 3).integer(nrOfSSBridges, 3)
+   .integer(nrOfIntraChainSSBridges, 3)
+   .integer(nrOfSSBridges - nrOfIntraChainSSBridges, 3)
+   .put(" TOTAL NUMBER OF RESIDUES, NUMBER OF CHAINS, NUMBER OF SS-BRIDGES(TOTAL,INTRACHAIN,INTERCHAIN) ")
+   .tab(127).put(".\n");
+  b.fixed(accessibleSurface, 8, 1)
+   .put("   ACCESSIBLE SURFACE OF PROTEIN (ANGSTROM**2) ").tab(127).put(".\n");
 
   // hydrogenbond summary
 
-  os << kHeaderLine % (
-    boost::format("%5.5d%5.1f   TOTAL NUMBER OF HYDROGEN BONDS OF TYPE O(I)-->H-N(J)  , SAME NUMBER PER 100 RESIDUES")
-      % nrOfHBonds % (nrOfHBonds * 100.0 / nrOfResidues)) % '.' << std::endl;
+  b.integer(nrOfHBonds, 5).fixed(nrOfHBonds * 100.0 / nrOfResidues, 5, 1)
+   .put("   TOTAL NUMBER OF HYDROGEN BONDS OF TYPE O(I)-->H-N(J)  , SAME NUMBER PER 100 RESIDUES ")
+   .tab(127).put(".\n");
 
   uint32 nrOfHBondsInParallelBridges = protein.GetNrOfHBondsInParallelBridges();
-  os << kHeaderLine % (
-    boost::format("%5.5d%5.1f   TOTAL NUMBER OF HYDROGEN BONDS IN     PARALLEL BRIDGES, SAME NUMBER PER 100 RESIDUES")
-      % nrOfHBondsInParallelBridges % (nrOfHBondsInParallelBridges * 100.0 / nrOfResidues)) % '.' << std::endl;
+  b.integer(nrOfHBondsInParallelBridges, 5)
+   .fixed(nrOfHBondsInParallelBridges * 100.0 / nrOfResidues, 5, 1)
+   .put("   TOTAL NUMBER OF HYDROGEN BONDS IN     PARALLEL BRIDGES, SAME NUMBER PER 100 RESIDUES ")
+   .tab(127).put(".\n");
 
   uint32 nrOfHBondsInAntiparallelBridges = protein.GetNrOfHBondsInAntiparallelBridges();
-  os << kHeaderLine % (
-    boost::format("%5.5d%5.1f   TOTAL NUMBER OF HYDROGEN BONDS IN ANTIPARALLEL BRIDGES, SAME NUMBER PER 100 RESIDUES")
-      % nrOfHBondsInAntiparallelBridges % (nrOfHBondsInAntiparallelBridges * 100.0 / nrOfResidues)) % '.' << std::endl;
+  b.integer(nrOfHBondsInAntiparallelBridges, 5)
+   .fixed(nrOfHBondsInAntiparallelBridges * 100.0 / nrOfResidues, 5, 1)
+   .put("   TOTAL NUMBER OF HYDROGEN BONDS IN ANTIPARALLEL BRIDGES, SAME NUMBER PER 100 RESIDUES ")
+   .tab(127).put(".\n");
 
-  boost::format kHBondsLine("%5.5d%5.1f   TOTAL NUMBER OF HYDROGEN BONDS OF TYPE O(I)-->H-N(I%c%1.1d), SAME NUMBER PER 100 RESIDUES");
-     for (int32 k = 0; k < 11; ++k)
+  for (int32 k = 0; k < 11; ++k)
   {
-    os << kHeaderLine % (kHBondsLine % nrOfHBondsPerDistance[k] % (nrOfHBondsPerDistance[k] * 100.0 / nrOfResidues) % (k - 5 < 0 ? '-' : '+') % abs(k - 5)) % '.' << std::endl;
+    b.integer(nrOfHBondsPerDistance[k], 5)
+     .fixed(nrOfHBondsPerDistance[k] * 100.0 / nrOfResidues, 5, 1)
+     .put("   TOTAL NUMBER OF HYDROGEN BONDS OF TYPE O(I)-->H-N(I")
+     .put(k - 5 < 0 ? '-' : '+').integer(abs(k - 5), 1)
+     .put("), SAME NUMBER PER 100 RESIDUES ").tab(127).put(".\n");
   }
 
   // histograms...
 
   uint32 histogram[kHistogramSize];
-  os << "  1  2  3  4  5  6  7  8  9 10 11 12 13 14 15 16 17 18 19 20 21 22 23 24 25 26 27 28 29 30     *** HISTOGRAMS OF ***           ." << std::endl;
+  b.put("  1  2  3  4  5  6  7  8  9 10 11 12 13 14 15 16 17 18 19 20 21 22 23 24 25 26 27 28 29 30     *** HISTOGRAMS OF ***           .\n");
 
   protein.GetResiduesPerAlphaHelixHistogram(histogram);
   for (uint32 i = 0; i < kHistogramSize; ++i)
-    os << boost::format("%3.3d") % histogram[i];
-  os << "    RESIDUES PER ALPHA HELIX         ." << std::endl;
+    b.integer(histogram[i], 3);
+  b.put("    RESIDUES PER ALPHA HELIX         .\n");
 
   protein.GetParallelBridgesPerLadderHistogram(histogram);
   for (uint32 i = 0; i < kHistogramSize; ++i)
-    os << boost::format("%3.3d") % histogram[i];
-  os << "    PARALLEL BRIDGES PER LADDER      ." << std::endl;
+    b.integer(histogram[i], 3);
+  b.put("    PARALLEL BRIDGES PER LADDER      .\n");
 
   protein.GetAntiparallelBridgesPerLadderHistogram(histogram);
   for (uint32 i = 0; i < kHistogramSize; ++i)
-    os << boost::format("%3.3d") % histogram[i];
-  os << "    ANTIPARALLEL BRIDGES PER LADDER  ." << std::endl;
+    b.integer(histogram[i], 3);
+  b.put("    ANTIPARALLEL BRIDGES PER LADDER  .\n");
 
   protein.GetLaddersPerSheetHistogram(histogram);
   for (uint32 i = 0; i < kHistogramSize; ++i)
-    os << boost::format("%3.3d") % histogram[i];
-  os << "    LADDERS PER SHEET                ." << std::endl;
+    b.integer(histogram[i], 3);
+  b.put("    LADDERS PER SHEET                .\n");
 
   // per residue information
 
-  os << "  #  RESIDUE AA STRUCTURE BP1 BP2  ACC     N-H-->O    O-->H-N N-H-->O    O-->H-N    TCO  KAPPA ALPHA  PHI   PSI    X-CA   Y-CA   Z-CA            CHAIN" << std::endl;
-  boost::format kDSSPResidueLine(
-    "%5.5d        !%c             0   0    0      0, 0.0     0, 0.0     0, 0.0     0, 0.0   0.000 360.0 360.0 360.0 360.0    0.0    0.0    0.0");
+  b.put("  #  RESIDUE AA STRUCTURE BP1 BP2  ACC     N-H-->O    O-->H-N N-H-->O    O-->H-N    TCO  KAPPA ALPHA  PHI   PSI    X-CA   Y-CA   Z-CA            CHAIN\n");
+  b.flush(os);
 
   std::vector<const MResidue*> residues;
-
-  foreach (const MChain* chain, protein.GetChains())
-  {
-    foreach (const MResidue* residue, chain->GetResidues())
-      residues.push_back(residue);
-  }
-
-  // keep residues sorted by residue number as assigned during reading the PDB file
-  sort(residues.begin(), residues.end(), boost::bind(&MResidue::GetNumber, _1) < boost::bind(&MResidue::GetNumber, _2));
+  GetResidues(protein, residues);
 
   const MResidue* last = nullptr;
   foreach (const MResidue* residue, residues)
@@ -241,9 +283,40 @@ void WriteDSSP(MProtein& protein, std::ostream& os)
       char breaktype = ' ';
       if (last->GetChainID() != residue->GetChainID())
         breaktype = '*';
-      os << (kDSSPResidueLine % (last->GetNumber() + 1) % breaktype) << std::endl;
+      b.integer(last->GetNumber() + 1, 5).put("        !").put(breaktype)
+       .put("             0   0    0      0, 0.0     0, 0.0     0, 0.0     0, 0.0   0.000 360.0 360.0 360.0 360.0    0.0    0.0    0.0\n");
     }
-    os << ResidueToDSSPLine(*residue) << std::endl;
+    WriteResidueLine(b, *residue);
+    b.put('\n');
+    last = residue;
+
+    // write out in blocks
+    if (b.size() > 65536)
+      b.flush(os);
+  }
+
+  b.flush(os);
+  os.flush();
+}
+
+std::string SecondaryStructureString(const MProtein& protein)
+{
+  std::vector<const MResidue*> residues;
+  GetResidues(protein, residues);
+
+  std::string result;
+  result.reserve(residues.size());
+
+  const MResidue* last = nullptr;
+  foreach (const MResidue* residue, residues)
+  {
+    if (last != nullptr and last->GetNumber() + 1 != residue->GetNumber())
+      result += '!';
+
+    char ss = SecondaryStructureCode(*residue);
+    result += ss == ' ' ? '-' : ss;
     last = residue;
   }
+
+  return result;
 }
@@ -20,4 +20,8 @@ std::string ResidueToDSSPLine(const MResidue& residue);
 // Write a complete DSSP file for a protein
 void WriteDSSP(MProtein& protein, std::ostream& os);
 
+// The secondary structure codes of all residues in the order of the DSSP
+// file, with '-' for a loop and '!' for a break
+std::string SecondaryStructureString(const MProtein& protein);
+
 #endif
@@ -0,0 +1,238 @@
+// Copyright Maarten L. Hekkelman, Radboud University 2008-2011.
+// Copyright Coos Baakman, Jon Black, Wouter G. Touw & Gert Vriend, Radboud university medical center 2015.
+//   Distributed under the Boost Software License, Version 1.0.
+//       (See accompanying file LICENSE_1_0.txt or copy at
+//             http://www.boost.org/LICENSE_1_0.txt)
+//
+// format_buffer writes fixed width fields into a reusable character buffer.
+// It produces the same text boost::format does for the conversions used in
+// the DSSP and HSSP output, without building a format object per line:
+//
+//   %5.5d   integer(v, 5)        %6.1f   fixed(v, 6, 1)
+//   %1.1s   string(s, 1, 1)      %4.4d   general(v, 4, 4), for doubles
+//   %11s    string(s, 11)        %|127t| tab(127, start)
+//   %c      put(c)
+
+#ifndef XSSP_FORMAT_H
+#define XSSP_FORMAT_H
+
+#pragma once
+
+#include "mas.h"
+
+#include <cmath>
+#include <cstdio>
+#include <ostream>
+#include <string>
+
+class format_buffer
+{
+  public:
+
+                    format_buffer() {}
+
+  void              clear()                 { m_data.clear(); }
+  const char*       data() const            { return m_data.data(); }
+  std::string::size_type
+                    size() const            { return m_data.size(); }
+  const std::string&
+                    str() const             { return m_data; }
+
+  // write the contents to os and start over
+  void              flush(std::ostream& os)
+                    {
+                      os.write(m_data.data(), m_data.size());
+                      m_data.clear();
+                    }
+
+  format_buffer&    put(char c)             { m_data += c; return *this; }
+  format_buffer&    put(const char* s)      { m_data += s; return *this; }
+  format_buffer&    put(const std::string& s)
+                                            { m_data += s; return *this; }
+  format_buffer&    put(char c, uint32 n)   { m_data.append(n, c); return *this; }
+
+  // right aligned in width columns, like %wd; never truncated
+  format_buffer&    integer(int64 v, uint32 width = 0);
+
+  // right aligned in width columns with precision decimals, like %w.pf
+  format_buffer&    fixed(double v, uint32 width, uint32 precision);
+
+  // a double in the stream's general notation, like %w.pg; this is what
+  // boost::format writes for a %w.pd conversion of a double
+  format_buffer&    general(double v, uint32 width, uint32 precision);
+
+  // right aligned in width columns after truncating to at most
+  // truncate characters, like %w.ts
+  format_buffer&    string(const std::string& s, uint32 width = 0,
+                           std::string::size_type truncate = std::string::npos);
+
+  // pad with spaces up to column of the current line
+  format_buffer&    tab(uint32 column);
+
+  // pad with spaces up to column, counted from offset start; this is
+  // %|ct| for a format whose output started at start
+  format_buffer&    tab(uint32 column, std::string::size_type start);
+
+  // right align everything written since offset start in width columns,
+  // for fields that are themselves composed, like %11s of "%d,%3.1f"
+  format_buffer&    align(std::string::size_type start, uint32 width);
+
+  private:
+                    format_buffer(const format_buffer&);
+  format_buffer&    operator=(const format_buffer&);
+
+  void              pad(uint32 length, uint32 width)
+                    {
+                      if (length < width)
+                        m_data.append(width - length, ' ');
+                    }
+
+  void              print(const char* format, uint32 width,
+                          uint32 precision, double v);
+
+  std::string       m_data;
+};
+
+inline
+format_buffer& format_buffer::integer(int64 v, uint32 width)
+{
+  char s[24];
+  char* e = s + sizeof(s);
+  char* p = e;
+
+  uint64 u = v < 0 ? 0 - static_cast<uint64>(v) : static_cast<uint64>(v);
+  do
+  {
+    *--p = '0' + u % 10;
+    u /= 10;
+  }
+  while (u > 0);
+
+  if (v < 0)
+    *--p = '-';
+
+  pad(static_cast<uint32>(e - p), width);
+  m_data.append(p, e);
+  return *this;
+}
+
+inline
+format_buffer& format_buffer::fixed(double v, uint32 width, uint32 precision)
+{
+  static const double kPow10[] = { 1, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6 };
+
+  // The scaled value is off by at most half an ulp, so unless its fraction
+  // is that close to one half we round the same way printf does. Anything
+  // else, ties included, is left to snprintf.
+  double scaled = 0;
+  if (precision < sizeof(kPow10) / sizeof(double) and std::isfinite(v))
+    scaled = std::fabs(v) * kPow10[precision];
+
+  double whole = std::floor(scaled);
+  double fraction = scaled - whole;
+
+  if (v != 0 and (scaled == 0 or scaled >= 1e15 or
+                  std::fabs(fraction - 0.5) <= scaled * 1e-15))
+  {
+    print("%*.*f", width, precision, v);
+    return *this;
+  }
+
+  uint64 digits = static_cast<uint64>(whole) + (fraction > 0.5 ? 1 : 0);
+
+  char s[32];
+  char* e = s + sizeof(s);
+  char* p = e;
+
+  for (uint32 i = 0; i < precision; ++i)
+  {
+    *--p = '0' + digits % 10;
+    digits /= 10;
+  }
+
+  if (precision > 0)
+    *--p = '.';
+
+  do
+  {
+    *--p = '0' + digits % 10;
+    digits /= 10;
+  }
+  while (digits > 0);
+
+  if (std::signbit(v))
+    *--p = '-';
+
+  pad(static_cast<uint32>(e - p), width);
+  m_data.append(p, e);
+  return *this;
+}
+
+inline
+format_buffer& format_buffer::general(double v, uint32 width,
+                                      uint32 precision)
+{
+  // whole numbers with at most precision digits print as integers
+  if (std::fabs(v) < 1e9 and v == std::floor(v) and
+      std::fabs(v) < std::pow(10.0, static_cast<int>(precision)) and
+      not (v == 0 and std::signbit(v)))
+    integer(static_cast<int64>(v), width);
+  else
+    print("%*.*g", width, precision, v);
+  return *this;
+}
+
+inline
+format_buffer& format_buffer::string(const std::string& s, uint32 width,
+                                     std::string::size_type truncate)
+{
+  std::string::size_type n = s.length() < truncate ? s.length() : truncate;
+  pad(static_cast<uint32>(n), width);
+  m_data.append(s, 0, n);
+  return *this;
+}
+
+inline
+format_buffer& format_buffer::tab(uint32 column)
+{
+  std::string::size_type line = m_data.rfind('\n');
+  return tab(column, line == std::string::npos ? 0 : line + 1);
+}
+
+inline
+format_buffer& format_buffer::tab(uint32 column, std::string::size_type start)
+{
+  pad(static_cast<uint32>(m_data.size() - start), column);
+  return *this;
+}
+
+inline
+format_buffer& format_buffer::align(std::string::size_type start,
+                                    uint32 width)
+{
+  std::string::size_type length = m_data.size() - start;
+  if (length < width)
+    m_data.insert(start, width - length, ' ');
+  return *this;
+}
+
+inline
+void format_buffer::print(const char* format, uint32 width,
+                          uint32 precision, double v)
+{
+  int w = static_cast<int>(width), p = static_cast<int>(precision);
+
+  char s[64];
+  int n = snprintf(s, sizeof(s), format, w, p, v);
+  if (n >= 0 and n < static_cast<int>(sizeof(s)))
+    m_data.append(s, n);
+  else if (n > 0)
+  {
+    std::string::size_type size = m_data.size();
+    m_data.resize(size + n + 1);
+    snprintf(&m_data[size], n + 1, format, w, p, v);
+    m_data.resize(size + n);
+  }
+}
+
+#endif
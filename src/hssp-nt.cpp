@@ -1,12 +1,13 @@
 #include "hssp-nt.h"
 
 #include "blast.h"
-#include "buffer.h"
 #include "dssp.h"
 #include "fetchdbrefs.h"
+#include "format.h"
 #include "matrix.h"
 #include "progress.h"
 #include "structure.h"
+#include "thread-pool.h"
 #include "utils.h"
 
 #include <boost/algorithm/string.hpp>
@@ -21,14 +22,22 @@
 #include <boost/iostreams/device/back_inserter.hpp>
 #include <boost/iostreams/filtering_stream.hpp>
 #include <boost/lexical_cast.hpp>
+#include <boost/ptr_container/ptr_vector.hpp>
 #include <boost/range/adaptor/sliced.hpp>
-#include <boost/regex.hpp>
 #include <boost/tr1/cmath.hpp>
 
 #include <algorithm>
 #include <cmath>
+#include <cstring>
 #include <iostream>
+#include <map>
 #include <set>
+#include <sstream>
+
+#if defined(__GNUC__) and (defined(__x86_64__) or defined(__i386__)) and defined(__SSE2__)
+#include <emmintrin.h>
+#define XSSP_SIMD_PROFILE 1
+#endif
 
 #define foreach BOOST_FOREACH
 
@@ -43,6 +52,10 @@ namespace HSSP
 
 const float kThreshold = 0.05f, kFragmentCutOff = 0.75f;
 
+// hits are aligned to the profile in a band of diagonals this wide on
+// either side of the diagonals of their best BLAST HSP
+const int32 kProfileBandWidth = 32;
+
 // precalculated threshold table for identity values between 10 and 80
 const float kHomologyThreshold[] = {
   0.795468f, 0.75398f, 0.717997f, 0.686414f, 0.658413f, 0.633373f, 0.610811f,
@@ -60,46 +73,37 @@ const float kHomologyThreshold[] = {
 
 // --------------------------------------------------------------------
 
+// The distance is one minus the fraction of identical residues in the best
+// alignment that ends at the last row or column. Only the previous row of
+// the matrices is kept.
 float calculateDistance(const sequence& a, const sequence& b)
 {
   const float kDistanceGapOpen = 10;
   const float kDistanceGapExtend = 0.2f;
 
-  int32 x = 0, dimX = static_cast<int32>(a.length());
-  int32 y = 0, dimY = static_cast<int32>(b.length());
+  int32 dimX = static_cast<int32>(a.length());
+  int32 dimY = static_cast<int32>(b.length());
 
-  matrix<float>  B(dimX, dimY);
-  matrix<float>  Ix(dimX, dimY);
-  matrix<float>  Iy(dimX, dimY);
-  matrix<uint16>  id(dimX, dimY);
-
-  Ix(0, 0) = 0;
-  Iy(0, 0) = 0;
+  // the row before the first holds zeros, as do the cells before each row
+  std::vector<float> B(dimY + 1), lastB(dimY + 1), Ix(dimY);
+  std::vector<uint16> id(dimY + 1), lastId(dimY + 1);
 
+  float high = -std::numeric_limits<float>::max();
   uint16 highId = 0;
 
-  Ix(x, y) = 0;
-  Iy(x, y) = 0;
-  if (x > 0 and y > 0)
-    id(x - 1, y - 1) = highId;
+  for (int32 x = 0; x < dimX; ++x)
+  {
+    std::swap(B, lastB);
+    std::swap(id, lastId);
 
-  int32 startX = x, startY = y;
-  float high = -std::numeric_limits<float>::max();
-  uint16 highIdSub = 0;
+    float Iy1 = 0;
 
-  sequence::const_iterator ia = a.begin();
-  for (x = startX; x < dimX; ++x, ++ia)
-  {
-    sequence::const_iterator ib = b.begin();
-    for (y = startY; y < dimY; ++y, ++ib)
+    for (int32 y = 0; y < dimY; ++y)
     {
-      float Ix1 = 0; if (x > startX) Ix1 = Ix(x - 1, y);
-      float Iy1 = 0; if (y > startY) Iy1 = Iy(x, y - 1);
+      float Ix1 = Ix[y];
 
       // (1)
-      float M = score(kMPam250, *ia, *ib);
-      if (x > startX and y > startY)
-        M += B(x - 1, y - 1);
+      float M = score(kMPam250, a[x], b[y]) + lastB[y];
 
       float s;
       uint16 i = 0;
@@ -108,42 +112,37 @@ float calculateDistance(const sequence& a, const sequence& b)
 
       if (M >= Ix1 and M >= Iy1)
       {
-        if (x > startX and y > startY)
-          i += id(x - 1, y - 1);
+        i += lastId[y];
         s = M;
       }
       else if (Ix1 >= Iy1)
       {
-        if (x > startX)
-          i += id(x - 1, y);
+        i += lastId[y + 1];
         s = Ix1;
       }
       else
       {
-        if (y > startY)
-          i += id(x, y - 1);
+        i += id[y];
         s = Iy1;
       }
 
-      B(x, y) = s;
-      id(x, y) = i;
+      B[y + 1] = s;
+      id[y + 1] = i;
 
       if ((x == dimX - 1 or y == dimY - 1) and high < s)
       {
         high = s;
-        highIdSub = i;
+        highId = i;
       }
 
       // (3)
-      Ix(x, y) = std::max(M - kDistanceGapOpen, Ix1 - kDistanceGapExtend);
+      Ix[y] = std::max(M - kDistanceGapOpen, Ix1 - kDistanceGapExtend);
 
       // (4)
-      Iy(x, y) = std::max(M - kDistanceGapOpen, Iy1 - kDistanceGapExtend);
+      Iy1 = std::max(M - kDistanceGapOpen, Iy1 - kDistanceGapExtend);
     }
   }
 
-  highId += highIdSub;
-
   float result = 1.0f - float(highId) / std::max(dimX, dimY);
 
   assert(result >= 0.0f);
@@ -152,6 +151,143 @@ float calculateDistance(const sequence& a, const sequence& b)
   return result;
 }
 
+// Calculate the distances of up to four sequences in a to b. With SSE2 the
+// sequences are aligned at the same time, each in its own lane, the
+// results are the same as those of calculateDistance.
+void calculateDistances(const sequence* const a[], uint32 n,
+                        const sequence& b, float outDistances[])
+{
+  assert(n <= 4);
+
+#if XSSP_SIMD_PROFILE
+  const float kDistanceGapOpen = 10;
+  const float kDistanceGapExtend = 0.2f;
+
+  int32 dimX[4] = {}, maxX = 0;
+  for (uint32 k = 0; k < n; ++k)
+  {
+    dimX[k] = static_cast<int32>(a[k]->length());
+    maxX = std::max(maxX, dimX[k]);
+  }
+
+  int32 dimY = static_cast<int32>(b.length());
+
+  // the scores against b, per residue of a
+  std::vector<std::vector<float> > scores(256);
+  std::vector<int32> residueY(b.begin(), b.end());
+
+  // rows hold four lanes per element, B and id start with the zero column
+  std::vector<float> data(3 * (dimY + 1) * 4);
+  float* B = &data[0];
+  float* lastB = B + (dimY + 1) * 4;
+  float* Ix = lastB + (dimY + 1) * 4;
+
+  std::vector<int32> idData(2 * (dimY + 1) * 4);
+  int32* id = &idData[0];
+  int32* lastId = id + (dimY + 1) * 4;
+
+  const __m128 gapOpen = _mm_set1_ps(kDistanceGapOpen);
+  const __m128 gapExtend = _mm_set1_ps(kDistanceGapExtend);
+  const __m128 all = _mm_castsi128_ps(_mm_set1_epi32(-1));
+  const __m128i one = _mm_set1_epi32(1);
+  const __m128i lastX = _mm_set_epi32(dimX[3] - 1, dimX[2] - 1, dimX[1] - 1,
+                                      dimX[0] - 1);
+
+  __m128 high = _mm_set1_ps(-std::numeric_limits<float>::max());
+  __m128i highId = _mm_setzero_si128();
+
+  for (int32 x = 0; x < maxX; ++x)
+  {
+    std::swap(B, lastB);
+    std::swap(id, lastId);
+
+    // lanes past the end of their sequence compare with residue 0 and are
+    // kept from updating their result
+    const float* row[4];
+    int32 residueX[4];
+    for (uint32 k = 0; k < 4; ++k)
+    {
+      residueX[k] = x < dimX[k] ? (*a[k])[x] : 0;
+
+      std::vector<float>& r = scores[residueX[k]];
+      if (r.empty())
+      {
+        r.resize(dimY);
+        for (int32 y = 0; y < dimY; ++y)
+          r[y] = score(kMPam250, residueX[k], b[y]);
+      }
+      row[k] = &r[0];
+    }
+
+    __m128i rx = _mm_loadu_si128(reinterpret_cast<const __m128i*>(residueX));
+    __m128i xs = _mm_set1_epi32(x);
+    __m128 active = _mm_castsi128_ps(_mm_cmpgt_epi32(
+      _mm_add_epi32(lastX, one), xs));
+    __m128 lastRow = _mm_castsi128_ps(_mm_cmpeq_epi32(lastX, xs));
+
+    __m128 Iy1 = _mm_setzero_ps();
+
+    for (int32 y = 0; y < dimY; ++y)
+    {
+      __m128 Ix1 = _mm_loadu_ps(Ix + 4 * y);
+
+      // (1)
+      __m128 M = _mm_add_ps(_mm_set_ps(row[3][y], row[2][y], row[1][y],
+                                       row[0][y]),
+                            _mm_loadu_ps(lastB + 4 * y));
+
+      __m128 c0 = _mm_and_ps(_mm_cmpge_ps(M, Ix1), _mm_cmpge_ps(M, Iy1));
+      __m128 c1 = _mm_andnot_ps(c0, _mm_cmpge_ps(Ix1, Iy1));
+      __m128 c2 = _mm_xor_ps(_mm_or_ps(c0, c1), all);
+
+      __m128 s = _mm_or_ps(_mm_and_ps(c0, M),
+                 _mm_or_ps(_mm_and_ps(c1, Ix1), _mm_and_ps(c2, Iy1)));
+
+      __m128i i = _mm_or_si128(
+        _mm_and_si128(_mm_castps_si128(c0), _mm_loadu_si128(
+          reinterpret_cast<const __m128i*>(lastId + 4 * y))),
+        _mm_or_si128(
+          _mm_and_si128(_mm_castps_si128(c1), _mm_loadu_si128(
+            reinterpret_cast<const __m128i*>(lastId + 4 * (y + 1)))),
+          _mm_and_si128(_mm_castps_si128(c2), _mm_loadu_si128(
+            reinterpret_cast<const __m128i*>(id + 4 * y)))));
+      i = _mm_sub_epi32(i, _mm_cmpeq_epi32(rx, _mm_set1_epi32(residueY[y])));
+
+      _mm_storeu_ps(B + 4 * (y + 1), s);
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(id + 4 * (y + 1)), i);
+
+      __m128 edge = y == dimY - 1 ? all : lastRow;
+      __m128 update = _mm_and_ps(_mm_and_ps(active, edge),
+                                 _mm_cmplt_ps(high, s));
+      high = _mm_or_ps(_mm_and_ps(update, s), _mm_andnot_ps(update, high));
+      highId = _mm_or_si128(_mm_and_si128(_mm_castps_si128(update), i),
+                            _mm_andnot_si128(_mm_castps_si128(update), highId));
+
+      // (3) and (4), _mm_max_ps(b, a) is std::max(a, b)
+      __m128 Mo = _mm_sub_ps(M, gapOpen);
+      _mm_storeu_ps(Ix + 4 * y, _mm_max_ps(_mm_sub_ps(Ix1, gapExtend), Mo));
+      Iy1 = _mm_max_ps(_mm_sub_ps(Iy1, gapExtend), Mo);
+    }
+  }
+
+  int32 ids[4];
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(ids), highId);
+
+  for (uint32 k = 0; k < n; ++k)
+  {
+    // identities are counted in 16 bits, as in calculateDistance
+    uint16 highIdK = static_cast<uint16>(ids[k]);
+    outDistances[k] = 1.0f - float(highIdK) / std::max(dimX[k], dimY);
+
+    assert(outDistances[k] >= 0.0f);
+    assert(outDistances[k] <= 1.0f);
+  }
+#else
+  for (uint32 k = 0; k < n; ++k)
+    outDistances[k] = calculateDistance(*a[k], b);
+#endif
+}
+
 // --------------------------------------------------------------------
 
 struct MResInfo
@@ -229,10 +365,11 @@ struct MHit
 {
   MHit(const MHit& e);
 
-  MHit(const std::string& id, const std::string& def, const sequence& seq)
-    : m_id(id),
-      m_def(def),
-      m_seq(seq),
+  MHit(const BlastHit& hit)
+    : m_id(hit.mId),
+      m_acc(hit.mAcc),
+      m_def(hit.mDef),
+      m_seq(hit.mTarget),
       m_distance(0),
       m_identical(0),
       m_similar(0),
@@ -243,7 +380,9 @@ struct MHit
       m_ifir(0),
       m_ilas(0),
       m_jfir(0),
-      m_jlas(0)
+      m_jlas(0),
+      m_nr(0),
+      m_hsps(hit.mHsps)
   {
   }
 
@@ -254,11 +393,6 @@ struct MHit
     std::string m_seq;
   };
 
-  static MHitPtr Create(const std::string& id, const std::string& def,
-                        const std::string& seq);
-
-  void CalculateDistance(const sequence& chain);
-
   std::string m_id, m_acc, m_def, m_stid;
   sequence m_seq;
   std::string m_aligned;
@@ -266,7 +400,9 @@ struct MHit
   int32 m_ifir, m_ilas, m_jfir, m_jlas;
   uint32 m_identical, m_similar, m_length;
   uint32 m_gaps, m_gapn;
+  uint32 m_nr;    // order in which this hit was added to the profile
   std::vector<insertion> m_insertions;
+  std::vector<BlastHsp> m_hsps;
 };
 
 std::ostream& operator<<(std::ostream& os, const MHit& hit)
@@ -284,40 +420,20 @@ std::ostream& operator<<(std::ostream& os, const MHit& hit)
   return os;
 }
 
-MHitPtr MHit::Create(const std::string& id, const std::string& def,
-                     const std::string& seq)
-{
-  MHitPtr result(new MHit(id, def, encode(seq)));
-
-  static const boost::regex
-    kM6FastARE("^(\\w+)((?:\\|([^| ]*))(?:\\|([^| ]+))?(?:\\|([^| ]+))?(?:\\|([^| ]+))?)");
-
-  boost::smatch m;
-  if (boost::regex_match(result->m_id, m, kM6FastARE,
-                         boost::match_not_dot_newline))
-  {
-    if (m[1] == "sp" or m[1] == "tr")
-    {
-      result->m_acc = m[3];
-      result->m_id = m[4];
-    }
-    else
-      result->m_id = result->m_acc = m[2];
-  }
-  else
-    result->m_acc = result->m_id;
-
-  result->m_distance = 0;
-
-  return result;
-}
+// --------------------------------------------------------------------
 
-void MHit::CalculateDistance(const sequence& chain)
+// The result of aligning a hit against the profile, enough to add it to
+// the profile later on.
+struct MHitAlignment
 {
-  m_distance = calculateDistance(m_seq, chain);
-}
+  MHitAlignment() : m_B(0, 0), m_tb(0, 0) {}
 
-// --------------------------------------------------------------------
+  diagonal_matrix<float> m_B;
+  diagonal_matrix<int8> m_tb;
+  int32 m_high_x, m_high_y;   // the last cell of the alignment
+  int32 m_x, m_y;             // the cell before its first
+  uint32 m_ident, m_similar, m_length, m_xgaps;
+};
 
 struct MProfile
 {
@@ -325,15 +441,25 @@ struct MProfile
            float inThreshold, float inFragmentCutOff);
   ~MProfile();
 
-  void Process(std::istream& inHits, float inGapOpen, float inGapExtend,
-               uint32 inMaxHits, uint32 inThreads);
-  void Align(MHitPtr e, float inGapOpen, float inGapExtend);
+  void Process(const std::vector<BlastHit>& inHits, float inGapOpen,
+               float inGapExtend, uint32 inMaxHits, uint32 inThreads);
+  bool Align(MHitPtr e, float inGapOpen, float inGapExtend,
+             MHitAlignment& outAlignment) const;
+  void Add(MHitPtr e, const MHitAlignment& inAlignment);
+  bool GetBand(const MHit& e, int32& outLo, int32& outHi) const;
+  void ExpandAlignments();
 
-  void AdjustXGapCosts(std::vector<float>& gop, std::vector<float>& gep);
+  void AdjustXGapCosts(std::vector<float>& gop,
+                       std::vector<float>& gep) const;
   void AdjustYGapCosts(const sequence& s, std::vector<float>& gop,
-                       std::vector<float>& gep);
-  void dump(const matrix<float>& B, const matrix<float>& Ix,
-            const matrix<float>& Iy, const matrix<int8>& tb,
+                       std::vector<float>& gep) const;
+  void FillMatrices(const sequence& inSeq, const std::vector<float>& gop_a,
+                    const std::vector<float>& gep_a,
+                    const std::vector<float>& gop_b,
+                    const std::vector<float>& gep_b,
+                    diagonal_matrix<float>& B, diagonal_matrix<int8>& tb,
+                    int32& outHighX, int32& outHighY) const;
+  void dump(const matrix_base<float>& B, const matrix_base<int8>& tb,
             const std::vector<float>& gopX, const std::vector<float>& gopY,
             const std::vector<float>& gepX, const std::vector<float>& gepY,
             const sequence& sx, const sequence& sy);
@@ -350,6 +476,7 @@ struct MProfile
   const MChain&  m_chain;
   sequence m_seq;
   MResInfoList m_residues;
+  std::vector<uint32> m_columns;  // entry nr that inserted each column
   std::vector<MHitPtr> m_entries;
   float m_threshold;
   float m_frag_cutoff;
@@ -366,6 +493,8 @@ MProfile::MProfile(const MChain& inChain, const sequence& inSequence,
     m_sum_dist_weight(0),
     m_shuffled(false)
 {
+  m_columns.assign(inSequence.length(), 0);
+
   const std::vector<MResidue*>& residues = m_chain.GetResidues();
   std::vector<MResidue*>::const_iterator ri = residues.begin();
 
@@ -393,8 +522,8 @@ MProfile::~MProfile()
 {
 }
 
-void MProfile::dump(const matrix<float>& B, const matrix<float>& Ix,
-                    const matrix<float>& Iy, const matrix<int8>& tb,
+void MProfile::dump(const matrix_base<float>& B,
+                    const matrix_base<int8>& tb,
                     const std::vector<float>& gopX,
                     const std::vector<float>& gopY,
                     const std::vector<float>& gepX,
@@ -417,7 +546,7 @@ void MProfile::dump(const matrix<float>& B, const matrix<float>& Ix,
   {
     os << kResidues[sy[y]];
     for (uint32 x = 0; x < m_residues.size(); ++x)
-      os << '\t' << B(x, y) << '\t' << Iy(x, y);
+      os << '\t' << B(x, y) << '\t';
     os << std::endl
        << gopY[y];
 
@@ -425,25 +554,63 @@ void MProfile::dump(const matrix<float>& B, const matrix<float>& Ix,
     {
       switch (tb(x, y))
       {
-        case -1:  os << '\t' << Ix(x, y) << '\t' << "|"; break;
-        case  0:  os << '\t' << Ix(x, y) << '\t' << "\\"; break;
-        case  1:  os << '\t' << Ix(x, y) << '\t' << "-"; break;
-        case  2:  os << '\t' << Ix(x, y) << '\t' << "."; break;
+        case -1:  os << '\t' << '\t' << "|"; break;
+        case  0:  os << '\t' << '\t' << "\\"; break;
+        case  1:  os << '\t' << '\t' << "-"; break;
+        case  2:  os << '\t' << '\t' << "."; break;
       }
     }
     os << std::endl;
   }
 }
 
+// The band of diagonals, as profile column minus hit position, to align hit
+// e in. Returns false if there is no BLAST HSP to base it on or if the band
+// would cover the whole matrix anyway.
+bool MProfile::GetBand(const MHit& e, int32& outLo, int32& outHi) const
+{
+  if (e.m_hsps.empty())
+    return false;
+
+  // the profile columns holding the residues of the original query
+  std::vector<int32> column;
+  for (uint32 i = 0; i < m_columns.size(); ++i)
+  {
+    if (m_columns[i] == 0)
+      column.push_back(i);
+  }
+
+  int32 dimX = static_cast<int32>(m_seq.length());
+  int32 dimY = static_cast<int32>(e.m_seq.length());
+
+  outLo = dimX;
+  outHi = -dimY;
+
+  foreach (const BlastHsp& hsp, e.m_hsps)
+  {
+    if (hsp.mQueryStart >= hsp.mQueryEnd or hsp.mQueryEnd > column.size() or
+        hsp.mTargetStart >= hsp.mTargetEnd or hsp.mTargetEnd > e.m_seq.length())
+      return false;
+
+    int32 start = column[hsp.mQueryStart] - hsp.mTargetStart;
+    int32 end = column[hsp.mQueryEnd - 1] - (hsp.mTargetEnd - 1);
+
+    outLo = std::min(outLo, std::min(start, end) - kProfileBandWidth);
+    outHi = std::max(outHi, std::max(start, end) + kProfileBandWidth);
+  }
+
+  return outLo > 1 - dimY or outHi < dimX - 1;
+}
+
 void MProfile::AdjustXGapCosts(std::vector<float>& gop,
-                               std::vector<float>& gep)
+                               std::vector<float>& gep) const
 {
   assert(gop.size() == m_seq.length());
   assert(gop.size() == m_residues.size());
 
   for (size_t ix = 0; ix < m_residues.size(); ++ix)
   {
-    MResInfo& e = m_residues[ix];
+    const MResInfo& e = m_residues[ix];
 
     // adjust for secondary structure
     switch (e.m_ss)
@@ -468,17 +635,8 @@ void MProfile::AdjustXGapCosts(std::vector<float>& gop,
       gep[ix] = float(e.m_dist[22]) / (m_entries.size() + 1);
 
     // if there is a gap within 8 residues, increase gap penalty
-    for (size_t d = 0; d < 8; ++d)
-    {
-      if (ix + d >= m_residues.size() or
-        m_residues[ix + d].m_dist[22] > 0 or
-        ix - d < 0 or
-        m_residues[ix - d].m_dist[22] > 0)
-      {
-        gop[ix] *= (2 + ((8 - d) * 2)) / 8.f;
-        break;
-      }
-    }
+    gop[ix] *= GapProximityFactor(ix, m_residues.size(),
+      [this](size_t i) { return m_residues[i].m_dist[22] > 0; });
   }
 }
 
@@ -508,7 +666,7 @@ const float kResidueSpecificPenalty[22] = {
 };
 
 void MProfile::AdjustYGapCosts(const sequence& s, std::vector<float>& gop,
-                               std::vector<float>& gep)
+                               std::vector<float>& gep) const
 {
   for (uint32 y = 0; y < s.length(); ++y)
   {
@@ -517,49 +675,202 @@ void MProfile::AdjustYGapCosts(const sequence& s, std::vector<float>& gop,
   }
 }
 
-void MProfile::Align(MHitPtr e, float inGapOpen, float inGapExtend)
+// Fill the score and traceback matrices for aligning inSeq against the
+// profile. The alignment ends at the highest score, if more cells have that
+// score it is the first of them in row order. Only the band stored in B and
+// tb is calculated, cells outside it count as zero like those outside the
+// matrix.
+
+void MProfile::FillMatrices(const sequence& inSeq,
+                            const std::vector<float>& gop_a,
+                            const std::vector<float>& gep_a,
+                            const std::vector<float>& gop_b,
+                            const std::vector<float>& gep_b,
+                            diagonal_matrix<float>& B,
+                            diagonal_matrix<int8>& tb,
+                            int32& outHighX, int32& outHighY) const
 {
-  int32 x = 0, dimX = static_cast<int32>(m_seq.length());
-  int32 y = 0, dimY = static_cast<int32>(e->m_seq.length());
+  int32 dimX = static_cast<int32>(m_seq.length());
+  int32 dimY = static_cast<int32>(inSeq.length());
+
+#if XSSP_SIMD_PROFILE
+  // The cells on an anti-diagonal depend only on the two anti-diagonals
+  // before it, so they are calculated four at a time. Ix and Iy are kept for
+  // the last anti-diagonal only and B for the last two, indexed by x + 1.
+  // Elements not written hold zero, the value outside the matrix.
+
+  // values for y are stored at dimY - 1 - y, so that they increase along an
+  // anti-diagonal just like x
+  std::vector<float> gopX(dimX + 4), gepX(dimX + 4);
+  std::vector<int32> residueX(dimX + 4);
+  for (int32 x = 0; x < dimX; ++x)
+  {
+    gopX[x] = x < dimX - 1 ? gop_a[x] : 0;
+    gepX[x] = gep_a[x];
+    residueX[x] = is_gap(m_seq[x]) ? 0 : -1;
+  }
 
-  matrix<float> B(dimX, dimY);
-  matrix<float> Ix(dimX, dimY);
-  matrix<float> Iy(dimX, dimY);
-  matrix<int8> tb(dimX, dimY);
+  std::vector<float> gopY(dimY + 4), gepY(dimY + 4);
+  std::vector<uint8> seqY(dimY + 4);
+  for (int32 y = 0; y < dimY; ++y)
+  {
+    gopY[dimY - 1 - y] = y < dimY - 1 ? gop_b[y] : 0;
+    gepY[dimY - 1 - y] = gep_b[y];
+    seqY[dimY - 1 - y] = inSeq[y];
+  }
 
-  float minLength = static_cast<float>(dimX);
-  float maxLength = static_cast<float>(dimY);
-  if (minLength > maxLength)
-    std::swap(minLength, maxLength);
+  uint32 n = dimX + 5;
+  std::vector<float> data(7 * n);
+  float* curB = &data[0];     float* lastB = curB + n;  float* last2B = lastB + n;
+  float* curIx = last2B + n;  float* lastIx = curIx + n;
+  float* curIy = lastIx + n;  float* lastIy = curIy + n;
 
-  float logmin = 1.0f / log10(minLength);
-  float logdiff = 1.0f + 0.5f * log10(minLength / maxLength);
+  const __m128i lane = _mm_set_epi32(3, 2, 1, 0);
+  const __m128 all = _mm_castsi128_ps(_mm_set1_epi32(-1));
 
-  // initial gap open penalty
-  float gop = (inGapOpen / (logdiff * logmin)) * abs(kMPam250MisMatchAverage) * kMPam250ScalingFactor;
-  float gep = inGapExtend;
+  __m128 highS = _mm_setzero_ps();
+  __m128i highX = _mm_set1_epi32(-1), highY = _mm_set1_epi32(-1);
 
-  // position specific gap penalties
-  // initial gap extend penalty is adjusted for difference in sequence lengths
-  std::vector<float> gop_a(dimX, gop);
-  std::vector<float> gep_a(dimX, gep * (1 + log10(float(dimX) / dimY)));
-  AdjustXGapCosts(gop_a, gep_a);
+  for (int32 d = 0; d < dimX + dimY - 1; ++d)
+  {
+    int32 first = B.first(d);
+    int32 last = B.last(d);
 
-  std::vector<float> gop_b(dimY, gop);
-  std::vector<float> gep_b(dimY, gep * (1 + log10(float(dimY) / dimX)));
-  AdjustYGapCosts(e->m_seq, gop_b, gep_b);
+    // the band misses only anti-diagonals before or after all the others,
+    // the buffers still hold zeros for those before
+    if (first > last)
+      continue;
+
+    float* diagB = B.diagonal(d);
+    int8* diagTB = tb.diagonal(d);
+
+    // the band never moves more than one cell per anti-diagonal, so this
+    // clears what was left of it the last time these buffers were used
+    for (int32 i = std::max(first - 2, 0); i <= first; ++i)
+      curB[i] = curIx[i] = curIy[i] = 0;
+
+    for (int32 x = first; x <= last; x += 4)
+    {
+      int32 count = std::min(last + 1 - x, 4);
+      int32 ry = dimY - 1 - d + x;
+
+      float score[4] = {};
+      for (int32 k = 0; k < count; ++k)
+        score[k] = m_residues[x + k].m_score[seqY[ry + k]];
+
+      __m128 M = _mm_add_ps(_mm_loadu_ps(score), _mm_loadu_ps(last2B + x));
+      __m128 Ix1 = _mm_loadu_ps(lastIx + x);
+      __m128 Iy1 = _mm_loadu_ps(lastIy + x + 1);
+
+      __m128 c0 = _mm_and_ps(_mm_cmpge_ps(M, Ix1), _mm_cmpge_ps(M, Iy1));
+      __m128 c1 = _mm_andnot_ps(c0, _mm_cmpge_ps(Ix1, Iy1));
+      __m128 c2 = _mm_xor_ps(_mm_or_ps(c0, c1), all);
+
+      __m128 Mx = _mm_sub_ps(M, _mm_loadu_ps(&gopX[x]));
+      __m128 My = _mm_sub_ps(M, _mm_loadu_ps(&gopY[ry]));
+      __m128 Ixe = _mm_sub_ps(Ix1, _mm_loadu_ps(&gepX[x]));
+      __m128 Iye = _mm_sub_ps(Iy1, _mm_loadu_ps(&gepY[ry]));
+
+      // _mm_max_ps(b, a) is std::max(a, b)
+      __m128 b = _mm_or_ps(_mm_and_ps(c0, M),
+                 _mm_or_ps(_mm_and_ps(c1, Ix1), _mm_and_ps(c2, Iy1)));
+      __m128 ix = _mm_or_ps(_mm_and_ps(c0, Mx),
+                  _mm_or_ps(_mm_and_ps(c1, Ixe),
+                            _mm_and_ps(c2, _mm_max_ps(Ixe, Mx))));
+      __m128 iy = _mm_or_ps(_mm_and_ps(c0, My),
+                  _mm_or_ps(_mm_and_ps(c1, _mm_max_ps(Iye, My)),
+                            _mm_and_ps(c2, Iye)));
+
+      _mm_storeu_ps(curB + x + 1, b);
+      _mm_storeu_ps(curIx + x + 1, ix);
+      _mm_storeu_ps(curIy + x + 1, iy);
+
+      // traceback is 0, 1 or -1 for c0, c1 and c2
+      __m128i t = _mm_or_si128(
+        _mm_and_si128(_mm_castps_si128(c1), _mm_set1_epi32(1)),
+        _mm_castps_si128(c2));
+      t = _mm_packs_epi32(t, t);
+      t = _mm_packs_epi16(t, t);
+
+      int32 directions = _mm_cvtsi128_si32(t);
+      memcpy(diagTB + x - first, &directions, count);
+
+      float value[4];
+      _mm_storeu_ps(value, b);
+      std::copy(value, value + count, diagB + x - first);
+
+      // keep the highest M per lane, ties go to the lowest x, then y
+      __m128i xs = _mm_add_epi32(_mm_set1_epi32(x), lane);
+      __m128i ys = _mm_sub_epi32(_mm_set1_epi32(d), xs);
+
+      __m128i before = _mm_or_si128(_mm_cmplt_epi32(xs, highX),
+        _mm_and_si128(_mm_cmpeq_epi32(xs, highX), _mm_cmplt_epi32(ys, highY)));
+      __m128 better = _mm_or_ps(_mm_cmpgt_ps(M, highS),
+        _mm_and_ps(_mm_cmpeq_ps(M, highS), _mm_castsi128_ps(before)));
+
+      __m128 update = _mm_and_ps(_mm_and_ps(c0, better), _mm_castsi128_ps(
+        _mm_and_si128(_mm_loadu_si128(
+                        reinterpret_cast<const __m128i*>(&residueX[x])),
+                      _mm_cmplt_epi32(lane, _mm_set1_epi32(count)))));
+      __m128i updatei = _mm_castps_si128(update);
+
+      highS = _mm_or_ps(_mm_and_ps(update, M), _mm_andnot_ps(update, highS));
+      highX = _mm_or_si128(_mm_and_si128(updatei, xs),
+                           _mm_andnot_si128(updatei, highX));
+      highY = _mm_or_si128(_mm_and_si128(updatei, ys),
+                           _mm_andnot_si128(updatei, highY));
+    }
+
+    // clear what the last block wrote past the end of the anti-diagonal
+    std::fill(curB + last + 2, curB + last + 5, 0.f);
+    std::fill(curIx + last + 2, curIx + last + 5, 0.f);
+    std::fill(curIy + last + 2, curIy + last + 5, 0.f);
+
+    std::swap(last2B, lastB);
+    std::swap(lastB, curB);
+    std::swap(lastIx, curIx);
+    std::swap(lastIy, curIy);
+  }
+
+  float s[4];
+  int32 hx[4], hy[4];
+  _mm_storeu_ps(s, highS);
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(hx), highX);
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(hy), highY);
+
+  float high = 0;
+  outHighX = outHighY = 0;
+
+  for (int32 k = 0; k < 4; ++k)
+  {
+    if (hx[k] < 0)
+      continue;
+
+    if (high < s[k] or (high == s[k] and (hx[k] < outHighX or
+                                         (hx[k] == outHighX and hy[k] < outHighY))))
+    {
+      high = s[k];
+      outHighX = hx[k];
+      outHighY = hy[k];
+    }
+  }
+#else
+  int32 lo = B.band_lo(), hi = B.band_hi();
+
+  diagonal_matrix<float> Ix(dimX, dimY, lo, hi);
+  diagonal_matrix<float> Iy(dimX, dimY, lo, hi);
 
   int32 highX = 0, highY = 0;
   float highS = 0;
 
-  for (x = 0; x < dimX; ++x)
+  for (int32 x = 0; x < dimX; ++x)
   {
-    for (y = 0; y < dimY; ++y)
+    for (int32 y = std::max(x - hi, 0); y < dimY and x - y >= lo; ++y)
     {
-      float Ix1 = 0; if (x > 0) Ix1 = Ix(x - 1, y);
-      float Iy1 = 0; if (y > 0) Iy1 = Iy(x, y - 1);
+      float Ix1 = 0; if (x > 0 and x - 1 - y >= lo) Ix1 = Ix(x - 1, y);
+      float Iy1 = 0; if (y > 0 and x - y + 1 <= hi) Iy1 = Iy(x, y - 1);
 
-      float M = m_residues[x].m_score[e->m_seq[y]];
+      float M = m_residues[x].m_score[inSeq[y]];
       if (x > 0 and y > 0)
         M += B(x - 1, y - 1);
 
@@ -597,202 +908,308 @@ void MProfile::Align(MHitPtr e, float inGapOpen, float inGapExtend)
     }
   }
 
+  outHighX = highX;
+  outHighY = highY;
+#endif
+}
+
+// Align hit e against the profile, returns true if it should be added to it.
+// The profile is left unchanged, so several hits can be aligned at once.
+bool MProfile::Align(MHitPtr e, float inGapOpen, float inGapExtend,
+                     MHitAlignment& outAlignment) const
+{
+  int32 x = 0, dimX = static_cast<int32>(m_seq.length());
+  int32 y = 0, dimY = static_cast<int32>(e->m_seq.length());
+
+  float minLength = static_cast<float>(dimX);
+  float maxLength = static_cast<float>(dimY);
+  if (minLength > maxLength)
+    std::swap(minLength, maxLength);
+
+  float logmin = 1.0f / log10(minLength);
+  float logdiff = 1.0f + 0.5f * log10(minLength / maxLength);
+
+  // initial gap open penalty
+  float gop = (inGapOpen / (logdiff * logmin)) * abs(kMPam250MisMatchAverage) * kMPam250ScalingFactor;
+  float gep = inGapExtend;
+
+  // position specific gap penalties
+  // initial gap extend penalty is adjusted for difference in sequence lengths
+  std::vector<float> gop_a(dimX, gop);
+  std::vector<float> gep_a(dimX, gep * (1 + log10(float(dimX) / dimY)));
+  AdjustXGapCosts(gop_a, gep_a);
+
+  std::vector<float> gop_b(dimY, gop);
+  std::vector<float> gep_b(dimY, gep * (1 + log10(float(dimY) / dimX)));
+  AdjustYGapCosts(e->m_seq, gop_b, gep_b);
+
+  // Align in a band around the diagonals where BLAST found the hit. If the
+  // alignment runs along the edge of the band it might have continued
+  // outside of it, the full matrix is used instead then.
+  int32 bandLo, bandHi;
+  bool banded = GetBand(*e, bandLo, bandHi);
+
+  diagonal_matrix<float>& B = outAlignment.m_B;
+  diagonal_matrix<int8>& tb = outAlignment.m_tb;
+
+  int32 highX, highY;
+  uint32 ident, similar, length, lengthI, xgaps, xgapsI;
+
+  for (;;)
+  {
+    if (not banded)
+    {
+      bandLo = 1 - dimY;
+      bandHi = dimX - 1;
+    }
+
+    B = diagonal_matrix<float>(dimX, dimY, bandLo, bandHi);
+    tb = diagonal_matrix<int8>(dimX, dimY, bandLo, bandHi);
+
+    FillMatrices(e->m_seq, gop_a, gep_a, gop_b, gep_b, B, tb, highX, highY);
+
 //#if not NDEBUG
 //
 //bool dmp = false;
 //if (e->m_acc == "Q0IJ18")
 //{
 //  dmp = true;
-//  dump(B, Ix, Iy, tb, gop_a, gop_b, gep_a, gep_b, m_seq, e->m_seq);
+//  dump(B, tb, gop_a, gop_b, gep_a, gep_b, m_seq, e->m_seq);
 //}
 //
 //#endif
 
-  // build the alignment
-  x = highX;
-  y = highY;
+    // build the alignment
+    x = highX;
+    y = highY;
 
-  uint32 ident = 0;
-  uint32 similar = 0;
-  uint32 length = 0;
-  uint32 lengthI = 0;
-  uint32 xgaps = 0;
-  uint32 xgapsI = 0;
+    ident = similar = length = lengthI = xgaps = xgapsI = 0;
+    bool edge = false;
 
-  // trace back the matrix
-  while (x >= 0 and y >= 0 and B(x, y) > 0)
-  {
-    ++lengthI;
-    switch (tb(x, y))
+    // trace back the matrix
+    while (x >= 0 and y >= 0 and B(x, y) > 0)
     {
-      case -1:
-        --y;
-        ++xgapsI;
-        break;
+      if (x - y == bandLo or x - y == bandHi)
+        edge = true;
 
-      case 1:
-        if (is_gap(m_seq[x]))
-          --lengthI;
-        --x;
-        break;
+      ++lengthI;
+      switch (tb(x, y))
+      {
+        case -1:
+          --y;
+          ++xgapsI;
+          break;
 
-      case 0:
-        if (not is_gap(m_seq[x]))
-        {
-          length = lengthI;
-          xgaps = xgapsI;
+        case 1:
+          if (is_gap(m_seq[x]))
+            --lengthI;
+          --x;
+          break;
 
-          if (e->m_seq[y] == m_seq[x])
-            ++ident, ++similar;
-          else if (score(kMPam250, m_seq[x], e->m_seq[y]) > 0)
-            ++similar;
-        }
+        case 0:
+          if (not is_gap(m_seq[x]))
+          {
+            length = lengthI;
+            xgaps = xgapsI;
 
-        --x;
-        --y;
-        break;
+            if (e->m_seq[y] == m_seq[x])
+              ++ident, ++similar;
+            else if (score(kMPam250, m_seq[x], e->m_seq[y]) > 0)
+              ++similar;
+          }
 
-      default:
-        assert(false);
-        break;
+          --x;
+          --y;
+          break;
+
+        default:
+          assert(false);
+          break;
+      }
     }
+
+    if (not (banded and edge))
+      break;
+
+    banded = false;
   }
 
+  outAlignment.m_high_x = highX;
+  outAlignment.m_high_y = highY;
+  outAlignment.m_x = x;
+  outAlignment.m_y = y;
+  outAlignment.m_ident = ident;
+  outAlignment.m_similar = similar;
+  outAlignment.m_length = length;
+  outAlignment.m_xgaps = xgaps;
+
   uint32 tix = std::max(10U, std::min(length, 80U)) - 10;
 
   // Add the hit only if it is within the required parameters.
   //
   // accept only alignment long enough (suppress fragments)
   // and those that score high enough
-  if (length >= m_seq.length() * m_frag_cutoff and
-    ident >= length * (kHomologyThreshold[tix] + m_threshold))
+  return length >= m_seq.length() * m_frag_cutoff and
+    ident >= length * (kHomologyThreshold[tix] + m_threshold);
+}
+
+void MProfile::Add(MHitPtr e, const MHitAlignment& inAlignment)
+{
+  const diagonal_matrix<int8>& tb = inAlignment.m_tb;
+
+  int32 highX = inAlignment.m_high_x, highY = inAlignment.m_high_y;
+  int32 x = inAlignment.m_x, y = inAlignment.m_y;
+  uint32 ident = inAlignment.m_ident, similar = inAlignment.m_similar;
+  uint32 length = inAlignment.m_length, lengthI = length;
+  uint32 xgaps = inAlignment.m_xgaps;
+
+  // reserve space, if needed
+  if (xgaps > 0)
   {
-    // reserve space, if needed
-    if (xgaps > 0)
-    {
-      const uint32 kBlockSize = 1024;
-      uint32 n = static_cast<uint32>(
-          (((m_residues.size() + xgaps) / kBlockSize) + 1) * kBlockSize);
-      m_seq.reserve(n);
-      foreach (MHitPtr e, m_entries)
-        e->m_aligned.reserve(n);
-    }
+    const uint32 kBlockSize = 1024;
+    uint32 n = static_cast<uint32>(
+        (((m_residues.size() + xgaps) / kBlockSize) + 1) * kBlockSize);
+    m_seq.reserve(n);
+    m_columns.reserve(n);
+  }
 
-    int32 fx = x + 1, fy = y + 1;
+  int32 fx = x + 1, fy = y + 1;
 
-    // update insert/delete counters for the residues
-    x = highX;  e->m_ilas = m_residues[x].m_seq_nr;
-    y = highY;  e->m_jlas = y + 1;
+  // update insert/delete counters for the residues
+  x = highX;  e->m_ilas = m_residues[x].m_seq_nr;
+  y = highY;  e->m_jlas = y + 1;
 
-    // trace back to fill aligned sequence and to create gaps in MSA
-    e->m_aligned = std::string(m_seq.length() + xgaps, '.');
-    bool gappedx = false, gappedy = false;
+  // trace back to fill aligned sequence and to create gaps in MSA.
+  // The entries accepted earlier are not touched here, the new columns
+  // are recorded in m_columns and ExpandAlignments fills in their gaps.
+  e->m_nr = static_cast<uint32>(m_entries.size() + 1);
+  e->m_aligned = std::string(m_seq.length() + xgaps, '.');
+  bool gappedx = false, gappedy = false;
 
-    lengthI = length;
-    while (x >= fx and y >= fy and lengthI-- > 0)
+  while (x >= fx and y >= fy and lengthI-- > 0)
+  {
+    switch (tb(x, y))
     {
-      switch (tb(x, y))
-      {
-        case -1:
-          e->m_aligned[x + xgaps] = kResidues[e->m_seq[y]];
+      case -1:
+        e->m_aligned[x + xgaps] = kResidues[e->m_seq[y]];
 
-          m_residues.insert(m_residues.begin() + x + 1,
-            MResInfo::NewGap(m_entries.size() + 1,
-                             m_sum_dist_weight, e->m_seq[y], e->m_distance));
+        m_residues.insert(m_residues.begin() + x + 1,
+          MResInfo::NewGap(m_entries.size() + 1,
+                           m_sum_dist_weight, e->m_seq[y], e->m_distance));
 
-          m_seq.insert(m_seq.begin() + x + 1, '.');
+        m_seq.insert(m_seq.begin() + x + 1, '.');
+        m_columns.insert(m_columns.begin() + x + 1, e->m_nr);
 
-          foreach (MHitPtr e, m_entries)
-            e->m_aligned.insert(e->m_aligned.begin() + x + 1, '.');
+        --y;
+        --xgaps;
 
-          --y;
-          --xgaps;
+        if (not gappedx)
+          ++e->m_gaps;
+        ++e->m_gapn;
+        gappedx = true;
+        gappedy = false;
+        break;
 
-          if (not gappedx)
+      case 1:
+        if (is_gap(m_seq[x]))
+          ++lengthI;
+        else
+        {
+          if (not gappedy)
             ++e->m_gaps;
           ++e->m_gapn;
-          gappedx = true;
-          gappedy = false;
-          break;
-
-        case 1:
-          if (is_gap(m_seq[x]))
-            ++lengthI;
-          else
-          {
-            if (not gappedy)
-              ++e->m_gaps;
-            ++e->m_gapn;
-            gappedx = false;
-            gappedy = true;
-          }
+          gappedx = false;
+          gappedy = true;
+        }
 
-          m_residues[x].AddGap(e->m_distance);
-          --x;
-          break;
+        m_residues[x].AddGap(e->m_distance);
+        --x;
+        break;
 
-        case 0:
-          e->m_aligned[x + xgaps] = kResidues[e->m_seq[y]];
-          m_residues[x].Add(e->m_seq[y], e->m_distance);
+      case 0:
+        e->m_aligned[x + xgaps] = kResidues[e->m_seq[y]];
+        m_residues[x].Add(e->m_seq[y], e->m_distance);
 
-          if (not is_gap(e->m_seq[y]) and is_gap(m_seq[x]))
-          {
-            if (not gappedx)
-              ++e->m_gaps;
-            gappedx = true;
-            ++e->m_gapn;
-          }
-          else if (gappedx)
-          {
-            ++m_residues[x].m_ins;
-            gappedx = false;
-          }
+        if (not is_gap(e->m_seq[y]) and is_gap(m_seq[x]))
+        {
+          if (not gappedx)
+            ++e->m_gaps;
+          gappedx = true;
+          ++e->m_gapn;
+        }
+        else if (gappedx)
+        {
+          ++m_residues[x].m_ins;
+          gappedx = false;
+        }
 
-          if (gappedy)
-          {
-            ++m_residues[x].m_del;
-            gappedy = false;
-          }
+        if (gappedy)
+        {
+          ++m_residues[x].m_del;
+          gappedy = false;
+        }
 
-          --x;
-          --y;
-          break;
-      }
+        --x;
+        --y;
+        break;
     }
+  }
 
-    // update the new entry
-    e->m_identical = ident;
-    e->m_similar = similar;
-    e->m_length = length;
-    e->m_distance = 1 - float(ident) / length;
-    e->m_score = 1 - e->m_distance;
+  // update the new entry
+  e->m_identical = ident;
+  e->m_similar = similar;
+  e->m_length = length;
+  e->m_distance = 1 - float(ident) / length;
+  e->m_score = 1 - e->m_distance;
 
-    e->m_ifir = m_residues[x + 1].m_seq_nr;
-    e->m_jfir = y + 2;
+  e->m_ifir = m_residues[x + 1].m_seq_nr;
+  e->m_jfir = y + 2;
 
-    e->m_stid = e->m_acc + '/' +
-      boost::lexical_cast<std::string>(e->m_jfir) + '-' +
-      boost::lexical_cast<std::string>(e->m_jlas);
+  e->m_stid = e->m_acc + '/' +
+    boost::lexical_cast<std::string>(e->m_jfir) + '-' +
+    boost::lexical_cast<std::string>(e->m_jlas);
 
-    m_entries.push_back(e);
+  m_entries.push_back(e);
 
-    m_sum_dist_weight += e->m_distance;
+  m_sum_dist_weight += e->m_distance;
 
 //#if not defined(NDEBUG)
-//    if (dmp)
-//    {
-//      std::string s = decode(m_seq);
-//      for (std::string::size_type i = 72; i < s.length(); i += 73)
-//        s.insert(s.begin() + i, '\n');
+//  if (dmp)
+//  {
+//    std::string s = decode(m_seq);
+//    for (std::string::size_type i = 72; i < s.length(); i += 73)
+//      s.insert(s.begin() + i, '\n');
 //
-//      cout << '>' << "PDB" << std::endl
-//         << s << std::endl;
+//    cout << '>' << "PDB" << std::endl
+//       << s << std::endl;
 //
-//      foreach (MHitPtr e, m_entries)
-//        cout << *e;
-//      exit(1);
-//    }
+//    foreach (MHitPtr e, m_entries)
+//      cout << *e;
+//    exit(1);
+//  }
 //#endif
+}
+
+// Each entry was aligned against the columns that existed when it was
+// added, bring them all up to the final set of columns by inserting a
+// gap for every column added by a later entry.
+void MProfile::ExpandAlignments()
+{
+  foreach (MHitPtr e, m_entries)
+  {
+    if (e->m_aligned.length() == m_columns.size())
+      continue;
+
+    std::string aligned(m_columns.size(), '.');
+    std::string::const_iterator a = e->m_aligned.begin();
+    for (uint32 i = 0; i < m_columns.size(); ++i)
+    {
+      if (m_columns[i] <= e->m_nr)
+        aligned[i] = *a++;
+    }
+
+    assert(a == e->m_aligned.end());
+    e->m_aligned.swap(aligned);
   }
 }
 
@@ -823,27 +1240,35 @@ void MProfile::PrintStockholm(std::ostream& os, const std::string& inChainID,
 
   // ## per residue information
 
+  // the per residue lines are formatted in a buffer that is written out
+  // every now and then
+  format_buffer b;
+
   uint32 nextNr = m_residues.front().m_seq_nr;
-  os << "#=GF CC ## RESIDUE INFORMATION" << std::endl
-     << "#=GF CC SeqNo   PDBNo AA STRUCTURE BP1 BP2  ACC  NOCC VAR"
-     << std::endl;
+  b.put("#=GF CC ## RESIDUE INFORMATION\n"
+        "#=GF CC SeqNo   PDBNo AA STRUCTURE BP1 BP2  ACC  NOCC VAR\n");
   foreach (auto& ri, m_residues)
   {
     if (ri.m_chain_id.empty())
       continue;
 
     if (ri.m_seq_nr != nextNr)
-      os << boost::format("#=GF RI %5.5d       ! !              0   0    0     0   0") % nextNr << std::endl;
+      b.put("#=GF RI ").integer(nextNr, 5)
+       .put("       ! !              0   0    0     0   0\n");
 
     uint32 ivar = uint32(100 * (1 - ri.m_consweight));
-    os << boost::format("#=GF RI %5.5d %s%5.5d%4.4d") % ri.m_seq_nr % ri.m_dssp % ri.m_nocc % ivar << std::endl;
+    b.put("#=GF RI ").integer(ri.m_seq_nr, 5).put(' ').put(ri.m_dssp)
+     .integer(ri.m_nocc, 5).integer(ivar, 4).put('\n');
 
     nextNr = ri.m_seq_nr + 1;
+
+    if (b.size() > 65536)
+      b.flush(os);
   }
 
   // ## SEQUENCE PROFILE AND ENTROPY
-  os << "#=GF CC ## SEQUENCE PROFILE AND ENTROPY" << std::endl
-     << "#=GF CC   SeqNo PDBNo   V   L   I   M   F   W   Y   G   A   P   S   T   C   H   R   K   Q   E   N   D  NOCC NDEL NINS ENTROPY RELENT WEIGHT" << std::endl;
+  b.put("#=GF CC ## SEQUENCE PROFILE AND ENTROPY\n"
+        "#=GF CC   SeqNo PDBNo   V   L   I   M   F   W   Y   G   A   P   S   T   C   H   R   K   Q   E   N   D  NOCC NDEL NINS ENTROPY RELENT WEIGHT\n");
 
   nextNr = m_residues.front().m_seq_nr;
   foreach (auto& ri, m_residues)
@@ -852,18 +1277,24 @@ void MProfile::PrintStockholm(std::ostream& os, const std::string& inChainID,
       continue;
 
     if (ri.m_seq_nr != nextNr)
-      os << boost::format("#=GF PR %5.5d           0   0   0   0   0   0   0   0   0   0   0   0   0   0   0   0   0   0   0   0     0    0    0   0.000      0  1.00")
-        % nextNr << std::endl;
+      b.put("#=GF PR ").integer(nextNr, 5)
+       .put("           0   0   0   0   0   0   0   0   0   0   0   0   0   0   0   0   0   0   0   0     0    0    0   0.000      0  1.00\n");
 
-    os << boost::format("#=GF PR %5.5d %5.5d %1.1s") % ri.m_seq_nr % ri.m_pdb_nr % ri.m_chain_id;
+    b.put("#=GF PR ").integer(ri.m_seq_nr, 5).put(' ')
+     .integer(ri.m_pdb_nr, 5).put(' ').string(ri.m_chain_id, 1, 1);
 
     for (uint32 i = 0; i < 20; ++i)
-      os << boost::format("%4.4d") % uint32(100.0 * ri.m_freq[i] + 0.5);
+      b.integer(uint32(100.0 * ri.m_freq[i] + 0.5), 4);
 
     uint32 relent = uint32(100 * ri.m_entropy / log(20.0));
-    os << "  " << boost::format("%4.4d %4.4d %4.4d  %6.3f   %4.4d %5.2f") % ri.m_nocc % ri.m_del % ri.m_ins % ri.m_entropy % relent % ri.m_consweight << std::endl;
+    b.put("  ").integer(ri.m_nocc, 4).put(' ').integer(ri.m_del, 4).put(' ')
+     .integer(ri.m_ins, 4).put("  ").fixed(ri.m_entropy, 6, 3).put("   ")
+     .integer(relent, 4).put(' ').fixed(ri.m_consweight, 5, 2).put('\n');
 
     nextNr = ri.m_seq_nr + 1;
+
+    if (b.size() > 65536)
+      b.flush(os);
   }
 
   // find the longest ID std::string length
@@ -874,9 +1305,8 @@ void MProfile::PrintStockholm(std::ostream& os, const std::string& inChainID,
       tl = e->m_stid.length();
   }
 
-  os << "#=GS " << inChainID << std::string(tl - inChainID.length(), ' ') << " CC The query chain" << std::endl;
-
-  boost::format fmt("#=GS %s HSSP score=%4.2f/%4.2f aligned=%d-%d/%d-%d length=%d ngaps=%d gaplen=%d seqlen=%d");
+  b.put("#=GS ").put(inChainID).put(' ', tl - inChainID.length())
+   .put(" CC The query chain\n");
 
   std::map<std::string,std::vector<std::string>> linked;
   if (inFetchDBRefs)
@@ -893,17 +1323,25 @@ void MProfile::PrintStockholm(std::ostream& os, const std::string& inChainID,
   {
     std::string id = e->m_stid + std::string(tl - e->m_stid.length(), ' ');
 
-    os << "#=GS " << id << " ID " << e->m_id << std::endl
-       << "#=GS " << id << " DE " << e->m_def << std::endl
-       << fmt % id % e->m_score % (float(e->m_similar) / e->m_length)
-           % e->m_ifir % e->m_ilas % e->m_jfir % e->m_jlas % e->m_length
-           % e->m_gaps % e->m_gapn % e->m_seq.length() << std::endl;
+    b.put("#=GS ").put(id).put(" ID ").put(e->m_id).put('\n')
+     .put("#=GS ").put(id).put(" DE ").put(e->m_def).put('\n')
+     .put("#=GS ").put(id).put(" HSSP score=").fixed(e->m_score, 4, 2)
+     .put('/').fixed(float(e->m_similar) / e->m_length, 4, 2)
+     .put(" aligned=").integer(e->m_ifir).put('-').integer(e->m_ilas)
+     .put('/').integer(e->m_jfir).put('-').integer(e->m_jlas)
+     .put(" length=").integer(e->m_length)
+     .put(" ngaps=").integer(e->m_gaps)
+     .put(" gaplen=").integer(e->m_gapn)
+     .put(" seqlen=").integer(e->m_seq.length()).put('\n');
 
     if (inFetchDBRefs and not linked[e->m_id].empty())
     {
-      os << "#=GS " << id << " DR PDB " << ba::join(linked[e->m_id], ", ")
-         << std::endl;
+      b.put("#=GS ").put(id).put(" DR PDB ")
+       .put(ba::join(linked[e->m_id], ", ")).put('\n');
     }
+
+    if (b.size() > 65536)
+      b.flush(os);
   }
 
   if (tl < 17)
@@ -916,9 +1354,8 @@ void MProfile::PrintStockholm(std::ostream& os, const std::string& inChainID,
     if (o + n > m_seq.length())
       n = m_seq.length() - o;
 
-    os << std::endl
-       << inChainID << std::string(tl - inChainID.length() + 1, ' ')
-       << decode(m_seq.substr(o, n)) << std::endl;
+    b.put('\n').put(inChainID).put(' ', tl - inChainID.length() + 1)
+     .put(decode(m_seq.substr(o, n))).put('\n');
 
     std::string ss(n, '.'), ins(n, ' '), del(n, ' '), ent(n, '-'), var(n, '-');
     for (std::string::size_type i = o; i < o + n; ++i)
@@ -943,20 +1380,24 @@ void MProfile::PrintStockholm(std::ostream& os, const std::string& inChainID,
     }
 
     foreach (const MHitPtr e, m_entries)
-      os << e->m_stid << std::string(tl - e->m_stid.length() + 1, ' ')
-         << e->m_aligned.substr(o, n) << std::endl;
+    {
+      b.put(e->m_stid).put(' ', tl - e->m_stid.length() + 1)
+       .put(e->m_aligned.substr(o, n)).put('\n');
+
+      if (b.size() > 65536)
+        b.flush(os);
+    }
 
-    os << "#=GC SS          " << std::string(tl - 17 + 1, ' ') << ss
-       << std::endl
-       << "#=GC Entropy     " << std::string(tl - 17 + 1, ' ') << ent
-       << std::endl
-       << "#=GC Variability " << std::string(tl - 17 + 1, ' ') << var
-       << std::endl;
+    b.put("#=GC SS          ").put(' ', tl - 17 + 1).put(ss).put('\n')
+     .put("#=GC Entropy     ").put(' ', tl - 17 + 1).put(ent).put('\n')
+     .put("#=GC Variability ").put(' ', tl - 17 + 1).put(var).put('\n');
 
     o += n;
   }
 
-  os << "//" << std::endl;
+  b.put("//\n");
+  b.flush(os);
+  os.flush();
 }
 
 void MProfile::PrintStockholm(std::ostream& os, const MProtein& inProtein,
@@ -1025,64 +1466,43 @@ void MProfile::PrintStockholm(std::ostream& os, const MProtein& inProtein,
 
 // --------------------------------------------------------------------
 
-void MProfile::Process(std::istream& inHits, float inGapOpen,
+void MProfile::Process(const std::vector<BlastHit>& inHits, float inGapOpen,
                        float inGapExtend, uint32 inMaxHits, uint32 inThreads)
 {
   std::vector<MHitPtr> hits;
+  hits.reserve(inHits.size());
 
-  std::string id, def, seq;
-  for (;;)
+  foreach (const BlastHit& hit, inHits)
   {
-    std::string line;
-    getline(inHits, line);
-    if (line.empty() and inHits.eof())
-      break;
-
-    if (ba::starts_with(line, ">"))
-    {
-      if (not (id.empty() or seq.empty()))
-        hits.push_back(MHit::Create(id, def, seq));
-
-      id.clear();
-      def.clear();
-      seq.clear();
-
-      std::string::size_type s = line.find(' ');
-      if (s != std::string::npos)
-      {
-        id = line.substr(1, s - 1);
-        def = line.substr(s + 1);
-      }
-      else
-        id = line.substr(1);
-    }
-    else
-      seq += line;
+    if (not (hit.mId.empty() and hit.mAcc.empty()))
+      hits.push_back(MHitPtr(new MHit(hit)));
   }
 
-  if (not (id.empty() or seq.empty()))
-    hits.push_back(MHit::Create(id, def, seq));
-
-  // Now calculate distances
+  // Now calculate distances, four at a time. Hits of about the same length
+  // are taken together, so that few lanes finish long before the others.
   MProgress p1(hits.size(), "distance");
 
-  boost::thread_group threads;
-  MCounter ix(0);
+  std::vector<MHitPtr> byLength(hits);
+  sort(byLength.begin(), byLength.end(),
+       [](const MHitPtr a, const MHitPtr b) -> bool {
+    return a->m_seq.length() < b->m_seq.length();
+  });
+
+  ParallelFor((byLength.size() + 3) / 4, [this, &byLength, &p1](uint32 i) {
+    uint32 n = std::min<uint32>(4, byLength.size() - 4 * i);
 
-  for (uint32 t = 0; t < inThreads; ++t)
-    threads.create_thread([this, &ix, &hits, &p1]() {
-      for (;;)
-      {
-        uint64 next = ix++;
-        if (next >= hits.size())
-          break;
+    const sequence* seqs[4];
+    float distances[4];
+    for (uint32 k = 0; k < n; ++k)
+      seqs[k] = &byLength[4 * i + k]->m_seq;
 
-        hits[next]->CalculateDistance(m_seq);
-        p1.Consumed(1);
-      }
-    });
+    calculateDistances(seqs, n, m_seq, distances);
+
+    for (uint32 k = 0; k < n; ++k)
+      byLength[4 * i + k]->m_distance = distances[k];
 
-  threads.join_all();
+    p1.Consumed(n);
+  }, inThreads);
 
   // if we have way too many hits, take a random set
   if (hits.size() > inMaxHits * 10 and inMaxHits > 0)
@@ -1101,12 +1521,45 @@ void MProfile::Process(std::istream& inHits, float inGapOpen,
     return a->m_distance < b->m_distance;
   });
 
-  // and then align all the hits
+  // and then align all the hits. Only accepted hits change the profile, so
+  // the next few hits are aligned in parallel against the current profile.
+  // Their results are used in order, up to the first hit that is accepted,
+  // the hits after that one are aligned again against the new profile.
+  // While hits are accepted that work is lost, so the window shrinks to a
+  // single hit after an accept and doubles after every window without one.
   MProgress p2(hits.size(), "aligning");
-  foreach (MHitPtr e, hits)
+
+  uint32 maxWindow = inThreads > 0 ? inThreads : MThreadPool::Instance().Size();
+  if (maxWindow == 0)
+    maxWindow = 1;
+
+  std::vector<MHitAlignment> alignments(maxWindow);
+  std::vector<uint8> accepted(maxWindow);
+
+  uint32 window = 1;
+  for (uint32 i = 0; i < hits.size(); )
   {
-    Align(e, inGapOpen, inGapExtend);
-    p2.Consumed(1);
+    uint32 n = std::min<uint32>(window, hits.size() - i);
+
+    ParallelFor(n, [&](uint32 k) {
+      accepted[k] = Align(hits[i + k], inGapOpen, inGapExtend, alignments[k]);
+    }, inThreads);
+
+    uint32 k = 0;
+    while (k < n and not accepted[k])
+      ++k;
+
+    if (k < n)
+    {
+      Add(hits[i + k], alignments[k]);
+      ++k;
+      window = 1;
+    }
+    else
+      window = std::min(2 * window, maxWindow);
+
+    i += k;
+    p2.Consumed(k);
   }
 
   // now if we have too many entries, take a random set
@@ -1117,6 +1570,8 @@ void MProfile::Process(std::istream& inHits, float inGapOpen,
     m_shuffled = true;
   }
 
+  ExpandAlignments();
+
   // sort by score
   sort(m_entries.begin(), m_entries.end(),
        [](const MHitPtr a, const MHitPtr b) -> bool {
@@ -1187,91 +1642,158 @@ void ClusterSequences(const std::vector<sequence>& s, std::vector<size_t>& ix)
 }
 
 // --------------------------------------------------------------------
-// Calculate the variability of a residue, based on dayhoff similarity
-// and weights
+// The aligned sequences of a profile, packed once aligning is done. Each
+// sequence is stored as residue numbers, 23 for gaps, and bit-sliced: for
+// every 64 columns five planes with the bits of those residue numbers and a
+// mask of the columns that are not a gap.
 
-std::pair<const char*,uint32> kSentinel((const char*)nullptr, 0);
+inline uint32 popcount(uint64 v)
+{
+#if defined(__GNUC__)
+  return __builtin_popcountll(v);
+#else
+  v = v - ((v >> 1) & 0x5555555555555555ULL);
+  v = (v & 0x3333333333333333ULL) + ((v >> 2) & 0x3333333333333333ULL);
+  v = (v + (v >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+  return static_cast<uint32>((v * 0x0101010101010101ULL) >> 56);
+#endif
+}
 
-void CalculateConservation(buffer<std::pair<const char*,uint32>>& b,
-                           const std::vector<MHitPtr>& inHits,
-                           std::vector<float>& sumvar,
-                           std::vector<float>& sumdist)
+class MPackedAlignment
 {
-  size_t length = sumvar.size();
-  std::vector<float> simval(length);
+  public:
+    MPackedAlignment(const std::vector<const char*>& inSeqs, uint32 inLength);
+
+    uint32 size() const         { return m_size; }
+    const uint8* residues(uint32 i) const
+                                { return &m_residues[i * m_length]; }
+
+    // the number of columns where neither i nor j has a gap, and the number
+    // of those where they have the same residue
+    void Compare(uint32 i, uint32 j, uint32& outLength,
+                 uint32& outIdentical) const;
+
+    // Calculate the variability of a residue, based on dayhoff similarity
+    // and weights. Each pair of sequence i with a sequence following it adds
+    // its distance times the dayhoff similarity to every column where both
+    // have one of the first 21 residues.
+    void AddConservation(uint32 i, std::vector<float>& sumvar,
+                         std::vector<float>& sumdist) const;
+
+  private:
+    static const uint32 kPlanes = 5, kCodes = 24, kSimilarity = 21;
+
+    uint32 m_size, m_length, m_blocks;
+    std::vector<uint8> m_residues;
+    std::vector<uint64> m_bits;     // per sequence and block the planes,
+                                    // followed by the not-gap mask
+    float m_dayhoff[kSimilarity][kCodes];
+};
 
-  for (;;)
+MPackedAlignment::MPackedAlignment(const std::vector<const char*>& inSeqs,
+                                   uint32 inLength)
+  : m_size(static_cast<uint32>(inSeqs.size()))
+  , m_length(inLength), m_blocks((inLength + 63) / 64)
+  , m_residues(m_size * m_length)
+  , m_bits(m_size * m_blocks * (kPlanes + 1))
+{
+  for (uint32 i = 0; i < m_size; ++i)
   {
-    auto next = b.get();
-    if (next == kSentinel)
-      break;
+    uint8* residues = &m_residues[i * m_length];
+    uint64* bits = &m_bits[i * m_blocks * (kPlanes + 1)];
 
-    const char* si = next.first;
-    for (uint32 j = next.second; j < inHits.size(); ++j)
+    for (uint32 k = 0; k < m_length; ++k)
     {
-      const char* sj = inHits[j]->m_aligned.c_str();
+      char c = inSeqs[i][k];
+      uint8 r = ResidueNr(c);
+      residues[k] = r;
+
+      uint64* block = bits + (k / 64) * (kPlanes + 1);
+      uint64 bit = 1ULL << (k % 64);
 
-      uint32 len = 0, agr = 0;
-      for (uint32 k = 0; k < length; ++k)
+      for (uint32 p = 0; p < kPlanes; ++p)
       {
-        simval[k] = std::numeric_limits<float>::min();
+        if (r & (1 << p))
+          block[p] |= bit;
+      }
 
-        if (is_gap(si[k]) or is_gap(sj[k]))
-          continue;
+      if (not is_gap(c))
+        block[kPlanes] |= bit;
+    }
+  }
 
-        ++len;
-        if (si[k] == sj[k])
-          ++agr;
+  // residues past the first 21 have no similarity
+  for (uint8 ri = 0; ri < kSimilarity; ++ri)
+    for (uint8 rj = 0; rj < kCodes; ++rj)
+      m_dayhoff[ri][rj] = rj < kSimilarity ? score(kDayhoffData, ri, rj) : 0;
+}
 
-        int8 ri = ResidueNr(si[k]);
-        int8 rj = ResidueNr(sj[k]);
+void MPackedAlignment::Compare(uint32 i, uint32 j, uint32& outLength,
+                               uint32& outIdentical) const
+{
+  const uint64* bi = &m_bits[i * m_blocks * (kPlanes + 1)];
+  const uint64* bj = &m_bits[j * m_blocks * (kPlanes + 1)];
 
-        if (ri <= 20 and rj <= 20)
-          simval[k] = score(kDayhoffData, ri, rj);
-      }
+  outLength = outIdentical = 0;
 
-      if (len == 0)
-        continue;
+  for (uint32 b = 0; b < m_blocks; ++b, bi += kPlanes + 1, bj += kPlanes + 1)
+  {
+    uint64 both = bi[kPlanes] & bj[kPlanes];
+    uint64 same = both;
+    for (uint32 p = 0; p < kPlanes; ++p)
+      same &= ~(bi[p] ^ bj[p]);
 
-      float distance = 1 - (float(agr) / float(len));
-      for (uint32 k = 0; k < length; ++k)
-      {
-        if (simval[k] != std::numeric_limits<float>::min())
-        {
-          sumvar[k] += distance * simval[k];
-          sumdist[k] += distance * 1.5f;
-        }
-      }
-    }
+    outLength += popcount(both);
+    outIdentical += popcount(same);
   }
-
-  b.put(kSentinel);
 }
 
-void MProfile::CalculateConservation(uint32 inThreads)
+void MPackedAlignment::AddConservation(uint32 i, std::vector<float>& sumvar,
+                                       std::vector<float>& sumdist) const
 {
-  std::vector<float> sumvar(m_seq.length(), 0), sumdist(m_seq.length(), 0);
+  // the summed distances of sequence i to the others, per column and
+  // residue in the other sequence
+  std::vector<float> weights(m_length * kCodes);
 
-  // Calculate conservation weights in multiple threads to gain speed.
-  buffer<std::pair<const char*,uint32>> b;
-  boost::thread_group threads;
-  boost::mutex sumLock;
+  for (uint32 j = i + 1; j < m_size; ++j)
+  {
+    uint32 len, agr;
+    Compare(i, j, len, agr);
 
-  for (uint32 t = 0; t < inThreads; ++t)
-    threads.create_thread([&]() {
-      std::vector<float> csumvar(sumvar.size(), 0), csumdist(sumdist.size(), 0);
+    if (len == 0)
+      continue;
 
-      HSSP::CalculateConservation(b, m_entries, csumvar, csumdist);
+    float distance = 1 - (float(agr) / float(len));
 
-      // accumulate our data
-      boost::mutex::scoped_lock l(sumLock);
+    const uint8* rj = residues(j);
+    for (uint32 k = 0; k < m_length; ++k)
+      weights[k * kCodes + rj[k]] += distance;
+  }
 
-      for (size_t i = 0; i < sumvar.size(); ++i)
-      {
-        sumvar[i] += csumvar[i];
-        sumdist[i] += csumdist[i];
-      }
-    });
+  const uint8* ri = residues(i);
+  for (uint32 k = 0; k < m_length; ++k)
+  {
+    if (ri[k] >= kSimilarity)
+      continue;
+
+    const float* w = &weights[k * kCodes];
+    const float* dayhoff = m_dayhoff[ri[k]];
+
+    float var = 0, dist = 0;
+    for (uint32 r = 0; r < kSimilarity; ++r)
+    {
+      var += w[r] * dayhoff[r];
+      dist += w[r];
+    }
+
+    sumvar[k] += var;
+    sumdist[k] += dist * 1.5f;
+  }
+}
+
+void MProfile::CalculateConservation(uint32 inThreads)
+{
+  std::vector<float> sumvar(m_seq.length(), 0), sumdist(m_seq.length(), 0);
 
   int64 N = (m_entries.size() * (m_entries.size() + 1)) / 2;
   if (m_shuffled)
@@ -1279,6 +1801,16 @@ void MProfile::CalculateConservation(uint32 inThreads)
 
   MProgress p(N, "conservation");
 
+  std::string s(decode(m_seq));
+
+  // sequence 0 is the query, sequence i entry i - 1
+  std::vector<const char*> seqs;
+  seqs.push_back(s.c_str());
+  foreach (MHitPtr e, m_entries)
+    seqs.push_back(e->m_aligned.c_str());
+
+  MPackedAlignment packed(seqs, static_cast<uint32>(s.length()));
+
   if (m_shuffled)  // need to recalculate m_dist[] and m_nocc
   {
     for (uint32 i = 0; i < m_seq.length(); ++i)
@@ -1289,9 +1821,9 @@ void MProfile::CalculateConservation(uint32 inThreads)
       for (uint32 j = 0; j < 23; ++j)
         ri.m_dist[j] = m_seq[i] == j ? 1 : 0;
 
-      foreach (MHitPtr e, m_entries)
+      for (uint32 e = 1; e < packed.size(); ++e)
       {
-        uint8 r = ResidueNr(e->m_aligned[i]);
+        uint8 r = packed.residues(e)[i];
         if (r < 23)
         {
           ++ri.m_dist[r];
@@ -1303,19 +1835,38 @@ void MProfile::CalculateConservation(uint32 inThreads)
     }
   }
 
-  std::string s(decode(m_seq));
-  b.put(std::make_pair(s.c_str(), 0));
+  // Calculate conservation weights in multiple threads to gain speed, each
+  // row compares a sequence with the ones following it.
+  uint32 nr_of_tasks = std::min(inThreads, MThreadPool::Instance().Size());
+  MCounter next(0);
+  boost::mutex sumLock;
+  MTaskGroup tasks;
 
-  p.Consumed(m_entries.size());
+  for (uint32 t = 0; t < nr_of_tasks; ++t)
+    tasks.Run([&]() {
+      std::vector<float> csumvar(sumvar.size(), 0), csumdist(sumdist.size(), 0);
 
-  for (uint32 i = 0; i + 1 < m_entries.size(); ++i)
-  {
-    b.put(std::make_pair(m_entries[i]->m_aligned.c_str(), i + 1));
-    p.Consumed(m_entries.size() - i);
-  }
+      for (;;)
+      {
+        uint32 row = static_cast<uint32>(next++);
+        if (row >= m_entries.size())
+          break;
+
+        packed.AddConservation(row, csumvar, csumdist);
+        p.Consumed(m_entries.size() - row);
+      }
+
+      // accumulate our data
+      boost::mutex::scoped_lock l(sumLock);
+
+      for (size_t i = 0; i < sumvar.size(); ++i)
+      {
+        sumvar[i] += csumvar[i];
+        sumdist[i] += csumdist[i];
+      }
+    });
 
-  b.put(kSentinel);
-  threads.join_all();
+  tasks.Wait();
 
   for (uint32 i = 0; i < m_seq.length(); ++i)
   {
@@ -1345,19 +1896,25 @@ void MProfile::CalculateConservation(uint32 inThreads)
 
 // --------------------------------------------------------------------
 
-void CreateHSSP(const MProtein& inProtein,
-                const std::vector<fs::path>& inDatabanks,
-                uint32 inMaxHits, uint32 inMinSeqLength, float inGapOpen,
-                float inGapExtend, float inThreshold, float inFragmentCutOff,
-                uint32 inThreads, bool inFetchDBRefs, std::ostream& inOs)
+// The chains of a protein that need a profile. Of chains with overlapping
+// sequences only the longest one is kept.
+
+struct MChainSet
 {
-  // construct a set of unique sequences, containing only the largest ones in
-  // case of overlap
   std::vector<sequence> seqset;
   std::vector<size_t> ix;
   std::vector<const MChain*> chains;
   std::vector<std::vector<std::string>> aka;
   std::vector<std::string> used;
+  std::vector<size_t> query;    // index of the blast query for each sequence
+};
+
+void CollectChains(const MProtein& inProtein, uint32 inMinSeqLength,
+                   MChainSet& outChains)
+{
+  std::vector<sequence>& seqset = outChains.seqset;
+  std::vector<size_t>& ix = outChains.ix;
+  std::vector<const MChain*>& chains = outChains.chains;
 
   foreach (const MChain* chain, inProtein.GetChains())
   {
@@ -1370,7 +1927,7 @@ void CreateHSSP(const MProtein& inProtein,
     chains.push_back(chain);
     seqset.push_back(encode(seq));
     ix.push_back(ix.size());
-    aka.push_back(std::vector<std::string>());
+    outChains.aka.push_back(std::vector<std::string>());
   }
 
   if (seqset.empty())
@@ -1383,53 +1940,136 @@ void CreateHSSP(const MProtein& inProtein,
   for (size_t i = 0; i < ix.size(); ++i)
   {
     if (ix[i] != i)
-      aka[ix[i]].push_back(chains[i]->GetChainID());
+      outChains.aka[ix[i]].push_back(chains[i]->GetChainID());
   }
 
   sort(ix.begin(), ix.end());
   ix.erase(unique(ix.begin(), ix.end()), ix.end());
 
   foreach (size_t i, ix)
-    used.push_back(chains[i]->GetChainID());
+    outChains.used.push_back(chains[i]->GetChainID());
 
+  outChains.query.assign(seqset.size(), 0);
+}
+
+void WriteHSSP(const MProtein& inProtein, const MChainSet& inChains,
+               const std::vector<std::vector<BlastHit> >& inBlastHits,
+               uint32 inMaxHits, float inGapOpen, float inGapExtend, float inThreshold,
+               float inFragmentCutOff, uint32 inThreads, bool inFetchDBRefs,
+               std::ostream& inOs)
+{
   bool empty = true;
 
-  foreach (size_t i, ix)
+  foreach (size_t i, inChains.ix)
   {
-    const MChain& chain(*chains[i]);
-
-    // do a blast search for inMaxHits * 4 hits.
-    std::vector<char> blastHits;
-
-    io::filtering_ostream out(io::back_inserter(blastHits));
-
-    //ifstream f("1F88-A-hits.fa");
-    //io::copy(f, out);
-
-    std::string seq = decode(seqset[i]);
-    SearchAndWriteResultsAsFastA(out, inDatabanks, seq,
-      "blastp", "BLOSUM62", 3, 10, true, true, -1, -1, 0, inThreads);
-    out.flush();
+    const MChain& chain(*inChains.chains[i]);
+    const std::vector<BlastHit>& blastHits = inBlastHits[inChains.query[i]];
 
     if (blastHits.empty())
       continue;
 
-    MProfile profile(chain, seqset[i], inThreshold, inFragmentCutOff);
+    MProfile profile(chain, inChains.seqset[i], inThreshold, inFragmentCutOff);
 
-    io::filtering_istream in(boost::make_iterator_range(blastHits));
-    profile.Process(in, inGapOpen, inGapExtend, inMaxHits, inThreads);
+    profile.Process(blastHits, inGapOpen, inGapExtend, inMaxHits, inThreads);
 
     if (profile.m_entries.empty())
       continue;
 
     empty = false;
-    profile.PrintStockholm(inOs, inProtein, inFetchDBRefs, used, aka[i]);
+    profile.PrintStockholm(inOs, inProtein, inFetchDBRefs, inChains.used,
+                           inChains.aka[i]);
   }
 
   if (empty)
     throw mas_exception("No hits found");
 }
 
+void CreateHSSP(const std::vector<const MProtein*>& inProteins,
+                const std::vector<fs::path>& inDatabanks,
+                uint32 inMaxHits, uint32 inMinSeqLength, float inGapOpen,
+                float inGapExtend, float inThreshold, float inFragmentCutOff,
+                uint32 inThreads, bool inFetchDBRefs, std::ostream& inOs,
+                std::vector<std::string>& outErrors)
+{
+  outErrors.assign(inProteins.size(), std::string());
+
+  // collect the chains of all proteins, identical sequences are searched
+  // for only once
+  boost::ptr_vector<MChainSet> chainSets;
+  std::vector<std::string> queries;
+  std::map<sequence,size_t> queryIndex;
+
+  for (size_t p = 0; p < inProteins.size(); ++p)
+  {
+    chainSets.push_back(new MChainSet);
+    MChainSet& chainSet = chainSets.back();
+
+    try
+    {
+      CollectChains(*inProteins[p], inMinSeqLength, chainSet);
+    }
+    catch (const std::exception& e)
+    {
+      outErrors[p] = e.what();
+      continue;
+    }
+
+    foreach (size_t i, chainSet.ix)
+    {
+      const sequence& seq = chainSet.seqset[i];
+
+      if (queryIndex.find(seq) == queryIndex.end())
+      {
+        queryIndex[seq] = queries.size();
+        queries.push_back(decode(seq));
+      }
+
+      chainSet.query[i] = queryIndex[seq];
+    }
+  }
+
+  // do a blast search for all the queries in one go
+  std::vector<std::vector<BlastHit> > blastHits(queries.size());
+
+  if (not queries.empty())
+    SearchForHits(blastHits, inDatabanks, queries, "blastp", "BLOSUM62", 3,
+                  10, true, true, -1, -1, 0, inThreads);
+
+  for (size_t p = 0; p < inProteins.size(); ++p)
+  {
+    if (not outErrors[p].empty())
+      continue;
+
+    try
+    {
+      WriteHSSP(*inProteins[p], chainSets[p], blastHits, inMaxHits,
+                inGapOpen, inGapExtend, inThreshold, inFragmentCutOff,
+                inThreads, inFetchDBRefs, inOs);
+    }
+    catch (const std::exception& e)
+    {
+      outErrors[p] = e.what();
+    }
+  }
+}
+
+void CreateHSSP(const MProtein& inProtein,
+                const std::vector<fs::path>& inDatabanks,
+                uint32 inMaxHits, uint32 inMinSeqLength, float inGapOpen,
+                float inGapExtend, float inThreshold, float inFragmentCutOff,
+                uint32 inThreads, bool inFetchDBRefs, std::ostream& inOs)
+{
+  std::vector<const MProtein*> proteins(1, &inProtein);
+  std::vector<std::string> errors;
+
+  CreateHSSP(proteins, inDatabanks, inMaxHits, inMinSeqLength, inGapOpen,
+             inGapExtend, inThreshold, inFragmentCutOff, inThreads,
+             inFetchDBRefs, inOs, errors);
+
+  if (not errors.front().empty())
+    throw mas_exception(errors.front());
+}
+
 // --------------------------------------------------------------------
 
 void CreateHSSP(const std::string& inProtein,
@@ -7,6 +7,7 @@
 
 #include <boost/filesystem/path.hpp>
 
+#include <cstddef>
 #include <vector>
 
 
@@ -23,12 +24,39 @@ void CreateHSSP(const MProtein& inProtein,
   float inThreshold, float inFragmentCutOff, uint32 inThreads,
   bool inFetchDBRefs, std::ostream& inOutStream);
 
+// Create the HSSP data for several proteins, the unique chains of all of
+// them are searched for in a single pass over the databanks. When a protein
+// fails outErrors contains the reason at its index, the others are still
+// written to inOutStream.
+void CreateHSSP(const std::vector<const MProtein*>& inProteins,
+  const std::vector<boost::filesystem::path>& inDatabanks,
+  uint32 inMaxhits, uint32 inMinSeqLength, float inGapOpen, float inGapExtend,
+  float inThreshold, float inFragmentCutOff, uint32 inThreads,
+  bool inFetchDBRefs, std::ostream& inOutStream,
+  std::vector<std::string>& outErrors);
+
 void CreateHSSP(const std::string& inProtein,
   const std::vector<boost::filesystem::path>& inDatabanks,
   uint32 inMaxhits, uint32 inMinSeqLength, float inGapOpen, float inGapExtend,
   float inThreshold, float inFragmentCutOff, uint32 inThreads,
   bool inFetchDBRefs, std::ostream& inOutStream);
 
+// The factor for the gap open penalty at inIndex in a profile of inLength
+// residues: the closer a gap (inIsGap) or either end of the profile, the
+// higher the penalty. Positions 8 or more residues away keep their penalty.
+template<class IsGap>
+float GapProximityFactor(std::size_t inIndex, std::size_t inLength,
+                         IsGap inIsGap)
+{
+  for (std::size_t d = 0; d < 8; ++d)
+  {
+    if (inIndex + d >= inLength or inIsGap(inIndex + d) or
+        inIndex < d or inIsGap(inIndex - d))
+      return (2 + ((8 - d) * 2)) / 8.f;
+  }
+  return 1;
+}
+
 }
 
 #endif
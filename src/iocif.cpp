@@ -28,123 +28,55 @@ const char* skip_white(const char* p, const char* end);
 const char* skip_value(const char* p, const char* end);
 
 std::string row::operator[](const char* inName) const
+{
+  return operator[](m_record->column(inName));
+}
+
+std::string row::operator[](int32 inColumn) const
 {
   std::string result;
 
-  foreach (const field& f, m_fields)
-  {
-    if (strncmp(inName, f.m_name, f.m_name_end - f.m_name) == 0)
-    {
-      result = f.value();
-      break;
-    }
-  }
+  if (inColumn >= 0 and m_row < m_record->m_row_count)
+    result = m_record->value(m_row, inColumn).value();
 
   return result;
 }
 
-row record::front() const
+int32 record::column(const char* inName) const
 {
-  row result;
-  result.m_data = m_start;
-  result.m_field = 0;
+  int32 result = -1;
+  std::string::size_type length = strlen(inName);
 
-  const char* p = m_start;
-
-  if (m_loop)
+  for (uint32 i = 0; i < m_fields.size(); ++i)
   {
-    for (uint32 i = 0; i < m_field_count; ++i)
+    const field& f = m_fields[i];
+    if (static_cast<std::string::size_type>(f.m_name_end - f.m_name) ==
+          length and
+        strncmp(inName, f.m_name, length) == 0)
     {
-      assert(*p == '_');
-      assert(*(p + m_name.length()) == '.');
-
-      field field = {};
-
-      field.m_name = p = p + m_name.length() + 1;
-      while (p != m_end and not isspace(*p))
-        ++p;
-
-      field.m_name_end = p;
-
-      p = skip_white(p, m_end);
-
-      result.m_fields.push_back(field);
-    }
-
-    foreach (field& fld, result.m_fields)
-    {
-      fld.m_data = skip_white(p, m_end);
-      fld.m_data_end = skip_value(fld.m_data, m_end);
-      p = skip_white(fld.m_data_end, m_end);
-    }
-  }
-  else
-  {
-    for (uint32 i = 0; i < m_field_count; ++i)
-    {
-      assert(*p == '_');
-      assert(*(p + m_name.length()) == '.');
-
-      field field;
-      field.m_name = p = p + m_name.length() + 1;
-      while (p != m_end and not isspace(*p))
-        ++p;
-
-      field.m_name_end = p;
-
-      p = skip_white(p, m_end);
-      field.m_data = p;
-
-      p = skip_value(p, m_end);
-      field.m_data_end = p;
-      p = skip_white(p, m_end);
-
-      result.m_fields.push_back(field);
+      result = i;
+      break;
     }
   }
 
   return result;
 }
 
-record::iterator record::begin() const
+row record::front() const
 {
-  return const_iterator(*this, front());
+  row result = { this, 0 };
+  return result;
 }
 
-record::iterator record::end() const
+record::iterator record::begin() const
 {
-  row end = { m_start, -1 };
-  return const_iterator(*this, end);
+  return const_iterator(front());
 }
 
-void record::advance(row& row) const
+record::iterator record::end() const
 {
-  if (m_loop and not row.m_fields.empty())
-  {
-    const char* p = skip_white(row.m_fields.back().m_data_end, m_end);
-
-    if (p >= m_end)
-    {
-      row.m_fields.clear();
-      row.m_field = -1;
-    }
-    else
-    {
-      foreach (field& fld, row.m_fields)
-      {
-        fld.m_data = skip_white(p, m_end);
-        fld.m_data_end = skip_value(fld.m_data, m_end);
-        p = skip_white(fld.m_data_end, m_end);
-      }
-
-      row.m_field += 1;
-    }
-  }
-  else
-  {
-    row.m_fields.clear();
-    row.m_field = -1;
-  }
+  row end = { this, m_row_count };
+  return const_iterator(end);
 }
 
 std::string record::get_joined(const char* inName,
@@ -163,6 +95,7 @@ std::string record::get_joined(const char* inName,
 }
 
 file::file(std::istream& is)
+  : m_empty()
 {
   // first extract data into a buffer
   m_buffer.reserve(10 * 1024 * 1024); // reserve 10 MB, should be sufficient
@@ -174,6 +107,21 @@ file::file(std::istream& is)
 
   m_buffer.push_back(0); // end with a null character, makes coding easier
 
+  parse();
+}
+
+file::file(const char* inData, const char* inEnd)
+  : m_empty()
+  , m_data(inData)
+  , m_end(inEnd)
+{
+  assert(*m_end == 0);
+
+  parse();
+}
+
+void file::parse()
+{
   // CIF files are simple to parse
 
   const char* p = m_data;
@@ -251,9 +199,22 @@ file::file(std::istream& is)
         else
           m_records.back().m_field_count += 1;
 
+        field fld = {};
+        fld.m_name = p + 1;
+
         // skip over field name
         while (p != m_end and not isspace(*p))
           ++p;
+
+        fld.m_name_end = p;
+        m_records.back().m_fields.push_back(fld);
+
+        // the value of a field outside a loop follows its name
+        if (not rec.m_loop)
+        {
+          p = skip_white(p, m_end);
+          m_records.back().add_value(p, skip_value(p, m_end));
+        }
       }
       else
       {
@@ -287,7 +248,10 @@ file::file(std::istream& is)
       throw mas_exception("invalid CIF file? (unexpected data, not in loop)");
     }
 
+    const char* v = p;
     p = skip_value(p, m_end);
+    m_records.back().add_value(v, p);
+
     p = skip_white(p, m_end);
 
     // check for a new data_ block
@@ -299,19 +263,35 @@ file::file(std::istream& is)
     m_records.back().m_end = p;
 
   sort(m_records.begin(), m_records.end());
+
+  // complete the rows
+  foreach (record& rec, m_records)
+  {
+    if (rec.m_loop and rec.m_field_count > 0)
+    {
+      // an incomplete last row gets empty values
+      rec.m_row_count = (rec.m_values.size() + rec.m_field_count - 1) /
+                        rec.m_field_count;
+
+      record::span empty = { static_cast<uint32>(rec.m_end - rec.m_start), 0 };
+      rec.m_values.resize(rec.m_row_count * rec.m_field_count, empty);
+    }
+    else if (rec.m_field_count > 0)
+      rec.m_row_count = 1;
+  }
 }
 
-record file::operator[](const char* inName) const
+const record& file::operator[](const char* inName) const
 {
-  record result = {};
-  result.m_name = inName;
+  record test = {};
+  test.m_name = inName;
 
   std::vector<record>::const_iterator i = lower_bound(m_records.begin(),
-                                                      m_records.end(), result);
+                                                      m_records.end(), test);
   if (i != m_records.end() and i->m_name == inName)
-    result = *i;
+    return *i;
 
-  return result;
+  return m_empty;
 }
 
 std::string file::get(const char* inName) const
@@ -321,7 +301,7 @@ std::string file::get(const char* inName) const
   if (p == nullptr)
     throw std::logic_error("incorrect name");
 
-  record r = operator[](std::string(inName, p).c_str());
+  const record& r = operator[](std::string(inName, p).c_str());
   return r.front()[std::string(p + 1).c_str()];
 }
 
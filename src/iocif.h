@@ -9,6 +9,10 @@
 #include <vector>
 
 //  Our CIF implementation consists of flyweight classes.
+//
+//  When a file is loaded the values of each record are split once into a
+//  flat array of spans, row after row, so a row is just an index and a
+//  value is found by its column number.
 
 namespace mmCIF
 {
@@ -46,18 +50,23 @@ struct field
   const char*    m_data_end;
 };
 
+struct record;
+
 struct row
 {
+  // the value in the field named inName, or the empty string
   std::string operator[](const char* inName) const;
 
+  // the value in column inColumn, see record::column
+  std::string operator[](int32 inColumn) const;
+
   bool operator==(const row& rhs) const
   {
-    return m_data == rhs.m_data and m_field == rhs.m_field;
+    return m_record == rhs.m_record and m_row == rhs.m_row;
   }
 
-  const char*      m_data;
-  int32        m_field;
-  std::vector<field>  m_fields;
+  const record*    m_record;
+  uint32        m_row;
 };
 
 struct record
@@ -74,28 +83,16 @@ struct record
     typedef base_type::reference reference;
     typedef base_type::pointer pointer;
 
-    const_iterator(const record& rec, const row& row)
-      : m_rec(rec),
-        m_row(row)
+    const_iterator(const row& row)
+      : m_row(row)
     {}
 
-    const_iterator(const const_iterator& iter)
-      : m_rec(iter.m_rec),
-        m_row(iter.m_row)
-    {}
-
-    const_iterator& operator=(const const_iterator& iter)
-    {
-      m_row = iter.m_row;
-      return *this;
-    }
-
     reference operator*() const { return m_row; }
     pointer operator->() const { return &m_row; }
 
     const_iterator& operator++()
     {
-      m_rec.advance(m_row);
+      ++m_row.m_row;
       return *this;
     }
 
@@ -117,19 +114,30 @@ struct record
     }
 
     private:
-      const record& m_rec;
       row m_row;
   };
 
   typedef const_iterator iterator;
 
   row front() const;
-  row back() const;
 
   const_iterator begin() const;
   const_iterator end() const;
 
-  void advance(row& row) const;  // update pointers to next data row, if any
+  uint32 size() const  { return m_row_count; }
+
+  // the column number of the field named inName, or -1 if there is none
+  int32 column(const char* inName) const;
+
+  field value(uint32 inRow, int32 inColumn) const
+  {
+    const span& v = m_values[inRow * m_fields.size() + inColumn];
+
+    field result = m_fields[inColumn];
+    result.m_data = m_start + v.m_offset;
+    result.m_data_end = result.m_data + v.m_length;
+    return result;
+  }
 
   bool operator<(const record& rhs) const
   {
@@ -139,11 +147,28 @@ struct record
   std::string get_joined(const char* inFieldName,
                          const char* inDelimiter) const;
 
+  void add_value(const char* inData, const char* inDataEnd)
+  {
+    span v = { static_cast<uint32>(inData - m_start),
+               static_cast<uint32>(inDataEnd - inData) };
+    m_values.push_back(v);
+  }
+
   const char* m_start;
   const char* m_end;
   bool m_loop;
   uint32 m_field_count;
   std::string m_name;
+
+  // a value, relative to m_start
+  struct span
+  {
+    uint32 m_offset, m_length;
+  };
+
+  std::vector<field> m_fields;    // the names, in column order
+  std::vector<span> m_values;     // the values, row after row
+  uint32 m_row_count;
 };
 
 class file
@@ -151,14 +176,22 @@ class file
   public:
   file(std::istream& is);
 
-  record operator[](const char* inName) const;
+  // parse the data in place, the character at inEnd must be a null
+  // character and the data must outlive this file
+  file(const char* inData, const char* inEnd);
+
+  // the record named inName, an empty record if there is none
+  const record& operator[](const char* inName) const;
 
   std::string get(const char* inName) const;
   std::string get_joined(const char* inName, const char* inDelimiter) const;
 
   private:
+  void parse();
+
   std::vector<char>  m_buffer;
   std::vector<record>  m_records;
+  record        m_empty;
   const char*      m_data;
   const char*      m_end;
 };
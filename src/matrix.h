@@ -366,6 +366,113 @@ class identity_matrix : public matrix_base<T>
   uint32        m_n;
 };
 
+// --------------------------------------------------------------------
+// diagonal_matrix is m x n like matrix, but the elements are stored by
+// anti-diagonal: all elements with the same i + j are consecutive, ordered
+// by i. Dynamic programming can fill a complete anti-diagonal at once.
+//
+// Optionally only a band of the matrix is stored, the elements for which
+// lo <= i - j <= hi. Elements outside the band read as T().
+
+template<typename T>
+class diagonal_matrix : public matrix_base<T>
+{
+  public:
+  typedef typename matrix_base<T>::value_type value_type;
+
+            diagonal_matrix(uint32 m, uint32 n, T v = T())
+              : m_offset(m + n)
+              , m_m(m)
+              , m_n(n)
+              , m_lo(1 - static_cast<int32>(n))
+              , m_hi(static_cast<int32>(m) - 1)
+            {
+              allocate(v);
+            }
+
+            diagonal_matrix(uint32 m, uint32 n, int32 lo, int32 hi,
+                            T v = T())
+              : m_offset(m + n)
+              , m_m(m)
+              , m_n(n)
+              , m_lo(lo)
+              , m_hi(hi)
+            {
+              allocate(v);
+            }
+
+  virtual uint32    dim_m() const          { return m_m; }
+  virtual uint32    dim_n() const          { return m_n; }
+
+  int32        band_lo() const          { return m_lo; }
+  int32        band_hi() const          { return m_hi; }
+
+  // the range of i on anti-diagonal d is [first(d), last(d)], last(d) is
+  // smaller than first(d) when the band does not cross anti-diagonal d
+  int32        first(uint32 d) const
+            {
+              int32 result = d < m_n ? 0 : d - m_n + 1;
+              int32 band = static_cast<int32>(d) + m_lo;
+              if (band > 2 * result)
+                result = (band + 1) / 2;
+              return result;
+            }
+
+  int32        last(uint32 d) const
+            {
+              int32 result = d < m_m ? d : m_m - 1;
+              int32 band = static_cast<int32>(d) + m_hi;
+              if (band < 0)
+                result = -1;
+              else if (band < 2 * result)
+                result = band / 2;
+              return result;
+            }
+
+  bool        in_band(uint32 i, uint32 j) const
+            {
+              int32 d = static_cast<int32>(i) - static_cast<int32>(j);
+              return d >= m_lo and d <= m_hi;
+            }
+
+  // the elements of anti-diagonal d, starting at i = first(d)
+  value_type*      diagonal(uint32 d)      { return &m_data[m_offset[d]]; }
+
+  virtual value_type  operator()(uint32 i, uint32 j) const
+            {
+              assert(i < m_m); assert(j < m_n);
+              if (not in_band(i, j))
+                return T();
+              return m_data[m_offset[i + j] + i - first(i + j)];
+            }
+
+  virtual value_type&  operator()(uint32 i, uint32 j)
+            {
+              assert(i < m_m); assert(j < m_n); assert(in_band(i, j));
+              return m_data[m_offset[i + j] + i - first(i + j)];
+            }
+
+  private:
+
+  void        allocate(T v)
+            {
+              uint32 size = 0;
+              for (uint32 d = 0; m_m > 0 and m_n > 0 and d + 1 < m_m + m_n; ++d)
+              {
+                m_offset[d] = size;
+                if (last(d) >= first(d))
+                  size += last(d) + 1 - first(d);
+              }
+              m_data.assign(size, v);
+            }
+
+  std::vector<value_type>
+              m_data;
+  std::vector<uint32>  m_offset;
+  uint32        m_m, m_n;
+  int32        m_lo, m_hi;
+};
+
 // --------------------------------------------------------------------
 // matrix functions
 
@@ -14,8 +14,13 @@
 #include "iocif.h"
 #include "mas.h"
 #include "structure.h"
+#include "thread-pool.h"
+#include "utils.h"
 #include "version.h"
 
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/format.hpp>
 #include <boost/program_options.hpp>
 #include <boost/iostreams/copy.hpp>
 #include <boost/iostreams/filtering_stream.hpp>
@@ -31,15 +36,285 @@
 #include <conio.h>
 #include <ctype.h>
 #endif
+#include <algorithm>
 #include <fstream>
+#include <map>
 
 
 namespace po = boost::program_options;
 namespace io = boost::iostreams;
 namespace ba = boost::algorithm;
+namespace fs = boost::filesystem;
 
 //int VERBOSE = 0;
 
+namespace
+{
+
+// strip the compression extension, if any, from inFile
+std::string StripCompression(std::string inFile)
+{
+#ifdef HAVE_LIBBZ2
+  if (ba::ends_with(inFile, ".bz2"))
+    inFile.erase(inFile.length() - 4);
+  else if (ba::ends_with(inFile, ".gz"))
+    inFile.erase(inFile.length() - 3);
+#endif
+  return inFile;
+}
+
+bool IsmmCIF(const std::string& inFile)
+{
+  return ba::ends_with(inFile, ".cif") or ba::ends_with(inFile, ".mcif");
+}
+
+// How to write the secondary structure
+struct MOutputOptions
+{
+  bool  allModels;  // of every model in a PDB file
+  bool  ssString;  // as a line per model instead of a DSSP file
+};
+
+// Read the structure in inInput into outProtein and calculate its secondary
+// structure.
+void ReadStructure(const std::string& inInput, MProtein& outProtein)
+{
+  // the file is mapped into memory, or decompressed into a buffer
+  input_buffer in(inInput);
+
+  if (IsmmCIF(StripCompression(inInput)))
+    outProtein.ReadmmCIF(in.begin(), in.end());
+  else
+    outProtein.ReadPDB(in.begin(), in.end());
+
+  outProtein.CalculateSecondaryStructure();
+}
+
+void WriteModel(MProtein& inProtein, uint32 inModel,
+                const MOutputOptions& inOptions, std::ostream& os)
+{
+  inProtein.CalculateSecondaryStructure();
+
+  if (inOptions.ssString)
+    os << inModel << ' ' << SecondaryStructureString(inProtein) << std::endl;
+  else
+    WriteDSSP(inProtein, os);
+}
+
+// Calculate the secondary structure of every model in the PDB file inInput.
+// The records up to the end of the first model give the protein, the
+// following models only replace its coordinates. The file is read one
+// model at a time, so memory use does not grow with the number of models.
+void WriteModels(const std::string& inInput, const MOutputOptions& inOptions,
+                 std::ostream& os)
+{
+  if (IsmmCIF(StripCompression(inInput)))
+    throw std::runtime_error("multiple models are only supported for PDB files");
+
+  std::ifstream file(inInput.c_str(), std::ios_base::in|std::ios_base::binary);
+  if (not file.is_open())
+    throw std::runtime_error("could not open input file " + inInput);
+
+  io::filtering_stream<io::input> in;
+#ifdef HAVE_LIBBZ2
+  if (ba::ends_with(inInput, ".bz2"))
+    in.push(io::bzip2_decompressor());
+  else if (ba::ends_with(inInput, ".gz"))
+    in.push(io::gzip_decompressor());
+#endif
+  in.push(file);
+
+  MPDBModelReader models(in);
+  std::string records;
+  uint32 model;
+
+  models.Next(records, model);
+
+  MProtein a;
+  a.ReadPDB(records.data(), records.data() + records.length());
+  WriteModel(a, model, inOptions, os);
+
+  while (models.Next(records, model))
+  {
+    a.ReadPDBModel(records.data(), records.data() + records.length());
+    WriteModel(a, model, inOptions, os);
+  }
+}
+
+// Create the file inOutput and write to it through out, compressed when
+// the name asks for it.
+void OpenOutput(const std::string& inOutput, std::ofstream& outfile,
+                io::filtering_stream<io::output>& out)
+{
+  outfile.open(inOutput.c_str(),
+               std::ios_base::out|std::ios_base::trunc|std::ios_base::binary);
+  if (not outfile.is_open())
+    throw std::runtime_error("could not create output file");
+
+#ifdef HAVE_LIBBZ2
+  if (ba::ends_with(inOutput, ".bz2"))
+    out.push(io::bzip2_compressor());
+  else if (ba::ends_with(inOutput, ".gz"))
+    out.push(io::gzip_compressor());
+#endif
+  out.push(outfile);
+}
+
+// Write the secondary structure of the structure in inInput to inOutput, or
+// to std::cout when inOutput is empty. A structure is read and calculated
+// before its output is created, so a failure leaves an existing file alone.
+void CreateDSSP(const std::string& inInput, const std::string& inOutput,
+                const MOutputOptions& inOptions)
+{
+  if (not inOptions.allModels)
+  {
+    MProtein a;
+    ReadStructure(inInput, a);
+
+    if (inOutput.empty())
+      WriteDSSP(a, std::cout);
+    else
+    {
+      std::ofstream outfile;
+      io::filtering_stream<io::output> out;
+      OpenOutput(inOutput, outfile, out);
+      WriteDSSP(a, out);
+    }
+  }
+  else if (inOutput.empty())
+    WriteModels(inInput, inOptions, std::cout);
+  else
+  {
+    // the models are written while they are read, so a failure halfway
+    // leaves a partial file that must not pass for a finished one
+    try
+    {
+      std::ofstream outfile;
+      io::filtering_stream<io::output> out;
+      OpenOutput(inOutput, outfile, out);
+      WriteModels(inInput, inOptions, out);
+    }
+    catch (...)
+    {
+      try
+      {
+        if (fs::exists(inOutput))
+          fs::remove(inOutput);
+      }
+      catch (...) {}
+
+      throw;
+    }
+  }
+}
+
+bool IsStructureFile(const std::string& inFile)
+{
+  std::string file = StripCompression(inFile);
+  return IsmmCIF(file) or ba::ends_with(file, ".pdb") or
+         ba::ends_with(file, ".ent");
+}
+
+// The structure files of a batch. inBatch is either a directory, which is
+// searched recursively for PDB and mmCIF files, or a file listing one
+// structure file per line. Empty lines and lines starting with '#' are
+// skipped.
+void ListBatch(const std::string& inBatch, std::vector<std::string>& outFiles)
+{
+  if (fs::is_directory(inBatch))
+  {
+    for (fs::recursive_directory_iterator file(inBatch), end; file != end;
+         ++file)
+    {
+      if (fs::is_regular_file(file->status()) and
+          IsStructureFile(file->path().filename().string()))
+        outFiles.push_back(file->path().string());
+    }
+
+    sort(outFiles.begin(), outFiles.end());
+  }
+  else
+  {
+    std::ifstream list(inBatch.c_str());
+    if (not list.is_open())
+      throw std::runtime_error("could not open batch file " + inBatch);
+
+    std::string line;
+    while (getline(list, line))
+    {
+      ba::trim(line);
+      if (not line.empty() and line[0] != '#')
+        outFiles.push_back(line);
+    }
+  }
+}
+
+// Create a DSSP file in inOutputDir for every structure in inFiles, with
+// inThreads structures in progress at a time. A structure that fails is
+// reported and skipped, as is a structure whose DSSP file would overwrite
+// that of an earlier one. Returns the number of failures.
+uint32 RunBatch(const std::vector<std::string>& inFiles,
+                const std::string& inOutputDir, uint32 inThreads,
+                const MOutputOptions& inOptions)
+{
+  using namespace boost::posix_time;
+
+  if (not inOutputDir.empty())
+    fs::create_directories(inOutputDir);
+
+  std::vector<std::string> outputs;
+  std::map<std::string,uint32> first;
+  for (uint32 i = 0; i < inFiles.size(); ++i)
+  {
+    fs::path output = fs::path(StripCompression(inFiles[i])).filename();
+    output.replace_extension(".dssp");
+    if (not inOutputDir.empty())
+      output = fs::path(inOutputDir) / output;
+
+    outputs.push_back(output.string());
+    first.insert(std::make_pair(outputs.back(), i));
+  }
+
+  ptime start = microsec_clock::universal_time();
+
+  boost::mutex lock;
+  uint32 failed = 0;
+
+  ParallelFor(inFiles.size(), [&](uint32 i) {
+    const std::string& input = inFiles[i];
+
+    try
+    {
+      uint32 owner = first.find(outputs[i])->second;
+      if (owner != i)
+        throw std::runtime_error(outputs[i] + " is already created for " +
+                                 inFiles[owner]);
+
+      CreateDSSP(input, outputs[i], inOptions);
+    }
+    catch (const std::exception& e)
+    {
+      boost::mutex::scoped_lock l(lock);
+      std::cerr << "DSSP could not be created for " << input
+                << " due to an error:" << std::endl
+                << e.what() << std::endl;
+      ++failed;
+    }
+  }, inThreads);
+
+  double seconds =
+    (microsec_clock::universal_time() - start).total_microseconds() / 1e6;
+
+  std::cerr << boost::format(
+      "Processed %1% structures (%2% failed) in %3$.1f seconds, "
+      "%4$.1f structures/sec") % inFiles.size() % failed % seconds %
+      (seconds > 0 ? inFiles.size() / seconds : 0.0) << std::endl;
+
+  return failed;
+}
+
+}
+
 int main(int argc, char* argv[])
 {
   try
@@ -48,7 +323,11 @@ int main(int argc, char* argv[])
     desc.add_options()
       ("help,h", "Display help message")
       ("input,i", po::value<std::string>(), "Input PDB file (.pdb) or mmCIF file (.cif/.mcif), optionally compressed by gzip (.gz) or bzip2 (.bz2)")
-      ("output,o", po::value<std::string>(), "Output file, optionally compressed by gzip (.gz) or bzip2 (.bz2). Use 'stdout' to output to screen")
+      ("output,o", po::value<std::string>(), "Output file, optionally compressed by gzip (.gz) or bzip2 (.bz2). Use 'stdout' to output to screen. In batch mode the directory for the DSSP files (default is the current directory)")
+      ("batch,b", po::value<std::string>(), "Process all structure files listed in this file, one per line, or found in this directory")
+      ("threads,a", po::value<uint32>(), "Number of structures processed at the same time in batch mode (default is maximum)")
+      ("all-models", "Calculate the secondary structure of every model in a PDB file, reading one model at a time, and write a DSSP block per model")
+      ("ss-string", "With --all-models, write a line per model with the model number and the secondary structure of all residues instead of a DSSP block")
       ("verbose,v", "Verbose output")
       ("version", "Print version and citation info")
       ("debug,d", po::value<int>(), "Debug level (for even more verbose output)");
@@ -79,7 +358,7 @@ int main(int argc, char* argv[])
       exit(0);
     }
 
-    if (vm.count("help") or not vm.count("input"))
+    if (vm.count("help") or not (vm.count("input") or vm.count("batch")))
     {
       std::cerr << desc << std::endl
          << std::endl
@@ -92,6 +371,14 @@ int main(int argc, char* argv[])
          << std::endl
          << "  " << argv[0] << " -i 1crn.pdb -o 1crn.dssp"
          << std::endl
+         << std::endl
+         << "To do the same for all structures listed in the file pdb.txt and"
+         << std::endl
+         << "write the results to the directory dssp, you type:"
+         << std::endl
+         << std::endl
+         << "  " << argv[0] << " -b pdb.txt -o dssp"
+         << std::endl
          << std::endl;
 #if defined(_MSC_VER)
       std::cerr << std::endl
@@ -113,66 +400,28 @@ int main(int argc, char* argv[])
     if (vm.count("debug"))
       VERBOSE = vm["debug"].as<int>();
 
-    std::string input = vm["input"].as<std::string>();
-
-    std::ifstream infile(input.c_str(),
-                         std::ios_base::in | std::ios_base::binary);
-    if (not infile.is_open())
-      throw std::runtime_error("No such file");
+    MOutputOptions options = {};
+    options.allModels = vm.count("all-models") != 0;
+    options.ssString = vm.count("ss-string") != 0;
 
-    io::filtering_stream<io::input> in;
-
-#ifdef HAVE_LIBBZ2
-    if (ba::ends_with(input, ".bz2"))
-    {
-      in.push(io::bzip2_decompressor());
-      input.erase(input.length() - 4);
-    }
-    else if (ba::ends_with(input, ".gz"))
-    {
-      in.push(io::gzip_decompressor());
-      input.erase(input.length() - 3);
-    }
-#endif
-
-    in.push(infile);
-
-    // OK, we've got the file, now create a protein
-    MProtein a;
-
-    if (ba::ends_with(input, ".cif") or ba::ends_with(input, ".mcif"))
-      a.ReadmmCIF(in);
-    else
-      a.ReadPDB(in);
-
-    // then calculate the secondary structure
-    a.CalculateSecondaryStructure();
-
-    // and finally report the secondary structure in the DSSP format
-    // either to cout or an (optionally compressed) file.
+    std::string output;
     if (vm.count("output"))
+      output = vm["output"].as<std::string>();
+
+    if (vm.count("batch"))
     {
-      std::string output = vm["output"].as<std::string>();
+      uint32 threads = 0;
+      if (vm.count("threads"))
+        threads = vm["threads"].as<uint32>();
 
-      std::ofstream outfile(
-          output.c_str(),
-          std::ios_base::out|std::ios_base::trunc|std::ios_base::binary);
-      if (not outfile.is_open())
-        throw std::runtime_error("could not create output file");
+      std::vector<std::string> files;
+      ListBatch(vm["batch"].as<std::string>(), files);
 
-      io::filtering_stream<io::output> out;
-#ifdef HAVE_LIBBZ2
-      if (ba::ends_with(output, ".bz2"))
-        out.push(io::bzip2_compressor());
-      else if (ba::ends_with(output, ".gz"))
-        out.push(io::gzip_compressor());
-#endif
-      out.push(outfile);
-
-      WriteDSSP(a, out);
+      if (RunBatch(files, output, threads, options) > 0)
+        exit(1);
     }
     else
-      WriteDSSP(a, std::cout);
+      CreateDSSP(vm["input"].as<std::string>(), output, options);
   }
   catch (const std::exception& e)
   {
@@ -8,6 +8,7 @@
 #include "config.h"
 #endif
 
+#include "blast.h"
 #include "fasta.h"
 #include "hssp-nt.h"
 #include "mas.h"
@@ -68,6 +69,7 @@ int main(int argc, char* argv[])
       ("input,i", po::value<std::string>(), "PDB ID or input PDB file (.pdb), mmCIF file (.cif/.mcif), or fasta file (.fa/.fasta), optionally compressed by gzip (.gz) or bzip2 (.bz2)")
       ("output,o", po::value<std::string>(), "Output file, optionally compressed by gzip (.gz) or bzip2 (.bz2). Use 'stdout' to output to screen")
       ("databank,d", po::value<std::vector<std::string>>(), "Databank to use (can be specified multiple times)")
+      ("build-db", "Convert the FastA databank given as input into an encoded databank written to output, for faster searching")
       ("threads,a",  po::value<uint32>(), "Number of threads (default is maximum)")
 //      ("use-seqres", po::value<bool>(), "Use SEQRES chain instead of chain based on ATOM records (values are true of false, default is true)")
       ("min-length", po::value<uint32>(), "Minimal chain length (default = 25)")
@@ -76,6 +78,7 @@ int main(int argc, char* argv[])
       ("gap-extend,E", po::value<float>(), "Gap extension penalty (default is 2.0)")
       ("threshold", po::value<float>(), "Homology threshold adjustment (default = 0.05)")
       ("max-hits,m", po::value<uint32>(), "Maximum number of hits to include (default = 5000)")
+      ("batch-size", po::value<uint32>(), "Number of fasta input sequences searched for in one pass over the databanks (default = 100)")
       ("fetch-dbrefs", "Fetch DBREF records for each UniProt ID")
       ("verbose,v", "Verbose mode")
       ("version", "Show version number and citation info");
@@ -119,7 +122,11 @@ int main(int argc, char* argv[])
       exit(0);
     }
 
-    if (vm.count("help") or not vm.count("input") or vm.count("databank") == 0)
+    bool buildDb = vm.count("build-db") > 0;
+
+    if (vm.count("help") or not vm.count("input") or
+        (vm.count("databank") == 0 and not buildDb) or
+        (buildDb and not vm.count("output")))
     {
       std::cerr << desc << std::endl;
       exit(1);
@@ -128,12 +135,15 @@ int main(int argc, char* argv[])
     VERBOSE = vm.count("verbose");
 
     std::vector<fs::path> databanks;
-    std::vector<std::string> dbs = vm["databank"].as<std::vector<std::string>>();
-    foreach (std::string db, dbs)
+    if (vm.count("databank"))
     {
-      databanks.push_back(db);
-      if (not fs::exists(databanks.back()))
-        throw mas_exception(boost::format("Databank %s does not exist") % db);
+      std::vector<std::string> dbs = vm["databank"].as<std::vector<std::string>>();
+      foreach (std::string db, dbs)
+      {
+        databanks.push_back(db);
+        if (not fs::exists(databanks.back()))
+          throw mas_exception(boost::format("Databank %s does not exist") % db);
+      }
     }
 
 //    bool useSeqRes = true;
@@ -166,6 +176,12 @@ int main(int argc, char* argv[])
 
     bool fetchDbRefs = vm.count("fetch-dbrefs") > 0;
 
+    uint32 batchSize = 100;
+    if (vm.count("batch-size"))
+      batchSize = vm["batch-size"].as<uint32>();
+    if (batchSize < 1)
+      batchSize = 1;
+
     uint32 threads = boost::thread::hardware_concurrency();
     if (vm.count("threads"))
       threads = vm["threads"].as<uint32>();
@@ -193,6 +209,13 @@ int main(int argc, char* argv[])
 #endif
     in.push(infile);
 
+    if (buildDb)
+    {
+      outfilename = fs::path(vm["output"].as<std::string>());
+      BuildEncodedDatabank(in, outfilename);
+      exit(0);
+    }
+
     // Where to write our HSSP file to:
     // either to cout or an (optionally compressed) file.
     std::ofstream outfile;
@@ -221,32 +244,44 @@ int main(int argc, char* argv[])
     if (ba::ends_with(input, ".fa") or ba::ends_with(input, ".fasta"))
     {
       std::vector<MProtein*> proteins = read_proteins_from_fasta(in);
-      for (auto& p: proteins)
+      for (size_t b = 0; b < proteins.size(); b += batchSize)
       {
+        std::vector<const MProtein*> batch(proteins.begin() + b,
+          proteins.begin() + std::min(b + batchSize, proteins.size()));
+        std::vector<std::string> errors(batch.size());
+
         try
         {
-          HSSP::CreateHSSP(*p, databanks, maxhits, minlength, gapOpen,
+          HSSP::CreateHSSP(batch, databanks, maxhits, minlength, gapOpen,
                            gapExtend, threshold, fragmentCutOff, threads,
-                           fetchDbRefs, out);
+                           fetchDbRefs, out, errors);
         }
         catch (const std::exception& e)
         {
-          std::cerr << "Creating HSSP for " << p->GetID() << " failed: "
-                    << e.what() << std::endl;
+          errors.assign(batch.size(), e.what());
         }
 
-        delete p;
+        for (size_t i = 0; i < batch.size(); ++i)
+        {
+          if (not errors[i].empty())
+            std::cerr << "Creating HSSP for " << batch[i]->GetID()
+                      << " failed: " << errors[i] << std::endl;
+
+          delete batch[i];
+        }
       }
     }
     else
     {
-      // read protein and calculate the secondary structure
+      // read protein and calculate the secondary structure, the file is
+      // mapped into memory or decompressed into a buffer
+      input_buffer data(vm["input"].as<std::string>());
       MProtein a;
 
       if (ba::ends_with(input, ".cif") or ba::ends_with(input, ".mcif"))
-        a.ReadmmCIF(in);
+        a.ReadmmCIF(data.begin(), data.end());
       else
-        a.ReadPDB(in);
+        a.ReadPDB(data.begin(), data.end());
 
       a.CalculateSecondaryStructure();
 
@@ -13,6 +13,7 @@
 
 #include <boost/foreach.hpp>
 
+#include <algorithm>
 #include <cmath>
 #include <valarray>
 
@@ -227,6 +228,106 @@ double RMSd(const std::vector<MPoint>& a, const std::vector<MPoint>& b)
   return sqrt(sum / a.size());
 }
 
+// --------------------------------------------------------------------
+
+MPointGrid::MPointGrid(const std::vector<MPoint>& inPoints,
+                       double inMinCellSize)
+  : mCellSize(inMinCellSize)
+  , mDimX(1)
+  , mDimY(1)
+  , mDimZ(1)
+{
+  MPoint max;
+
+  if (not inPoints.empty())
+  {
+    mOrigin = max = inPoints.front();
+    foreach (const MPoint& pt, inPoints)
+    {
+      mOrigin.mX = std::min(mOrigin.mX, pt.mX);
+      mOrigin.mY = std::min(mOrigin.mY, pt.mY);
+      mOrigin.mZ = std::min(mOrigin.mZ, pt.mZ);
+      max.mX = std::max(max.mX, pt.mX);
+      max.mY = std::max(max.mY, pt.mY);
+      max.mZ = std::max(max.mZ, pt.mZ);
+    }
+  }
+
+  // Keep the number of cells in proportion to the number of points, sparse
+  // structures (e.g. chains far apart) would otherwise need a huge grid.
+  double maxCells = std::max<double>(64, 8.0 * inPoints.size());
+  for (;;)
+  {
+    double dx = floor((max.mX - mOrigin.mX) / mCellSize) + 1;
+    double dy = floor((max.mY - mOrigin.mY) / mCellSize) + 1;
+    double dz = floor((max.mZ - mOrigin.mZ) / mCellSize) + 1;
+
+    if (dx * dy * dz <= maxCells)
+    {
+      mDimX = static_cast<int32>(dx);
+      mDimY = static_cast<int32>(dy);
+      mDimZ = static_cast<int32>(dz);
+      break;
+    }
+
+    mCellSize *= 1.5;
+  }
+
+  // counting sort of the point indices into their cells
+  std::vector<uint32> cell(inPoints.size());
+  mCellStart.assign(mDimX * mDimY * mDimZ + 1, 0);
+
+  for (uint32 i = 0; i < inPoints.size(); ++i)
+  {
+    const MPoint& pt = inPoints[i];
+    cell[i] = (CellIndex(pt.mZ, mOrigin.mZ, mDimZ) * mDimY +
+               CellIndex(pt.mY, mOrigin.mY, mDimY)) * mDimX +
+              CellIndex(pt.mX, mOrigin.mX, mDimX);
+    ++mCellStart[cell[i] + 1];
+  }
+
+  for (uint32 c = 1; c < mCellStart.size(); ++c)
+    mCellStart[c] += mCellStart[c - 1];
+
+  std::vector<uint32> fill(mCellStart.begin(), mCellStart.end() - 1);
+  mIndices.resize(inPoints.size());
+  for (uint32 i = 0; i < inPoints.size(); ++i)
+    mIndices[fill[cell[i]]++] = i;
+}
+
+inline
+int32 MPointGrid::CellIndex(double inValue, double inOrigin,
+                            int32 inCells) const
+{
+  int32 result = static_cast<int32>(floor((inValue - inOrigin) / mCellSize));
+  if (result < 0)
+    result = 0;
+  else if (result >= inCells)
+    result = inCells - 1;
+  return result;
+}
+
+void MPointGrid::GetCandidates(const MPoint& inLocation,
+                               std::vector<uint32>& outIndices) const
+{
+  int32 cx = CellIndex(inLocation.mX, mOrigin.mX, mDimX);
+  int32 cy = CellIndex(inLocation.mY, mOrigin.mY, mDimY);
+  int32 cz = CellIndex(inLocation.mZ, mOrigin.mZ, mDimZ);
+
+  for (int32 z = std::max(cz - 1, 0); z <= std::min(cz + 1, mDimZ - 1); ++z)
+  {
+    for (int32 y = std::max(cy - 1, 0); y <= std::min(cy + 1, mDimY - 1); ++y)
+    {
+      uint32 row = (z * mDimY + y) * mDimX;
+      uint32 b = mCellStart[row + std::max(cx - 1, 0)];
+      uint32 e = mCellStart[row + std::min(cx + 1, mDimX - 1) + 1];
+
+      outIndices.insert(outIndices.end(), mIndices.begin() + b,
+                        mIndices.begin() + e);
+    }
+  }
+}
+
 // The next function returns the largest solution for a quartic equation
 // based on Ferrari's algorithm.
 // A depressed quartic is of the form:
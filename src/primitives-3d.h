@@ -11,6 +11,8 @@
 
 #pragma once
 
+#include "mas.h"
+
 #include <boost/math/quaternion.hpp>
 #include <boost/tr1/tuple.hpp>
 
@@ -78,6 +80,35 @@ MQuaternion AlignPoints(const std::vector<MPoint>& a,
                         const std::vector<MPoint>& b);
 double RMSd(const std::vector<MPoint>& a, const std::vector<MPoint>& b);
 
+// --------------------------------------------------------------------
+// A uniform cell grid over a set of points. The cells are at least
+// inMinCellSize wide, so every point within that distance of a query
+// location is found in the 3x3x3 block of cells around it. Indices are
+// returned per cell in ascending order, callers still have to do their own
+// exact distance test.
+
+class MPointGrid
+{
+  public:
+            MPointGrid(const std::vector<MPoint>& inPoints,
+                       double inMinCellSize);
+
+  void        GetCandidates(const MPoint& inLocation,
+                            std::vector<uint32>& outIndices) const;
+
+  private:
+            MPointGrid(const MPointGrid&);
+  MPointGrid&      operator=(const MPointGrid&);
+
+  int32        CellIndex(double inValue, double inOrigin, int32 inCells) const;
+
+  MPoint        mOrigin;
+  double        mCellSize;
+  int32        mDimX, mDimY, mDimZ;
+  std::vector<uint32>  mCellStart;  // offsets into mIndices, one extra at the end
+  std::vector<uint32>  mIndices;    // point indices, sorted by cell
+};
+
 // --------------------------------------------------------------------
 // inlines
 
@@ -9,8 +9,8 @@
 #include "structure.h"
 
 #include "align-2d.h"
-#include "buffer.h"
 #include "iocif.h"
+#include "thread-pool.h"
 #include "utils.h"
 
 #include <boost/algorithm/string.hpp>
@@ -19,11 +19,21 @@
 #include <boost/format.hpp>
 #include <boost/lexical_cast.hpp>
 #include <boost/math/special_functions/round.hpp>
+#include <boost/ptr_container/ptr_vector.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/unordered_set.hpp>
 
+#include <cstring>
+#include <iterator>
 #include <set>
 #include <numeric>
 #include <functional>
 
+#if defined(__GNUC__) and (defined(__x86_64__) or defined(__i386__))
+#include <immintrin.h>
+#endif
+
 namespace ba = boost::algorithm;
 namespace bm = boost::math;
 
@@ -140,6 +150,101 @@ MAtomType MapElement(std::string inElement)
   return result;
 }
 
+namespace
+{
+
+// The names a structure file is made of: every one character name, the
+// residues DSSP knows, their atoms and the elements. The vocabulary is
+// filled once and never changes afterwards, so it is read without a lock.
+class MNameVocabulary
+{
+  public:
+            MNameVocabulary();
+
+  const std::string*  Find(const std::string& inName) const;
+  const std::string*  Empty() const            { return &mEmpty; }
+
+  private:
+  std::string      mEmpty;
+  std::string      mChars[256];
+  boost::unordered_set<std::string>
+            mNames;
+};
+
+MNameVocabulary::MNameVocabulary()
+{
+  for (uint32 c = 0; c < 256; ++c)
+    mChars[c].assign(1, static_cast<char>(c));
+
+  for (uint32 i = 0; i < kResidueTypeCount; ++i)
+    mNames.insert(kResidueInfo[i].name);
+
+  const char* kNames[] = {
+    "CA", "CB", "CD", "CD1", "CD2", "CE", "CE1", "CE2", "CE3", "CG", "CG1",
+    "CG2", "CH2", "CZ", "CZ2", "CZ3", "ND1", "ND2", "NE", "NE1", "NE2",
+    "NH1", "NH2", "NZ", "OD1", "OD2", "OE1", "OE2", "OG", "OG1", "OH", "OXT",
+    "SD", "SG", "HOH", "CL", "MG", "ZN", "SE"
+  };
+
+  for (uint32 i = 0; i < sizeof(kNames) / sizeof(kNames[0]); ++i)
+    mNames.insert(kNames[i]);
+}
+
+const std::string* MNameVocabulary::Find(const std::string& inName) const
+{
+  const std::string* result = nullptr;
+
+  if (inName.empty())
+    result = &mEmpty;
+  else if (inName.length() == 1)
+    result = &mChars[static_cast<unsigned char>(inName[0])];
+  else
+  {
+    boost::unordered_set<std::string>::const_iterator i = mNames.find(inName);
+    if (i != mNames.end())
+      result = &*i;
+  }
+
+  return result;
+}
+
+const MNameVocabulary& Vocabulary()
+{
+  static const MNameVocabulary sVocabulary;
+  return sVocabulary;
+}
+
+}
+
+const std::string* MAtomName::Empty()
+{
+  return Vocabulary().Empty();
+}
+
+// Names outside the vocabulary are kept in a set under a lock. They live as
+// long as the program does, a std::set never moves its elements so the
+// pointers handed out stay valid while other threads add names.
+const std::string* MAtomName::Intern(const std::string& inName)
+{
+  const std::string* result = Vocabulary().Find(inName);
+
+  if (result == nullptr)
+  {
+    static std::set<std::string> sNames;
+    static boost::mutex sLock;
+
+    boost::mutex::scoped_lock lock(sLock);
+    result = &*sNames.insert(inName).first;
+  }
+
+  return result;
+}
+
+std::ostream& operator<<(std::ostream& os, const MAtomName& inName)
+{
+  return os << inName.str();
+}
+
 MResidueType MapResidue(std::string inName)
 {
   ba::trim(inName);
@@ -308,12 +413,18 @@ const MResidueInfo kResidueInfo[] = {
   { kValine,         'V', "VAL" }
 };
 
+// The residue numbers on one side of a ladder, kept in the arena of
+// CalculateBetaSheets. Ladders are short, so inserting at the front of a
+// vector is cheap, and unlike a deque a vector does not allocate when it is
+// moved while sorting the bridges.
+typedef std::vector<uint32, arena_allocator<uint32> > MLadderSide;
+
 struct MBridge
 {
   MBridgeType type;
   uint32 sheet, ladder;
   std::set<MBridge*> link;
-  std::deque<uint32> i, j;
+  MLadderSide i, j;
   std::string chainI, chainJ;
 
   bool operator<(const MBridge& b) const {
@@ -342,7 +453,7 @@ bool Linked(const MBridge& a, const MBridge& b)
 // --------------------------------------------------------------------
 
 MResidue::MResidue(uint32 inNumber, MResidue* inPrevious,
-                   const std::vector<MAtom>& inAtoms)
+                   const std::vector<MAtom>& inAtoms, arena* inArena)
   : mPrev(inPrevious)
   , mNext(nullptr)
   , mSeqNumber(inAtoms.front().mResSeq)
@@ -352,6 +463,7 @@ MResidue::MResidue(uint32 inNumber, MResidue* inPrevious,
   , mSSBridgeNr(0)
   , mAccessibility(0)
   , mSecondaryStructure(loop)
+  , mSideChain(arena_allocator<MAtom>(inArena))
   , mSheet(0)
   , mBend(false)
 {
@@ -368,6 +480,19 @@ MResidue::MResidue(uint32 inNumber, MResidue* inPrevious,
   static const MAtom kNullAtom = {};
   mN = mCA = mC = mO = kNullAtom;
 
+  static const MAtomName kN("N"), kCA("CA"), kC("C"), kO("O");
+
+  // an arena does not reuse what a growing vector releases, so reserve the
+  // side chain at its final size
+  uint32 sideChainSize = 0;
+  foreach (const MAtom& atom, inAtoms)
+  {
+    if (atom.mName != kN and atom.mName != kCA and atom.mName != kC and
+        atom.mName != kO)
+      ++sideChainSize;
+  }
+  mSideChain.reserve(sideChainSize);
+
   foreach (const MAtom& atom, inAtoms)
   {
     if (mChainID.empty())
@@ -381,18 +506,26 @@ MResidue::MResidue(uint32 inNumber, MResidue* inPrevious,
     if (atom.mResSeq != mSeqNumber)
       throw mas_exception(boost::format("inconsistent residue sequence numbers (%1% != %2%)") % atom.mResSeq % mSeqNumber);
 
-    if (atom.GetName() == "N")
+    if (atom.mName == kN)
       mN = atom;
-    else if (atom.GetName() == "CA")
+    else if (atom.mName == kCA)
       mCA = atom;
-    else if (atom.GetName() == "C")
+    else if (atom.mName == kC)
       mC = atom;
-    else if (atom.GetName() == "O")
+    else if (atom.mName == kO)
       mO = atom;
     else
       mSideChain.push_back(atom);
   }
 
+  CalculateGeometry();
+
+  if (VERBOSE > 3)
+    std::cerr << "Created residue " << mN.mResName << std::endl;
+}
+
+void MResidue::CalculateGeometry()
+{
   // assign the Hydrogen
   mH = GetN();
 
@@ -428,9 +561,33 @@ MResidue::MResidue(uint32 inNumber, MResidue* inPrevious,
   mCenter.mX = (mBox[0].mX + mBox[1].mX) / 2;
   mCenter.mY = (mBox[0].mY + mBox[1].mY) / 2;
   mCenter.mZ = (mBox[0].mZ + mBox[1].mZ) / 2;
+}
 
-  if (VERBOSE > 3)
-    std::cerr << "Created residue " << mN.mResName << std::endl;
+void MResidue::GetAtoms(std::vector<MAtom*>& outAtoms)
+{
+  outAtoms.push_back(&mN);
+  outAtoms.push_back(&mCA);
+  outAtoms.push_back(&mC);
+  outAtoms.push_back(&mO);
+  foreach (MAtom& atom, mSideChain)
+    outAtoms.push_back(&atom);
+}
+
+void MResidue::Reset()
+{
+  CalculateGeometry();
+
+  mAccessibility = 0;
+  mSecondaryStructure = loop;
+  mSheet = 0;
+  mBend = false;
+
+  std::fill(mHelixFlags, mHelixFlags + 3, helixNone);
+
+  mBetaPartner[0].residue = mBetaPartner[1].residue = nullptr;
+
+  mHBondDonor[0].energy = mHBondDonor[1].energy = mHBondAcceptor[0].energy = mHBondAcceptor[1].energy = 0;
+  mHBondDonor[0].residue = mHBondDonor[1].residue = mHBondAcceptor[0].residue = mHBondAcceptor[1].residue = nullptr;
 }
 
 MResidue::MResidue(uint32 inNumber, char inTypeCode, MResidue* inPrevious)
@@ -461,7 +618,7 @@ MResidue::MResidue(uint32 inNumber, char inTypeCode, MResidue* inPrevious)
   mCA.mChainID = "A";
 }
 
-MResidue::MResidue(const MResidue& residue)
+MResidue::MResidue(const MResidue& residue, arena* inArena)
   : mChainID(residue.mChainID)
   , mPrev(nullptr)
   , mNext(nullptr)
@@ -476,7 +633,8 @@ MResidue::MResidue(const MResidue& residue)
   , mCA(residue.mCA)
   , mO(residue.mO)
   , mH(residue.mH)
-  , mSideChain(residue.mSideChain)
+  , mSideChain(residue.mSideChain.begin(), residue.mSideChain.end(),
+               arena_allocator<MAtom>(inArena))
   , mSheet(residue.mSheet)
   , mBend(residue.mBend)
   , mCenter(residue.mCenter)
@@ -513,13 +671,14 @@ void MResidue::SetChainID(const std::string& inChainID)
 {
   mChainID = inChainID;
 
-  mC.SetChainID(inChainID);
-  mCA.SetChainID(inChainID);
-  mO.SetChainID(inChainID);
-  mN.SetChainID(inChainID);
-  mH.SetChainID(inChainID);
+  MAtomName chainID(inChainID);
+  mC.SetChainID(chainID);
+  mCA.SetChainID(chainID);
+  mO.SetChainID(chainID);
+  mN.SetChainID(chainID);
+  mH.SetChainID(chainID);
   for_each(mSideChain.begin(), mSideChain.end(),
-           boost::bind(&MAtom::SetChainID, _1, inChainID));
+           boost::bind(&MAtom::SetChainID, _1, chainID));
 }
 
 bool MResidue::ValidDistance(const MResidue& inNext) const
@@ -645,7 +804,8 @@ uint8 MResidue::GetSSBridgeNr() const
 }
 
 // TODO: use the angle to improve bond energy calculation.
-double MResidue::CalculateHBondEnergy(MResidue& inDonor, MResidue& inAcceptor)
+double MResidue::HBondEnergy(const MResidue& inDonor,
+                             const MResidue& inAcceptor)
 {
   double result = 0;
 
@@ -669,6 +829,13 @@ double MResidue::CalculateHBondEnergy(MResidue& inDonor, MResidue& inAcceptor)
       result = kMinHBondEnergy;
   }
 
+  return result;
+}
+
+double MResidue::CalculateHBondEnergy(MResidue& inDonor, MResidue& inAcceptor)
+{
+  double result = HBondEnergy(inDonor, inAcceptor);
+
   // update donor
   if (result < inDonor.mHBondAcceptor[0].energy)
   {
@@ -740,41 +907,6 @@ void MResidue::ExtendBox(const MAtom& atom, double inRadius)
     mBox[1].mZ = atom.mLoc.mZ + inRadius;
 }
 
-inline
-bool MResidue::AtomIntersectsBox(const MAtom& atom, double inRadius) const
-{
-  return
-    atom.mLoc.mX + inRadius >= mBox[0].mX and
-    atom.mLoc.mX - inRadius <= mBox[1].mX and
-    atom.mLoc.mY + inRadius >= mBox[0].mY and
-    atom.mLoc.mY - inRadius <= mBox[1].mY and
-    atom.mLoc.mZ + inRadius >= mBox[0].mZ and
-    atom.mLoc.mZ - inRadius <= mBox[1].mZ;
-}
-
-void MResidue::CalculateSurface(const std::vector<MResidue*>& inResidues)
-{
-  std::vector<MResidue*> neighbours;
-
-  foreach (MResidue* r, inResidues)
-  {
-    MPoint center;
-    double radius;
-    r->GetCenterAndRadius(center, radius);
-
-    if (Distance(mCenter, center) < mRadius + radius)
-      neighbours.push_back(r);
-  }
-
-  mAccessibility = CalculateSurface(mN, kRadiusN, neighbours) +
-           CalculateSurface(mCA, kRadiusCA, neighbours) +
-           CalculateSurface(mC, kRadiusC, neighbours) +
-           CalculateSurface(mO, kRadiusO, neighbours);
-
-  foreach (const MAtom& atom, mSideChain)
-    mAccessibility += CalculateSurface(atom, kRadiusSideAtom, neighbours);
-}
-
 class MAccumulator
 {
   public:
@@ -804,59 +936,268 @@ class MAccumulator
       candidate c = { b - a, r * r, distance };
 
       m_x.push_back(c);
-      push_heap(m_x.begin(), m_x.end());
     }
   }
 
+  // the order only affects how soon a covered dot is rejected, not whether
+  // it is, so there is no need for a stable order here.
   void sort()
   {
-    sort_heap(m_x.begin(), m_x.end());
+    std::sort(m_x.begin(), m_x.end());
   }
 
   std::vector<candidate>  m_x;
 };
 
-double MResidue::CalculateSurface(const MAtom& inAtom, double inRadius,
-                                  const std::vector<MResidue*>& inResidues)
+// --------------------------------------------------------------------
+// The sorted candidates of an MAccumulator as a structure of arrays, so that
+// a surface dot can be tested against several candidates at once. The arrays
+// are padded to a multiple of kOccluderLanes with candidates that never
+// cover a dot.
+
+namespace
 {
-  MAccumulator accumulate;
 
-  foreach (MResidue* r, inResidues)
+const uint32 kOccluderLanes = 4;
+
+struct MOccluders
+{
+  MOccluders(const std::vector<MAccumulator::candidate>& inCandidates)
+    : mCount(inCandidates.size())
   {
-    if (r->AtomIntersectsBox(inAtom, inRadius))
+    uint32 n = (mCount + kOccluderLanes - 1) / kOccluderLanes * kOccluderLanes;
+
+    mX.resize(n, 0);
+    mY.resize(n, 0);
+    mZ.resize(n, 0);
+    mRadius.resize(n, -1);
+
+    for (uint32 k = 0; k < mCount; ++k)
     {
-      accumulate(inAtom, r->mN, inRadius, kRadiusN);
-      accumulate(inAtom, r->mCA, inRadius, kRadiusCA);
-      accumulate(inAtom, r->mC, inRadius, kRadiusC);
-      accumulate(inAtom, r->mO, inRadius, kRadiusO);
+      mX[k] = inCandidates[k].location.mX;
+      mY[k] = inCandidates[k].location.mY;
+      mZ[k] = inCandidates[k].location.mZ;
+      mRadius[k] = inCandidates[k].radius;
+    }
+  }
+
+  uint32        mCount;
+  std::vector<double>  mX, mY, mZ, mRadius;
+};
 
-      foreach (const MAtom& atom, r->mSideChain)
-        accumulate(inAtom, atom, inRadius, kRadiusSideAtom);
+// A dot is free when it lies outside all candidate spheres. The squared
+// distances are calculated exactly like DistanceSquared does, so all kernels
+// give the same answer. Candidates are sorted on distance, the closest are
+// the most likely to cover a dot and are tested first.
+
+double FreeSurface(const MOccluders& inOccluders, double inRadius)
+{
+  MSurfaceDots& surfaceDots = MSurfaceDots::Instance();
+  double surface = 0;
+
+  for (uint32 i = 0; i < surfaceDots.size(); ++i)
+  {
+    MPoint xx = surfaceDots[i] * inRadius;
+
+    bool free = true;
+    for (uint32 k = 0; free and k < inOccluders.mCount; ++k)
+    {
+      MPoint location(inOccluders.mX[k], inOccluders.mY[k], inOccluders.mZ[k]);
+      free = inOccluders.mRadius[k] < DistanceSquared(xx, location);
     }
+
+    if (free)
+      surface += surfaceDots.weight();
   }
 
-  accumulate.sort();
+  return surface;
+}
 
-  double radius = inRadius + kRadiusWater;
+#if defined(__GNUC__) and (defined(__x86_64__) or defined(__i386__)) and defined(__SSE2__)
+
+#define XSSP_SIMD_SURFACE 1
+
+double FreeSurfaceSSE2(const MOccluders& inOccluders, double inRadius)
+{
+  MSurfaceDots& surfaceDots = MSurfaceDots::Instance();
   double surface = 0;
 
+  for (uint32 i = 0; i < surfaceDots.size(); ++i)
+  {
+    MPoint xx = surfaceDots[i] * inRadius;
+
+    const __m128d x = _mm_set1_pd(xx.mX);
+    const __m128d y = _mm_set1_pd(xx.mY);
+    const __m128d z = _mm_set1_pd(xx.mZ);
+
+    bool free = true;
+    for (uint32 k = 0; free and k < inOccluders.mCount; k += 2)
+    {
+      __m128d dx = _mm_sub_pd(x, _mm_loadu_pd(&inOccluders.mX[k]));
+      __m128d dy = _mm_sub_pd(y, _mm_loadu_pd(&inOccluders.mY[k]));
+      __m128d dz = _mm_sub_pd(z, _mm_loadu_pd(&inOccluders.mZ[k]));
+
+      __m128d d = _mm_add_pd(
+        _mm_add_pd(_mm_mul_pd(dx, dx), _mm_mul_pd(dy, dy)),
+        _mm_mul_pd(dz, dz));
+
+      __m128d outside = _mm_cmplt_pd(_mm_loadu_pd(&inOccluders.mRadius[k]), d);
+      free = _mm_movemask_pd(outside) == 0x3;
+    }
+
+    if (free)
+      surface += surfaceDots.weight();
+  }
+
+  return surface;
+}
+
+__attribute__((target("avx2")))
+double FreeSurfaceAVX2(const MOccluders& inOccluders, double inRadius)
+{
   MSurfaceDots& surfaceDots = MSurfaceDots::Instance();
+  double surface = 0;
 
   for (uint32 i = 0; i < surfaceDots.size(); ++i)
   {
-    MPoint xx = surfaceDots[i] * radius;
+    MPoint xx = surfaceDots[i] * inRadius;
+
+    const __m256d x = _mm256_set1_pd(xx.mX);
+    const __m256d y = _mm256_set1_pd(xx.mY);
+    const __m256d z = _mm256_set1_pd(xx.mZ);
 
     bool free = true;
-    for (uint32 k = 0; free and k < accumulate.m_x.size(); ++k)
-      free = accumulate.m_x[k].radius < DistanceSquared(xx, accumulate.m_x[k].location);
+    for (uint32 k = 0; free and k < inOccluders.mCount; k += 4)
+    {
+      __m256d dx = _mm256_sub_pd(x, _mm256_loadu_pd(&inOccluders.mX[k]));
+      __m256d dy = _mm256_sub_pd(y, _mm256_loadu_pd(&inOccluders.mY[k]));
+      __m256d dz = _mm256_sub_pd(z, _mm256_loadu_pd(&inOccluders.mZ[k]));
+
+      // no fused multiply-add here, the result must match DistanceSquared
+      __m256d d = _mm256_add_pd(
+        _mm256_add_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy)),
+        _mm256_mul_pd(dz, dz));
+
+      __m256d outside = _mm256_cmp_pd(
+        _mm256_loadu_pd(&inOccluders.mRadius[k]), d, _CMP_LT_OQ);
+      free = _mm256_movemask_pd(outside) == 0xf;
+    }
 
     if (free)
       surface += surfaceDots.weight();
   }
 
+  return surface;
+}
+
+#endif
+
+typedef double (*FreeSurfaceFunc)(const MOccluders&, double);
+
+FreeSurfaceFunc SelectFreeSurface()
+{
+  FreeSurfaceFunc result = &FreeSurface;
+#if XSSP_SIMD_SURFACE
+  if (__builtin_cpu_supports("avx2"))
+    result = &FreeSurfaceAVX2;
+  else
+    result = &FreeSurfaceSSE2;
+#endif
+  return result;
+}
+
+const FreeSurfaceFunc kFreeSurface = SelectFreeSurface();
+
+// --------------------------------------------------------------------
+// The atoms of the residues around a residue as a structure of arrays. The
+// atoms of each neighbour are contiguous, in the order N, CA, C, O and side
+// chain, so collecting the candidates for an atom runs over the coordinates
+// in sequence instead of over the atom records of each residue.
+
+struct MNeighbourAtoms
+{
+  struct neighbour
+  {
+    MPoint  box[2];
+    uint32  begin, end;
+  };
+
+  void AddAtom(const MPoint& inAtom, double inRadius)
+  {
+    mX.push_back(inAtom.mX);
+    mY.push_back(inAtom.mY);
+    mZ.push_back(inAtom.mZ);
+    mRadius.push_back(inRadius);
+  }
+
+  std::vector<neighbour>  mNeighbours;
+  std::vector<double>    mX, mY, mZ, mRadius;
+};
+
+double AtomSurface(const MPoint& inAtom, double inRadius,
+                   const MNeighbourAtoms& inAtoms)
+{
+  MAccumulator accumulate;
+
+  foreach (const MNeighbourAtoms::neighbour& n, inAtoms.mNeighbours)
+  {
+    if (inAtom.mX + inRadius >= n.box[0].mX and
+        inAtom.mX - inRadius <= n.box[1].mX and
+        inAtom.mY + inRadius >= n.box[0].mY and
+        inAtom.mY - inRadius <= n.box[1].mY and
+        inAtom.mZ + inRadius >= n.box[0].mZ and
+        inAtom.mZ - inRadius <= n.box[1].mZ)
+    {
+      for (uint32 k = n.begin; k < n.end; ++k)
+        accumulate(inAtom, MPoint(inAtoms.mX[k], inAtoms.mY[k], inAtoms.mZ[k]),
+                   inRadius, inAtoms.mRadius[k]);
+    }
+  }
+
+  accumulate.sort();
+
+  double radius = inRadius + kRadiusWater;
+  double surface = kFreeSurface(MOccluders(accumulate.m_x), radius);
+
   return surface * radius * radius;
 }
 
+}
+
+void MResidue::CalculateSurface(const std::vector<MResidue*>& inResidues)
+{
+  MNeighbourAtoms atoms;
+
+  foreach (const MResidue* r, inResidues)
+  {
+    if (Distance(mCenter, r->mCenter) >= mRadius + r->mRadius)
+      continue;
+
+    MNeighbourAtoms::neighbour n;
+    n.box[0] = r->mBox[0];
+    n.box[1] = r->mBox[1];
+    n.begin = atoms.mX.size();
+
+    atoms.AddAtom(r->mN, kRadiusN);
+    atoms.AddAtom(r->mCA, kRadiusCA);
+    atoms.AddAtom(r->mC, kRadiusC);
+    atoms.AddAtom(r->mO, kRadiusO);
+    foreach (const MAtom& atom, r->mSideChain)
+      atoms.AddAtom(atom, kRadiusSideAtom);
+
+    n.end = atoms.mX.size();
+    atoms.mNeighbours.push_back(n);
+  }
+
+  mAccessibility = AtomSurface(mN, kRadiusN, atoms) +
+           AtomSurface(mCA, kRadiusCA, atoms) +
+           AtomSurface(mC, kRadiusC, atoms) +
+           AtomSurface(mO, kRadiusO, atoms);
+
+  foreach (const MAtom& atom, mSideChain)
+    mAccessibility += AtomSurface(atom, kRadiusSideAtom, atoms);
+}
+
 void MResidue::Translate(const MPoint& inTranslation)
 {
   mN.Translate(inTranslation);
@@ -904,6 +1245,7 @@ void MResidue::WritePDB(std::ostream& os)
 
 MChain::MChain(const MChain& chain)
   : mChainID(chain.mChainID)
+  , mArena(nullptr)
 {
   MResidue* previous = nullptr;
 
@@ -918,24 +1260,40 @@ MChain::MChain(const MChain& chain)
 
 MChain::~MChain()
 {
-  foreach (MResidue* residue, mResidues)
-    delete residue;
+  DeleteResidues();
 }
 
 MChain& MChain::operator=(const MChain& chain)
 {
-  foreach (MResidue* residue, mResidues)
-    delete residue;
+  DeleteResidues();
   mResidues.clear();
 
   foreach (const MResidue* residue, chain.mResidues)
-    mResidues.push_back(new MResidue(*residue));
+    mResidues.push_back(NewResidue(*residue));
 
   mChainID = chain.mChainID;
 
   return *this;
 }
 
+MResidue* MChain::NewResidue(const MResidue& inResidue)
+{
+  if (mArena == nullptr)
+    return new MResidue(inResidue);
+  return new (mArena->allocate<MResidue>()) MResidue(inResidue, mArena);
+}
+
+void MChain::DeleteResidues()
+{
+  foreach (MResidue* residue, mResidues)
+  {
+    if (mArena == nullptr)
+      delete residue;
+    else
+      residue->~MResidue();
+  }
+}
+
 void MChain::SetChainID(const std::string& inChainID)
 {
   mChainID = inChainID;
@@ -1049,6 +1407,14 @@ MProtein::~MProtein()
 }
 
 void MProtein::ReadPDB(std::istream& is, bool cAlphaOnly)
+{
+  std::string data((std::istreambuf_iterator<char>(is)),
+                   std::istreambuf_iterator<char>());
+
+  ReadPDB(data.c_str(), data.c_str() + data.length(), cAlphaOnly);
+}
+
+void MProtein::ReadPDB(const char* inData, const char* inEnd, bool cAlphaOnly)
 {
   mResidueCount = 0;
   mChainBreaks = 0;
@@ -1071,12 +1437,16 @@ void MProtein::ReadPDB(std::istream& is, bool cAlphaOnly)
   char firstAltLoc = 0;
   bool atomSeen = false;
 
-  while (not is.eof())
+  // the lines are copied into a single string, saving an allocation per line
+  std::string line;
+  for (const char* p = inData; p < inEnd; )
   {
-    std::string line;
-    getline(is, line);
-    if (line.empty() and is.eof())
-      break;
+    const char* eol = static_cast<const char*>(memchr(p, '\n', inEnd - p));
+    if (eol == nullptr)
+      eol = inEnd;
+
+    line.assign(p, eol);
+    p = eol < inEnd ? eol + 1 : inEnd;
 
     if (VERBOSE > 3)
       std::cerr << line << std::endl;
@@ -1199,7 +1569,7 @@ void MProtein::ReadPDB(std::istream& is, bool cAlphaOnly)
       //  18 - 20  Residue name resName Residue name.
       atom.mResName = ba::trim_copy(line.substr(17, 4));
       //  22    Character chainID Chain identifier.
-      atom.mChainID = line[21];
+      atom.mChainID = std::string(1, line[21]);
       //  23 - 26  Integer resSeq Residue sequence number.
       atom.mResSeq = boost::lexical_cast<int16>(
           ba::trim_copy(line.substr(22, 4)));
@@ -1333,7 +1703,189 @@ void MProtein::ReadPDB(std::istream& is, bool cAlphaOnly)
     throw mas_exception("empty protein, or no valid complete residues");
 }
 
+namespace
+{
+
+std::string ModelAtomKey(const std::string& inChainID, int16 inResSeq,
+                         const std::string& inICode, const std::string& inName)
+{
+  return inChainID + ' ' + boost::lexical_cast<std::string>(inResSeq) + ' ' +
+         inICode + ' ' + inName;
+}
+
+}
+
+void MProtein::ReadPDBModel(const char* inData, const char* inEnd)
+{
+  if (mModelAtoms.empty())
+  {
+    foreach (MChain* chain, mChains)
+    {
+      foreach (MResidue* residue, chain->GetResidues())
+        residue->GetAtoms(mModelAtoms);
+    }
+
+    for (uint32 i = 0; i < mModelAtoms.size(); ++i)
+    {
+      const MAtom& atom = *mModelAtoms[i];
+      mModelAtomIndex[ModelAtomKey(atom.mChainID, atom.mResSeq, atom.mICode,
+                                   atom.mName)] = i;
+    }
+  }
+
+  // the first of alternate locations is taken, as ReadPDB does
+  std::vector<bool> seen(mModelAtoms.size());
+  uint32 seenCount = 0;
+
+  std::string line;
+  for (const char* p = inData; p < inEnd; )
+  {
+    const char* eol = static_cast<const char*>(memchr(p, '\n', inEnd - p));
+    if (eol == nullptr)
+      eol = inEnd;
+
+    line.assign(p, eol);
+    p = eol < inEnd ? eol + 1 : inEnd;
+
+    if (not (ba::starts_with(line, "ATOM  ") or ba::starts_with(line, "HETATM")))
+      continue;
+
+    boost::unordered_map<std::string,uint32>::iterator i =
+      mModelAtomIndex.find(ModelAtomKey(std::string(1, line[21]),
+        boost::lexical_cast<int16>(ba::trim_copy(line.substr(22, 4))),
+        line.substr(26, 1), ba::trim_copy(line.substr(12, 4))));
+
+    if (i == mModelAtomIndex.end() or seen[i->second])
+      continue;
+
+    MAtom& atom = *mModelAtoms[i->second];
+    atom.mLoc.mX = ParseFloat(line.substr(30, 8));
+    atom.mLoc.mY = ParseFloat(line.substr(38, 8));
+    atom.mLoc.mZ = ParseFloat(line.substr(46, 8));
+
+    seen[i->second] = true;
+    ++seenCount;
+  }
+
+  if (seenCount != mModelAtoms.size())
+    throw mas_exception(boost::format("model has %1% of the %2% atoms of the first model")
+      % seenCount % mModelAtoms.size());
+
+  // Residues are numbered in the order they were added, with an extra number
+  // for every chain and chain break. A break depends on the coordinates, so
+  // the numbers are assigned again like AddResidue does.
+  std::vector<MResidue*> residues;
+  residues.reserve(mResidueCount);
+  foreach (MChain* chain, mChains)
+    residues.insert(residues.end(), chain->GetResidues().begin(),
+                    chain->GetResidues().end());
+
+  sort(residues.begin(), residues.end(),
+       boost::bind(&MResidue::GetNumber, _1) <
+       boost::bind(&MResidue::GetNumber, _2));
+
+  uint32 chains = 0;
+  mChainBreaks = 0;
+  for (uint32 i = 0; i < residues.size(); ++i)
+  {
+    MResidue* r = residues[i];
+    r->Reset();
+
+    const MResidue* prev = r->Prev();
+    if (prev == nullptr)
+      ++chains;
+    else if (not prev->ValidDistance(*r))
+      ++mChainBreaks;
+
+    r->SetNumber(i + chains + mChainBreaks);
+  }
+
+  mNrOfHBondsInParallelBridges = 0;
+  mNrOfHBondsInAntiparallelBridges = 0;
+
+  std::fill(mParallelBridgesPerLadderHistogram,
+            mParallelBridgesPerLadderHistogram + kHistogramSize, 0);
+  std::fill(mAntiparallelBridgesPerLadderHistogram,
+            mAntiparallelBridgesPerLadderHistogram + kHistogramSize, 0);
+  std::fill(mLaddersPerSheetHistogram,
+            mLaddersPerSheetHistogram + kHistogramSize, 0);
+}
+
+MPDBModelReader::MPDBModelReader(std::istream& inData)
+  : mData(inData)
+  , mModel(0)
+  , mFirst(true)
+{
+}
+
+bool MPDBModelReader::Next(std::string& outRecords, uint32& outModel)
+{
+  outRecords.clear();
+
+  bool result = false, numbered = false;
+  std::string line;
+
+  while (getline(mData, line))
+  {
+    if (ba::starts_with(line, "MODEL"))
+    {
+      // the serial number, or the next one when it cannot be read
+      ++mModel;
+      try
+      {
+        mModel = boost::lexical_cast<uint32>(ba::trim_copy(line.substr(5)));
+      }
+      catch (const boost::bad_lexical_cast&)
+      {
+      }
+
+      numbered = true;
+      if (not mFirst)
+        outRecords.clear();
+    }
+    else if (ba::starts_with(line, "ENDMDL"))
+    {
+      if (mFirst)
+        outRecords += line + '\n';
+      result = true;
+      break;
+    }
+
+    if (mFirst or ba::starts_with(line, "ATOM  ") or
+        ba::starts_with(line, "HETATM"))
+    {
+      outRecords += line;
+      outRecords += '\n';
+    }
+  }
+
+  // a model that runs up to the end of the file without an ENDMDL
+  if (not result)
+    result = not outRecords.empty();
+
+  if (result and not numbered)
+    ++mModel;
+
+  mFirst = false;
+  outModel = mModel;
+
+  return result;
+}
+
 void MProtein::ReadmmCIF(std::istream& is, bool cAlphaOnly)
+{
+  mmCIF::file data(is);
+  ReadmmCIF(data, cAlphaOnly);
+}
+
+void MProtein::ReadmmCIF(const char* inData, const char* inEnd,
+                         bool cAlphaOnly)
+{
+  mmCIF::file data(inData, inEnd);
+  ReadmmCIF(data, cAlphaOnly);
+}
+
+void MProtein::ReadmmCIF(const mmCIF::file& data, bool cAlphaOnly)
 {
   mResidueCount = 0;
   mChainBreaks = 0;
@@ -1351,12 +1903,10 @@ void MProtein::ReadmmCIF(std::istream& is, bool cAlphaOnly)
   std::vector<std::pair<MResidueID,MResidueID>> ssbonds;
   std::set<char> terminatedChains;
 
-  // Read the mmCIF data into a mmCIF file class
+  // The mmCIF data is read into a mmCIF file class
   // Using http://mmcif.rcsb.org/dictionaries/pdb-correspondence/pdb2mmcif-2010.html
   // as a reference.
 
-  mmCIF::file data(is);
-
   // ID
   mID = data.get("_entry.id");
 
@@ -1421,23 +1971,44 @@ void MProtein::ReadmmCIF(std::istream& is, bool cAlphaOnly)
   // remap label_seq_id to auth_seq_id
   std::map<std::string, std::map<int,int> > seq_id_map;
 
-  foreach (const mmCIF::row& atom, data["_atom_site"])
+  // look up the columns of _atom_site once, the rows are then read by
+  // column number
+  const mmCIF::record& atomSite = data["_atom_site"];
+
+  enum {
+    kModelNum, kLabelSeqID, kID, kAtomID, kAltID, kCompID, kAsymID, kSeqID,
+    kInsCode, kCartnX, kCartnY, kCartnZ, kOccupancy, kBIso, kTypeSymbol,
+    kCharge, kColumnCount
+  };
+
+  const char* kColumnNames[kColumnCount] = {
+    "pdbx_PDB_model_num", "label_seq_id", "id", "auth_atom_id",
+    "label_alt_id", "auth_comp_id", "label_asym_id", "auth_seq_id",
+    "pdbx_PDB_ins_code", "Cartn_x", "Cartn_y", "Cartn_z", "occupancy",
+    "B_iso_or_equiv", "type_symbol", "pdbx_formal_charge"
+  };
+
+  int32 column[kColumnCount];
+  for (uint32 i = 0; i < kColumnCount; ++i)
+    column[i] = atomSite.column(kColumnNames[i]);
+
+  foreach (const mmCIF::row& atom, atomSite)
   {
     // skip over NMR models > 1
-    if (atoi(atom["pdbx_PDB_model_num"].c_str()) > 1)
+    if (atoi(atom[column[kModelNum]].c_str()) > 1)
       continue;
 
-    std::string label_seq_id = atom["label_seq_id"];
+    std::string label_seq_id = atom[column[kLabelSeqID]];
 
     MAtom a;
 
-    a.mSerial = boost::lexical_cast<uint32>(atom["id"]);
-    a.mName = atom["auth_atom_id"];
-    a.mAltLoc = atom["label_alt_id"] == "." ? ' ' : atom["label_alt_id"][0];
-    a.mResName = atom["auth_comp_id"];
-    a.mChainID = atom["label_asym_id"];
-    a.mResSeq = boost::lexical_cast<int16>(atom["auth_seq_id"]);
-    a.mICode = atom["pdbx_PDB_ins_code"] == "?" ? "" : atom["pdbx_PDB_ins_code"];
+    a.mSerial = boost::lexical_cast<uint32>(atom[column[kID]]);
+    a.mName = atom[column[kAtomID]];
+    a.mAltLoc = atom[column[kAltID]] == "." ? ' ' : atom[column[kAltID]][0];
+    a.mResName = atom[column[kCompID]];
+    a.mChainID = atom[column[kAsymID]];
+    a.mResSeq = boost::lexical_cast<int16>(atom[column[kSeqID]]);
+    a.mICode = atom[column[kInsCode]] == "?" ? "" : atom[column[kInsCode]];
 
     // map seq_id
     if (label_seq_id == "?" or label_seq_id == ".")
@@ -1445,15 +2016,15 @@ void MProtein::ReadmmCIF(std::istream& is, bool cAlphaOnly)
     else
       seq_id_map[a.mChainID][boost::lexical_cast<int16>(label_seq_id)] = a.mResSeq;
 
-    a.mLoc.mX = ParseFloat(atom["Cartn_x"]);
-    a.mLoc.mY = ParseFloat(atom["Cartn_y"]);
-    a.mLoc.mZ = ParseFloat(atom["Cartn_z"]);
+    a.mLoc.mX = ParseFloat(atom[column[kCartnX]]);
+    a.mLoc.mY = ParseFloat(atom[column[kCartnY]]);
+    a.mLoc.mZ = ParseFloat(atom[column[kCartnZ]]);
 
-    a.mOccupancy = ParseFloat(atom["occupancy"]);
-    a.mTempFactor = ParseFloat(atom["B_iso_or_equiv"]);
-    a.mElement = atom["type_symbol"];
-    a.mCharge = atom["pdbx_formal_charge"] != "?" ? boost::lexical_cast<int>(
-        atom["pdbx_formal_charge"]) : 0;
+    a.mOccupancy = ParseFloat(atom[column[kOccupancy]]);
+    a.mTempFactor = ParseFloat(atom[column[kBIso]]);
+    a.mElement = atom[column[kTypeSymbol]];
+    a.mCharge = atom[column[kCharge]] != "?" ? boost::lexical_cast<int>(
+        atom[column[kCharge]]) : 0;
 
     try
     {
@@ -1679,7 +2250,8 @@ void MProtein::AddResidue(const std::vector<MAtom>& inAtoms)
       prev = residues.back();
 
     uint32 resNumber = mResidueCount + mChains.size() + mChainBreaks;
-    MResidue* r = new MResidue(resNumber, prev, inAtoms);
+    MResidue* r = new (mArena.allocate<MResidue>())
+      MResidue(resNumber, prev, inAtoms, &mArena);
     // check for chain breaks
     if (prev != nullptr and not prev->ValidDistance(*r))
     {
@@ -1717,7 +2289,7 @@ MChain& MProtein::GetChain(const std::string& inChainID)
     if (mChains[i]->GetChainID() == inChainID)
       return *mChains[i];
 
-  mChains.push_back(new MChain(inChainID));
+  mChains.push_back(new MChain(inChainID, &mArena));
   return *mChains.back();
 }
 
@@ -1753,14 +2325,188 @@ void MProtein::CalculateSecondaryStructure(bool inPreferPiHelices)
   if (VERBOSE)
     std::cerr << "using " << residues.size() << " residues" << std::endl;
 
-  boost::thread t(boost::bind(&MProtein::CalculateAccessibilities, this,
-                  boost::ref(residues)));
+  MTaskGroup accessibilities;
+  accessibilities.Run(boost::bind(&MProtein::CalculateAccessibilities, this,
+                      boost::cref(residues)));
 
   CalculateHBondEnergies(residues);
   CalculateBetaSheets(residues);
   CalculateAlphaHelices(residues, inPreferPiHelices);
 
-  t.join();
+  accessibilities.Wait();
+}
+
+// --------------------------------------------------------------------
+// Parallel H-bond calculation. The rows are dealt out to the workers in
+// blocks. Each worker keeps the two best partners in the donor and acceptor
+// role for the rows it owns, and for the residues in rows of other workers
+// it found a partner for. The results of all workers are merged afterwards.
+
+namespace
+{
+
+const uint32 kHBondBlockSize = 64;  // rows handed to a worker at a time
+
+struct MHBondSlot
+{
+  double  energy;
+  uint32  partner;  // index in the residue list
+
+  // The serial code visits the partners of a residue in ascending order and
+  // only replaces a slot for a strictly lower energy. Hence ties go to the
+  // partner with the lowest index.
+  bool operator<(const MHBondSlot& rhs) const
+  {
+    return energy < rhs.energy or
+           (energy == rhs.energy and partner < rhs.partner);
+  }
+};
+
+struct MHBondSlots
+{
+  MHBondSlot  donor[2], acceptor[2];
+};
+
+const MHBondSlots kEmptyHBondSlots = {
+  { { 0, 0 }, { 0, 0 } }, { { 0, 0 }, { 0, 0 } }
+};
+
+// The worker that owns residue inResidue, and the index of that residue in
+// the rows of its owner.
+inline uint32 HBondOwner(uint32 inResidue, uint32 inWorkers)
+{
+  return (inResidue / kHBondBlockSize) % inWorkers;
+}
+
+inline uint32 HBondRow(uint32 inResidue, uint32 inWorkers)
+{
+  return (inResidue / (kHBondBlockSize * inWorkers)) * kHBondBlockSize +
+         inResidue % kHBondBlockSize;
+}
+
+// The slots of one worker take memory for its own rows plus the partners it
+// touched, not for the whole protein.
+struct MHBondWorkerSlots
+{
+  std::vector<MHBondSlots>  owned;
+  boost::unordered_map<uint32,MHBondSlots>
+              others;
+
+  MHBondSlots&  Get(uint32 inResidue, uint32 inWorker, uint32 inWorkers)
+  {
+    if (HBondOwner(inResidue, inWorkers) == inWorker)
+      return owned[HBondRow(inResidue, inWorkers)];
+    return others.insert(
+      std::make_pair(inResidue, kEmptyHBondSlots)).first->second;
+  }
+};
+
+inline void StoreHBond(MHBondSlot ioSlots[2], double inEnergy,
+                       uint32 inPartner)
+{
+  MHBondSlot slot = { inEnergy, inPartner };
+
+  if (inEnergy >= 0)
+    return;
+
+  if (slot < ioSlots[0])
+  {
+    ioSlots[1] = ioSlots[0];
+    ioSlots[0] = slot;
+  }
+  else if (slot < ioSlots[1])
+    ioSlots[1] = slot;
+}
+
+void CalculateHBondSlots(const std::vector<MResidue*>& inResidues,
+                         const std::vector<MPoint>& inCAlphas,
+                         const MPointGrid& inGrid, uint32 inWorker,
+                         uint32 inWorkers, MHBondWorkerSlots& outSlots)
+{
+  const uint32 stride = kHBondBlockSize * inWorkers;
+  outSlots.owned.assign(
+    (inResidues.size() + stride - 1) / stride * kHBondBlockSize,
+    kEmptyHBondSlots);
+
+  std::vector<uint32> candidates;
+
+  for (uint32 block = inWorker * kHBondBlockSize;
+       block + 1 < inResidues.size();
+       block += inWorkers * kHBondBlockSize)
+  {
+    for (uint32 i = block;
+         i < block + kHBondBlockSize and i + 1 < inResidues.size(); ++i)
+    {
+      const MResidue* ri = inResidues[i];
+      MHBondSlots& si = outSlots.owned[HBondRow(i, inWorkers)];
+
+      candidates.clear();
+      inGrid.GetCandidates(inCAlphas[i], candidates);
+
+      foreach (uint32 j, candidates)
+      {
+        if (j <= i)
+          continue;
+
+        const MResidue* rj = inResidues[j];
+
+        if (Distance(ri->GetCAlpha(), rj->GetCAlpha()) < kMinimalCADistance)
+        {
+          double energy = MResidue::HBondEnergy(*ri, *rj);
+          double reverse = j != i + 1 ? MResidue::HBondEnergy(*rj, *ri) : 0;
+
+          // only partners that form a bond take a slot
+          if (energy >= 0 and reverse >= 0)
+            continue;
+
+          MHBondSlots& sj = outSlots.Get(j, inWorker, inWorkers);
+
+          StoreHBond(si.acceptor, energy, j);
+          StoreHBond(sj.donor, energy, i);
+          StoreHBond(sj.acceptor, reverse, i);
+          StoreHBond(si.donor, reverse, j);
+        }
+      }
+    }
+  }
+}
+
+void MergeHBondSlots(const std::vector<MResidue*>& inResidues,
+                     const boost::ptr_vector<MHBondWorkerSlots>& inSlots,
+                     uint32 inResidue, bool inDonor, HBond outBonds[2])
+{
+  MHBondSlot best[2] = { { 0, 0 }, { 0, 0 } };
+
+  const uint32 workers = inSlots.size();
+  const uint32 owner = HBondOwner(inResidue, workers);
+
+  for (uint32 w = 0; w < workers; ++w)
+  {
+    const MHBondSlots* slots;
+    if (w == owner)
+      slots = &inSlots[w].owned[HBondRow(inResidue, workers)];
+    else
+    {
+      boost::unordered_map<uint32,MHBondSlots>::const_iterator i =
+        inSlots[w].others.find(inResidue);
+      if (i == inSlots[w].others.end())
+        continue;
+      slots = &i->second;
+    }
+
+    const MHBondSlot* s = inDonor ? slots->donor : slots->acceptor;
+    for (uint32 k = 0; k < 2; ++k)
+      StoreHBond(best, s[k].energy, s[k].partner);
+  }
+
+  for (uint32 k = 0; k < 2; ++k)
+  {
+    outBonds[k].energy = best[k].energy;
+    outBonds[k].residue =
+      best[k].energy < 0 ? inResidues[best[k].partner] : nullptr;
+  }
+}
+
 }
 
 void MProtein::CalculateHBondEnergies(const std::vector<MResidue*>& inResidues)
@@ -1768,23 +2514,69 @@ void MProtein::CalculateHBondEnergies(const std::vector<MResidue*>& inResidues)
   if (VERBOSE)
     std::cerr << "Calculate H-bond energies" << std::endl;
 
-  // Calculate the HBond energies
-  for (uint32 i = 0; i + 1 < inResidues.size(); ++i)
-  {
-    MResidue* ri = inResidues[i];
+  // Only residues with their C-alpha's closer than kMinimalCADistance can
+  // form an H-bond, use a grid over the C-alpha locations to find those.
+  std::vector<MPoint> calphas;
+  calphas.reserve(inResidues.size());
+  foreach (const MResidue* r, inResidues)
+    calphas.push_back(r->GetCAlpha());
 
-    for (uint32 j = i + 1; j < inResidues.size(); ++j)
+  MPointGrid grid(calphas, kMinimalCADistance);
+
+  uint32 nr_of_threads = MThreadPool::Instance().Size();
+  if (nr_of_threads > inResidues.size() / kHBondBlockSize)
+    nr_of_threads = inResidues.size() / kHBondBlockSize;
+
+  if (nr_of_threads <= 1)
+  {
+    // Calculate the HBond energies. The candidates are visited in ascending
+    // order, ties in energy are resolved exactly as in a full pairwise scan.
+    std::vector<uint32> candidates;
+    for (uint32 i = 0; i + 1 < inResidues.size(); ++i)
     {
-      MResidue* rj = inResidues[j];
+      MResidue* ri = inResidues[i];
+
+      candidates.clear();
+      grid.GetCandidates(calphas[i], candidates);
+      sort(candidates.begin(), candidates.end());
 
-      if (Distance(ri->GetCAlpha(), rj->GetCAlpha()) < kMinimalCADistance)
+      foreach (uint32 j, candidates)
       {
-        MResidue::CalculateHBondEnergy(*ri, *rj);
-        if (j != i + 1)
-          MResidue::CalculateHBondEnergy(*rj, *ri);
+        if (j <= i)
+          continue;
+
+        MResidue* rj = inResidues[j];
+
+        if (Distance(ri->GetCAlpha(), rj->GetCAlpha()) < kMinimalCADistance)
+        {
+          MResidue::CalculateHBondEnergy(*ri, *rj);
+          if (j != i + 1)
+            MResidue::CalculateHBondEnergy(*rj, *ri);
+        }
       }
     }
   }
+  else
+  {
+    boost::ptr_vector<MHBondWorkerSlots> slots;
+    MTaskGroup tasks;
+
+    for (uint32 ti = 0; ti < nr_of_threads; ++ti)
+    {
+      slots.push_back(new MHBondWorkerSlots);
+      tasks.Run(boost::bind(&CalculateHBondSlots, boost::cref(inResidues),
+        boost::cref(calphas), boost::cref(grid), ti, nr_of_threads,
+        boost::ref(slots.back())));
+    }
+
+    tasks.Wait();
+
+    for (uint32 i = 0; i < inResidues.size(); ++i)
+    {
+      MergeHBondSlots(inResidues, slots, i, true, inResidues[i]->Donor());
+      MergeHBondSlots(inResidues, slots, i, false, inResidues[i]->Acceptor());
+    }
+  }
 }
 
 // TODO: improve alpha helix calculation by better recognizing pi-helices
@@ -1898,56 +2690,98 @@ void MProtein::CalculateBetaSheets(const std::vector<MResidue*>& inResidues)
     std::cerr << "Calculate beta sheets" << std::endl;
 
   // Calculate Bridges
+  arena ladders;
   std::vector<MBridge> bridges;
   if (inResidues.size() > 4)
   {
+    boost::unordered_map<const MResidue*,uint32> index;
+    for (uint32 i = 0; i < inResidues.size(); ++i)
+      index[inResidues[i]] = i;
+
+    // The bridges that can still be extended, by the next pair of residues
+    // they would take; (type, i, j) is a parallel or antiparallel bridge
+    // whose i side ends at i - 1. No two bridges wait for the same pair.
+    typedef std::tr1::tuple<MBridgeType,uint32,uint32> ladder_end;
+    boost::unordered_map<ladder_end,uint32> open;
+
+    std::vector<uint32> candidates;
+
     for (uint32 i = 1; i + 4 < inResidues.size(); ++i)
     {
       MResidue* ri = inResidues[i];
 
-      for (uint32 j = i + 3; j + 1 < inResidues.size(); ++j)
+      // TestBridge(ri, rj) needs an H-bond from ri or its successor to rj
+      // or to the predecessor of rj, see the figure there. So the partners
+      // of those H-bonds and their successors are the only candidates.
+      candidates.clear();
+      const MResidue* donors[2] = { ri, ri->Next() };
+      foreach (const MResidue* donor, donors)
       {
+        if (donor == nullptr)
+          continue;
+
+        for (uint32 k = 0; k < 2; ++k)
+        {
+          const MResidue* partner = donor->Acceptor()[k].residue;
+          if (partner == nullptr)
+            continue;
+
+          candidates.push_back(index[partner]);
+          if (partner->Next() != nullptr)
+            candidates.push_back(index[partner->Next()]);
+        }
+      }
+
+      sort(candidates.begin(), candidates.end());
+      candidates.erase(unique(candidates.begin(), candidates.end()),
+                       candidates.end());
+
+      foreach (uint32 j, candidates)
+      {
+        if (j < i + 3 or j + 1 >= inResidues.size())
+          continue;
+
         MResidue* rj = inResidues[j];
 
         MBridgeType type = ri->TestBridge(rj);
         if (type == btNoBridge)
           continue;
 
-        bool found = false;
-        foreach (MBridge& bridge, bridges)
+        boost::unordered_map<ladder_end,uint32>::iterator l =
+          open.find(ladder_end(type, i, j));
+
+        uint32 nr;
+        if (l != open.end())
         {
-          if (type != bridge.type or i != bridge.i.back() + 1)
-            continue;
+          nr = l->second;
+          open.erase(l);
 
-          if (type == btParallel and bridge.j.back() + 1 == j)
-          {
-            bridge.i.push_back(i);
+          MBridge& bridge = bridges[nr];
+          bridge.i.push_back(i);
+          if (type == btParallel)
             bridge.j.push_back(j);
-            found = true;
-            break;
-          }
-
-          if (type == btAntiParallel and bridge.j.front() - 1 == j)
-          {
-            bridge.i.push_back(i);
-            bridge.j.push_front(j);
-            found = true;
-            break;
-          }
+          else
+            bridge.j.insert(bridge.j.begin(), j);
         }
-
-        if (not found)
+        else
         {
-          MBridge bridge = {};
+          MBridge bridge = {
+            type, 0, 0, std::set<MBridge*>(),
+            MLadderSide(&ladders), MLadderSide(&ladders),
+            ri->GetChainID(), rj->GetChainID()
+          };
 
-          bridge.type = type;
           bridge.i.push_back(i);
-          bridge.chainI = ri->GetChainID();
           bridge.j.push_back(j);
-          bridge.chainJ = rj->GetChainID();
 
-          bridges.push_back(bridge);
+          nr = bridges.size();
+          bridges.push_back(std::move(bridge));
         }
+
+        if (type == btParallel)
+          open[ladder_end(type, i + 1, j + 1)] = nr;
+        else
+          open[ladder_end(type, i + 1, j - 1)] = nr;
       }
     }
   }
@@ -2098,7 +2932,7 @@ void MProtein::CalculateBetaSheets(const std::vector<MResidue*>& inResidues)
     {
       mNrOfHBondsInParallelBridges += bridge.i.back() - bridge.i.front() + 2;
 
-      std::deque<uint32>::iterator j = bridge.j.begin();
+      MLadderSide::iterator j = bridge.j.begin();
       foreach (uint32 i, bridge.i)
         inResidues[i]->SetBetaPartner(betai, inResidues[*j++], bridge.ladder,
                                       true);
@@ -2112,7 +2946,7 @@ void MProtein::CalculateBetaSheets(const std::vector<MResidue*>& inResidues)
     {
       mNrOfHBondsInAntiparallelBridges += bridge.i.back() - bridge.i.front() + 2;
 
-      std::deque<uint32>::reverse_iterator j = bridge.j.rbegin();
+      MLadderSide::reverse_iterator j = bridge.j.rbegin();
       foreach (uint32 i, bridge.i)
         inResidues[i]->SetBetaPartner(betai, inResidues[*j++], bridge.ladder,
                                       false);
@@ -2139,53 +2973,66 @@ void MProtein::CalculateBetaSheets(const std::vector<MResidue*>& inResidues)
   }
 }
 
+namespace
+{
+
+// Residues are only neighbours when their bounding spheres overlap. The grid
+// cells are as wide as the largest sphere diameter, so all neighbours of a
+// residue are found in the cells around its center.
+void GetNeighbourCandidates(const MResidue* inResidue,
+                            const std::vector<MResidue*>& inResidues,
+                            const MPointGrid& inGrid,
+                            std::vector<uint32>& ioIndices,
+                            std::vector<MResidue*>& outCandidates)
+{
+  MPoint center;
+  double radius;
+  inResidue->GetCenterAndRadius(center, radius);
+
+  ioIndices.clear();
+  inGrid.GetCandidates(center, ioIndices);
+  sort(ioIndices.begin(), ioIndices.end());
+
+  outCandidates.clear();
+  foreach (uint32 i, ioIndices)
+    outCandidates.push_back(inResidues[i]);
+}
+
+}
+
 void MProtein::CalculateAccessibilities(
     const std::vector<MResidue*>& inResidues)
 {
   if (VERBOSE)
     std::cerr << "Calculate accessibilities" << std::endl;
 
-  uint32 nr_of_threads = boost::thread::hardware_concurrency();
-  if (nr_of_threads <= 1)
-  {
-    foreach (MResidue* residue, inResidues)
-      residue->CalculateSurface(inResidues);
-  }
-  else
+  std::vector<MPoint> centers;
+  centers.reserve(inResidues.size());
+  double maxRadius = 0;
+  foreach (const MResidue* residue, inResidues)
   {
-    MResidueQueue queue;
-
-    boost::thread_group t;
-
-    for (uint32 ti = 0; ti < nr_of_threads; ++ti)
-      t.create_thread(boost::bind(&MProtein::CalculateAccessibility, this,
-        boost::ref(queue), boost::ref(inResidues)));
-
-    foreach (MResidue* residue, inResidues)
-      queue.put(residue);
-
-    queue.put(nullptr);
+    MPoint center;
+    double radius;
+    residue->GetCenterAndRadius(center, radius);
 
-    t.join_all();
+    centers.push_back(center);
+    if (maxRadius < radius)
+      maxRadius = radius;
   }
-}
 
-void MProtein::CalculateAccessibility(MResidueQueue& inQueue,
-  const std::vector<MResidue*>& inResidues)
-{
+  MPointGrid grid(centers, std::max(2 * maxRadius, 1.0));
+
   // make sure the MSurfaceDots is constructed once
   (void)MSurfaceDots::Instance();
 
-  for (;;)
-  {
-    MResidue* residue = inQueue.get();
-    if (residue == nullptr)
-      break;
-
-    residue->CalculateSurface(inResidues);
-  }
+  ParallelFor(inResidues.size(), [&inResidues, &grid](uint32 i) {
+    std::vector<uint32> indices;
+    std::vector<MResidue*> candidates;
 
-  inQueue.put(nullptr);
+    GetNeighbourCandidates(inResidues[i], inResidues, grid, indices,
+                           candidates);
+    inResidues[i]->CalculateSurface(candidates);
+  });
 }
 
 void MProtein::Center()
@@ -7,17 +7,21 @@
 #pragma once
 
 #include "align-2d.h"
+#include "arena.h"
 #include "mas.h"
 #include "primitives-3d.h"
 
+#include <boost/unordered_map.hpp>
+
 struct MAtom;
 class MResidue;
 class MChain;
 class MProtein;
 
-// forward declaration of buffer
-template<typename T, uint32 N> class buffer;
-typedef buffer<MResidue*,100>  MResidueQueue;
+namespace mmCIF
+{
+class file;
+}
 
 const uint32 kHistogramSize = 30;
 
@@ -47,25 +51,56 @@ enum MAtomType
 
 MAtomType MapElement(std::string inElement);
 
-// for now, MAtom contains exactly what the ATOM line contains in a PDB file
+// Atom, residue, chain and element names come from a small vocabulary. An
+// MAtomName refers to the one shared copy of its text, so copying an atom
+// does not allocate and names compare equal when the pointers do.
+class MAtomName
+{
+  public:
+            MAtomName() : mName(Empty()) {}
+            MAtomName(const std::string& inName) : mName(Intern(inName)) {}
+            MAtomName(const char* inName) : mName(Intern(inName)) {}
+
+  const std::string&  str() const            { return *mName; }
+            operator const std::string&() const  { return *mName; }
+
+  bool        operator==(const MAtomName& rhs) const
+                            { return mName == rhs.mName; }
+  bool        operator!=(const MAtomName& rhs) const
+                            { return mName != rhs.mName; }
+
+  private:
+  static const std::string*
+            Empty();
+  static const std::string*
+            Intern(const std::string& inName);
+
+  const std::string*  mName;
+};
+
+std::ostream& operator<<(std::ostream& os, const MAtomName& inName);
+
+// MAtom contains what the ATOM line contains in a PDB file, with the names
+// interned and the members ordered to keep the record small.
 struct MAtom
 {
+  MPoint    mLoc;
+  MAtomName  mName;
+  MAtomName  mResName;
+  MAtomName  mChainID;
+  MAtomName  mICode;
+  MAtomName  mElement;
   uint32    mSerial;
-  std::string  mName;
-  char    mAltLoc;
-  std::string  mResName;
-  std::string  mChainID;
-  int16    mResSeq;
-  std::string  mICode;
   MAtomType  mType;
-  MPoint    mLoc;
-  double    mOccupancy;
-  double    mTempFactor;
-  std::string  mElement;
-  int      mCharge;
+  float    mOccupancy;
+  float    mTempFactor;
+  int16    mResSeq;
+  char    mAltLoc;
+  int8    mCharge;
 
-  void    SetChainID(const std::string& inChainID){ mChainID = inChainID;}
-  std::string  GetName() const              { return mName; }
+  void    SetChainID(const MAtomName& inChainID){ mChainID = inChainID;}
+  const std::string&
+        GetName() const              { return mName; }
   void    Translate(const MPoint& inTranslation)  { mLoc += inTranslation; }
   void    Rotate(const MQuaternion& inRotation)  { mLoc.Rotate(inRotation); }
   void    WritePDB(std::ostream& os) const;
@@ -74,6 +109,9 @@ struct MAtom
         operator MPoint&()            { return mLoc; }
 };
 
+// the side chain atoms of a residue, kept in the arena of its protein
+typedef std::vector<MAtom, arena_allocator<MAtom> > MAtomList;
+
 enum MResidueType
 {
   kUnknownResidue,
@@ -153,10 +191,11 @@ enum MSecondaryStructure
 class MResidue
 {
   public:
-            MResidue(const MResidue& residue);
+            MResidue(const MResidue& residue, arena* inArena = nullptr);
             MResidue(uint32 inNumber, char inTypeCode, MResidue* inPrevious);
             MResidue(uint32 inNumber,
-              MResidue* inPrevious, const std::vector<MAtom>& inAtoms);
+              MResidue* inPrevious, const std::vector<MAtom>& inAtoms,
+              arena* inArena = nullptr);
 
   void        SetChainID(const std::string& inChainID);
   std::string      GetChainID() const        { return mChainID; }
@@ -237,13 +276,23 @@ class MResidue
   void        WritePDB(std::ostream& os);
 
   static double CalculateHBondEnergy(MResidue& inDonor, MResidue& inAcceptor);
+  // as above, but without storing the result in donor and acceptor
+  static double HBondEnergy(const MResidue& inDonor,
+                            const MResidue& inAcceptor);
 
-  std::vector<MAtom>&  GetSideChain()        { return mSideChain; }
-  const std::vector<MAtom>&
-            GetSideChain() const    { return mSideChain; }
+  MAtomList&      GetSideChain()        { return mSideChain; }
+  const MAtomList&  GetSideChain() const    { return mSideChain; }
 
   void        GetPoints(std::vector<MPoint>& outPoints) const;
 
+  // the atoms as read from the structure file, in the order N, CA, C, O
+  // and side chain
+  void        GetAtoms(std::vector<MAtom*>& outAtoms);
+
+  // after the atoms have moved: recalculate the hydrogen and the box and
+  // forget everything CalculateSecondaryStructure assigned
+  void        Reset();
+
   void        CalculateSurface(const std::vector<MResidue*>& inResidues);
 
   void        GetCenterAndRadius(MPoint& outCenter, double& outRadius) const
@@ -253,14 +302,10 @@ class MResidue
 
   protected:
 
-  double        CalculateSurface(
-              const MAtom& inAtom, double inRadius,
-              const std::vector<MResidue*>& inResidues);
-
   bool        TestBond(const MResidue* other) const;
 
+  void        CalculateGeometry();
   void        ExtendBox(const MAtom& atom, double inRadius);
-  bool        AtomIntersectsBox(const MAtom& atom, double inRadius) const;
 
   std::string      mChainID;
   MResidue*      mPrev;
@@ -273,7 +318,7 @@ class MResidue
   MSecondaryStructure  mSecondaryStructure;
   MAtom        mC, mN, mCA, mO, mH;
   HBond        mHBondDonor[2], mHBondAcceptor[2];
-  std::vector<MAtom>  mSideChain;
+  MAtomList      mSideChain;
   MBridgeParner    mBetaPartner[2];
   uint32        mSheet;
   MHelixFlag      mHelixFlags[3];  //
@@ -291,7 +336,9 @@ class MChain
   public:
 
             MChain(const MChain& chain);
-            MChain(const std::string& inChainID) : mChainID(inChainID) {}
+            // the residues of a chain with an arena are created in it
+            MChain(const std::string& inChainID, arena* inArena = nullptr)
+              : mChainID(inChainID), mArena(inArena) {}
             ~MChain();
 
   MChain&        operator=(const MChain& chain);
@@ -317,9 +364,13 @@ class MChain
   bool        Empty() const            { return mResidues.empty(); }
 
   private:
+  MResidue*      NewResidue(const MResidue& inResidue);
+  void        DeleteResidues();
+
   std::string      mChainID;
   std::vector<MResidue*>
             mResidues;
+  arena*        mArena;
 };
 
 class MProtein
@@ -334,6 +385,22 @@ class MProtein
   void        ReadPDB(std::istream& is, bool inCAlphaOnly = false);
   void        ReadmmCIF(std::istream& is, bool inCAlphaOnly = false);
 
+  // read from the characters inData up to inEnd, which must be followed
+  // by a null character, e.g. an input_buffer
+  void        ReadPDB(const char* inData, const char* inEnd,
+                bool inCAlphaOnly = false);
+  void        ReadmmCIF(const char* inData, const char* inEnd,
+                bool inCAlphaOnly = false);
+
+  // Replace the coordinates with those in the next model of the PDB file
+  // this protein was read from, inData up to inEnd holding the records of
+  // that model. The residues of the first model are kept, the numbering
+  // follows the chain breaks in the new model and everything calculated by
+  // CalculateSecondaryStructure is cleared. Atoms missing from the first
+  // model are ignored, an atom of the protein missing in the new model is
+  // an error.
+  void        ReadPDBModel(const char* inData, const char* inEnd);
+
   const std::string&  GetID() const          { return mID; }
   const std::string&  GetHeader() const        { return mHeader; }
   std::string      GetCompound() const;
@@ -401,6 +468,8 @@ class MProtein
 
   private:
 
+  void ReadmmCIF(const mmCIF::file& inData, bool inCAlphaOnly);
+
   void AddResidue(const std::vector<MAtom>& inAtoms);
 
   void CalculateHBondEnergies(const std::vector<MResidue*>& inResidues);
@@ -409,9 +478,9 @@ class MProtein
   void CalculateBetaSheets(const std::vector<MResidue*>& inResidues);
   void CalculateAccessibilities(const std::vector<MResidue*>& inResidues);
 
-  // a thread entry point
-  void        CalculateAccessibility(MResidueQueue& inQueue,
-              const std::vector<MResidue*>& inResidues);
+  // residues and their side chains are allocated here, the chains
+  // destroy the residues
+  arena        mArena;
 
   std::string      mID, mHeader;
 
@@ -423,6 +492,12 @@ class MProtein
   std::vector<std::pair<MResidue*,MResidue*> > mSSBonds;
   uint32        mIgnoredWaterMolecules;
 
+  // the atoms of the protein, and their index by chain, residue number,
+  // insertion code and name, for ReadPDBModel
+  std::vector<MAtom*>  mModelAtoms;
+  boost::unordered_map<std::string,uint32>
+            mModelAtomIndex;
+
   // statistics
   uint32 mNrOfHBondsInParallelBridges, mNrOfHBondsInAntiparallelBridges;
   uint32 mParallelBridgesPerLadderHistogram[kHistogramSize];
@@ -430,6 +505,28 @@ class MProtein
   uint32 mLaddersPerSheetHistogram[kHistogramSize];
 };
 
+// MPDBModelReader splits a PDB file in a stream into its models, one model
+// at a time. The first model comes with all the records in front of it, for
+// MProtein::ReadPDB, the later ones with their ATOM and HETATM records only,
+// for MProtein::ReadPDBModel. A last model without ENDMDL is returned too.
+class MPDBModelReader
+{
+  public:
+            MPDBModelReader(std::istream& inData);
+
+  // The records of the next model in outRecords and the serial number from
+  // its MODEL record in outModel, false when there are no more models.
+  bool        Next(std::string& outRecords, uint32& outModel);
+
+  private:
+            MPDBModelReader(const MPDBModelReader&);
+  MPDBModelReader&  operator=(const MPDBModelReader&);
+
+  std::istream&    mData;
+  uint32        mModel;
+  bool        mFirst;
+};
+
 // inlines
 
 // GetSequences can be used to quickly get all sequences in a vector<string>
@@ -0,0 +1,215 @@
+// Copyright Maarten L. Hekkelman, Radboud University 2008-2011.
+// Copyright Coos Baakman, Jon Black, Wouter G. Touw & Gert Vriend, Radboud university medical center 2015.
+//   Distributed under the Boost Software License, Version 1.0.
+//       (See accompanying file LICENSE_1_0.txt or copy at
+//             http://www.boost.org/LICENSE_1_0.txt)
+
+#include "thread-pool.h"
+
+#include <boost/bind.hpp>
+
+// --------------------------------------------------------------------
+
+MThreadPool& MThreadPool::Instance()
+{
+  static MThreadPool sInstance(boost::thread::hardware_concurrency());
+  return sInstance;
+}
+
+MThreadPool::MThreadPool(uint32 inThreads)
+  : mQueued(0)
+  , mNext(0)
+  , mStop(false)
+{
+  // the thread waiting for a task group is the remaining one
+  for (uint32 i = 1; i < inThreads; ++i)
+    mWorkers.push_back(new MWorker);
+
+  for (uint32 i = 0; i < mWorkers.size(); ++i)
+    mThreads.create_thread(boost::bind(&MThreadPool::Run, this, i));
+}
+
+MThreadPool::~MThreadPool()
+{
+  {
+    boost::mutex::scoped_lock lock(mMutex);
+    mStop = true;
+    mWakeUp.notify_all();
+  }
+
+  mThreads.join_all();
+}
+
+void MThreadPool::Submit(const MTask& inTask)
+{
+  uint32 worker;
+  if (mCurrent.get() != nullptr)
+    worker = *mCurrent;
+  else
+    worker = static_cast<uint32>(++mNext) % mWorkers.size();
+
+  {
+    boost::mutex::scoped_lock lock(mWorkers[worker].mMutex);
+    mWorkers[worker].mTasks.push_back(inTask);
+  }
+
+  ++mQueued;
+
+  boost::mutex::scoped_lock lock(mMutex);
+  mWakeUp.notify_one();
+}
+
+// Take a task from the back of deque inFirst, or steal one from the front
+// of any of the others.
+bool MThreadPool::Pop(uint32 inFirst, MTask& outTask)
+{
+  bool result = false;
+
+  for (uint32 i = 0; i < mWorkers.size() and not result; ++i)
+  {
+    MWorker& worker = mWorkers[(inFirst + i) % mWorkers.size()];
+
+    boost::mutex::scoped_lock lock(worker.mMutex);
+    if (worker.mTasks.empty())
+      continue;
+
+    if (i == 0)
+    {
+      outTask = worker.mTasks.back();
+      worker.mTasks.pop_back();
+    }
+    else
+    {
+      outTask = worker.mTasks.front();
+      worker.mTasks.pop_front();
+    }
+
+    --mQueued;
+    result = true;
+  }
+
+  return result;
+}
+
+bool MThreadPool::RunPendingTask()
+{
+  if (mWorkers.empty() or mQueued <= 0)
+    return false;
+
+  uint32 first;
+  if (mCurrent.get() != nullptr)
+    first = *mCurrent;
+  else
+    first = static_cast<uint32>(mNext) % mWorkers.size();
+
+  MTask task;
+  bool result = Pop(first, task);
+  if (result)
+    task();
+
+  return result;
+}
+
+void MThreadPool::Run(uint32 inWorker)
+{
+  mCurrent.reset(new uint32(inWorker));
+
+  for (;;)
+  {
+    MTask task;
+    if (Pop(inWorker, task))
+    {
+      task();
+      continue;
+    }
+
+    boost::mutex::scoped_lock lock(mMutex);
+    if (mStop)
+      break;
+
+    if (mQueued <= 0)
+      mWakeUp.wait(lock);
+  }
+}
+
+// --------------------------------------------------------------------
+
+MTaskGroup::MTaskGroup(MThreadPool& inPool)
+  : mPool(inPool)
+  , mPending(0)
+{
+}
+
+MTaskGroup::~MTaskGroup()
+{
+  try
+  {
+    Wait();
+  }
+  catch (...) {}
+}
+
+void MTaskGroup::Run(const MTask& inTask)
+{
+  {
+    boost::mutex::scoped_lock lock(mMutex);
+    ++mPending;
+  }
+
+  if (mPool.mWorkers.empty())
+    Execute(inTask);
+  else
+    mPool.Submit(boost::bind(&MTaskGroup::Execute, this, inTask));
+}
+
+void MTaskGroup::Execute(const MTask& inTask)
+{
+  std::exception_ptr e;
+
+  try
+  {
+    inTask();
+  }
+  catch (...)
+  {
+    e = std::current_exception();
+  }
+
+  // nothing may touch this group after the lock is released, the waiting
+  // thread may destroy it right away
+  boost::mutex::scoped_lock lock(mMutex);
+
+  if (e and not mException)
+    mException = e;
+
+  if (--mPending == 0)
+    mDone.notify_all();
+}
+
+void MTaskGroup::Wait()
+{
+  for (;;)
+  {
+    {
+      boost::mutex::scoped_lock lock(mMutex);
+      if (mPending == 0)
+        break;
+    }
+
+    // help out while our own tasks are still queued, otherwise they are
+    // all being executed and we can only wait for them
+    if (mPool.RunPendingTask())
+      continue;
+
+    boost::mutex::scoped_lock lock(mMutex);
+    if (mPending > 0)
+      mDone.wait(lock);
+  }
+
+  if (mException)
+  {
+    std::exception_ptr e = mException;
+    mException = std::exception_ptr();
+    std::rethrow_exception(e);
+  }
+}
@@ -0,0 +1,141 @@
+// Copyright Maarten L. Hekkelman, Radboud University 2008-2011.
+// Copyright Coos Baakman, Jon Black, Wouter G. Touw & Gert Vriend, Radboud university medical center 2015.
+//   Distributed under the Boost Software License, Version 1.0.
+//       (See accompanying file LICENSE_1_0.txt or copy at
+//             http://www.boost.org/LICENSE_1_0.txt)
+//
+// A process wide work stealing thread pool. Each worker thread owns a deque
+// of tasks, it takes new work from the back of its own deque and steals from
+// the front of the other deques when that one is empty. A thread waiting for
+// a task group executes pending tasks too, so task groups can be nested.
+
+#ifndef XSSP_THREAD_POOL_H
+#define XSSP_THREAD_POOL_H
+
+#pragma once
+
+#include "mas.h"
+
+#include <boost/detail/atomic_count.hpp>
+#include <boost/function.hpp>
+#include <boost/ptr_container/ptr_vector.hpp>
+#include <boost/thread/condition.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/tss.hpp>
+
+#include <deque>
+#include <exception>
+
+typedef boost::function<void()> MTask;
+
+class MThreadPool
+{
+  public:
+
+  static MThreadPool&  Instance();
+
+  // The number of threads executing tasks, the waiting thread included
+  uint32        Size() const        { return mWorkers.size() + 1; }
+
+  private:
+  friend class MTaskGroup;
+
+  struct MWorker
+  {
+    boost::mutex    mMutex;
+    std::deque<MTask>  mTasks;
+  };
+
+            MThreadPool(uint32 inThreads);
+            ~MThreadPool();
+            MThreadPool(const MThreadPool&);
+  MThreadPool&    operator=(const MThreadPool&);
+
+  void        Submit(const MTask& inTask);
+  bool        RunPendingTask();
+  bool        Pop(uint32 inFirst, MTask& outTask);
+  void        Run(uint32 inWorker);
+
+  boost::ptr_vector<MWorker>
+            mWorkers;
+  boost::thread_group  mThreads;
+  boost::thread_specific_ptr<uint32>
+            mCurrent;    // index of the worker running this thread
+  boost::detail::atomic_count
+            mQueued, mNext;
+  boost::mutex    mMutex;
+  boost::condition  mWakeUp;
+  bool        mStop;
+};
+
+// --------------------------------------------------------------------
+// A set of tasks to be executed by the pool. Wait returns when all tasks
+// are done and rethrows the first exception thrown by any of them.
+
+class MTaskGroup
+{
+  public:
+            MTaskGroup(MThreadPool& inPool = MThreadPool::Instance());
+            ~MTaskGroup();
+
+  void        Run(const MTask& inTask);
+  void        Wait();
+
+  private:
+            MTaskGroup(const MTaskGroup&);
+  MTaskGroup&      operator=(const MTaskGroup&);
+
+  void        Execute(const MTask& inTask);
+
+  MThreadPool&    mPool;
+  uint32        mPending;
+  boost::mutex    mMutex;
+  boost::condition  mDone;
+  std::exception_ptr  mException;
+};
+
+// --------------------------------------------------------------------
+// Call inFunc(i) for all i in [0, inCount) using at most inMaxThreads
+// threads, zero means as many as the pool has. Indices are handed out one
+// at a time, so the order in which they are processed is not defined.
+
+template<class Func>
+void ParallelFor(uint32 inCount, Func inFunc, uint32 inMaxThreads = 0)
+{
+  MThreadPool& pool = MThreadPool::Instance();
+
+  uint32 nr_of_threads = pool.Size();
+  if (inMaxThreads > 0 and nr_of_threads > inMaxThreads)
+    nr_of_threads = inMaxThreads;
+  if (nr_of_threads > inCount)
+    nr_of_threads = inCount;
+
+  if (nr_of_threads <= 1)
+  {
+    for (uint32 i = 0; i < inCount; ++i)
+      inFunc(i);
+  }
+  else
+  {
+    boost::detail::atomic_count next(-1);
+    MTaskGroup group(pool);
+
+    for (uint32 t = 0; t < nr_of_threads; ++t)
+    {
+      group.Run([&next, &inFunc, inCount]() {
+        for (;;)
+        {
+          uint32 i = static_cast<uint32>(++next);
+          if (i >= inCount)
+            break;
+          inFunc(i);
+        }
+      });
+    }
+
+    group.Wait();
+  }
+}
+
+#endif
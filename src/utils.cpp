@@ -4,18 +4,32 @@
 //       (See accompanying file LICENSE_1_0.txt or copy at
 //             http://www.boost.org/LICENSE_1_0.txt)
 
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
 #include "utils.h"
 
 #include "align-2d.h"
 
+#include <boost/algorithm/string.hpp>
 #include <boost/bind.hpp>
 #include <boost/foreach.hpp>
+#include <boost/iostreams/filtering_stream.hpp>
 #include <boost/thread.hpp>
 
+#ifdef HAVE_LIBBZ2
+#include <boost/iostreams/filter/bzip2.hpp>
+#include <boost/iostreams/filter/gzip.hpp>
+#endif
+
 #include <cstdio>
+#include <fstream>
 #include <iostream>
 
 namespace fs = boost::filesystem;
+namespace io = boost::iostreams;
+namespace ba = boost::algorithm;
 
 #define foreach BOOST_FOREACH
 // --------------------------------------------------------------------
@@ -58,6 +72,101 @@ mas_exception::mas_exception(const boost::format& msg)
   snprintf(m_msg, sizeof(m_msg), "%s", msg.str().c_str());
 }
 
+// --------------------------------------------------------------------
+
+input_buffer::input_buffer(const std::string& inFile)
+  : m_data(nullptr)
+  , m_size(0)
+{
+  if (not fs::exists(inFile))
+    throw mas_exception(boost::format("No such file %s") % inFile);
+
+  // Pipes, FIFOs and devices have no size and cannot be mapped or seeked
+  // in, they are read until the end instead.
+  bool regular = fs::is_regular_file(inFile);
+  size_t size = regular ? fs::file_size(inFile) : 0;
+
+#ifdef HAVE_LIBBZ2
+  bool gzip = ba::ends_with(inFile, ".gz");
+  if (gzip or ba::ends_with(inFile, ".bz2"))
+  {
+    std::ifstream file(inFile.c_str(),
+                       std::ios_base::in | std::ios_base::binary);
+    if (not file.is_open())
+      throw mas_exception(boost::format("Could not open %s") % inFile);
+
+    // gzip stores the uncompressed size, modulo 2^32, in its last four
+    // bytes; for bzip2 we can only guess
+    size_t hint = 4 * size;
+    if (gzip and regular and size >= 18)
+    {
+      uint8 isize[4];
+      file.seekg(-4, std::ios_base::end);
+      file.read(reinterpret_cast<char*>(isize), 4);
+      file.seekg(0);
+
+      size_t n = isize[0] | (isize[1] << 8) | (isize[2] << 16) |
+                 (uint32(isize[3]) << 24);
+      if (n >= size)
+        hint = n;
+    }
+
+    io::filtering_stream<io::input> in;
+    if (gzip)
+      in.push(io::gzip_decompressor());
+    else
+      in.push(io::bzip2_decompressor());
+    in.push(file);
+
+    read(in, hint);
+    return;
+  }
+#endif
+
+  // The part of the last page that is past the end of the file reads as
+  // zeros, which gives us the null character. Files that end exactly on a
+  // page boundary are read instead.
+  if (regular and size > 0 and
+      size % io::mapped_file_source::alignment() != 0)
+  {
+    m_file.open(inFile);
+    m_data = m_file.data();
+    m_size = m_file.size();
+  }
+  else
+  {
+    std::ifstream file(inFile.c_str(),
+                       std::ios_base::in | std::ios_base::binary);
+    if (not file.is_open())
+      throw mas_exception(boost::format("Could not open %s") % inFile);
+
+    read(file, size);
+  }
+}
+
+void input_buffer::read(std::istream& is, size_t inSizeHint)
+{
+  m_buffer.resize(inSizeHint + 1);
+
+  size_t n = 0;
+  for (;;)
+  {
+    is.read(&m_buffer[n], m_buffer.size() - 1 - n);
+    n += is.gcount();
+
+    if (not is or is.peek() == std::char_traits<char>::eof())
+      break;
+
+    m_buffer.resize(2 * m_buffer.size());
+  }
+
+  m_buffer.resize(n + 1);
+  m_buffer[n] = 0;
+
+  m_data = &m_buffer[0];
+  m_size = n;
+}
+
 //// --------------------------------------------------------------------
 //
 //std::string decode(const sequence& s)
@@ -13,6 +13,7 @@
 
 #include <boost/filesystem.hpp>
 #include <boost/format.hpp>
+#include <boost/iostreams/device/mapped_file.hpp>
 #include <boost/lexical_cast.hpp>
 #include <boost/thread.hpp>
 
@@ -82,6 +83,33 @@ class mas_exception : public std::exception
   char      m_msg[1024];
 };
 
+// --------------------------------------------------------------------
+// The contents of an input file as a single range of characters, followed
+// by a null character. Plain files are mapped into memory, files ending in
+// .gz or .bz2 are decompressed into one buffer that is sized up front.
+
+class input_buffer
+{
+  public:
+          input_buffer(const std::string& inFile);
+
+  const char*    begin() const      { return m_data; }
+  const char*    end() const        { return m_data + m_size; }
+  size_t      size() const        { return m_size; }
+
+  private:
+          input_buffer(const input_buffer&);
+  input_buffer&  operator=(const input_buffer&);
+
+  void      read(std::istream& is, size_t inSizeHint);
+
+  boost::iostreams::mapped_file_source
+            m_file;
+  std::vector<char>  m_buffer;
+  const char*    m_data;
+  size_t      m_size;
+};
+
 // --------------------------------------------------------------------
 
 #ifndef NDEBUG
@@ -0,0 +1,286 @@
+// Micro benchmarks for the performance critical parts of xssp.
+//
+// Usage: bench_xssp [name...], runs all benchmarks when no name is given.
+
+#include "mas.h"
+#include "buffer.h"
+#include "iocif.h"
+#include "primitives-3d.h"
+
+#include <boost/bind.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/format.hpp>
+#include <boost/thread.hpp>
+
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace pt = boost::posix_time;
+
+// --------------------------------------------------------------------
+
+class timer
+{
+  public:
+          timer() : m_start(pt::microsec_clock::local_time()) {}
+
+  double    elapsed() const
+        {
+          return (pt::microsec_clock::local_time() - m_start)
+            .total_microseconds() / 1e6;
+        }
+
+  private:
+  pt::ptime  m_start;
+};
+
+// random points with roughly the density of C-alpha atoms in a protein,
+// one residue per 150 cubic angstrom.
+void random_points(uint32 inCount, std::vector<MPoint>& outPoints)
+{
+  double side = pow(inCount * 150.0, 1 / 3.0);
+
+  outPoints.clear();
+  for (uint32 i = 0; i < inCount; ++i)
+    outPoints.push_back(MPoint(side * rand() / RAND_MAX,
+                               side * rand() / RAND_MAX,
+                               side * rand() / RAND_MAX));
+}
+
+// --------------------------------------------------------------------
+// pairs of C-alpha's within H-bond range, full scan versus MPointGrid
+
+void bench_grid()
+{
+  const double kCutoff = 9.0;
+
+  std::cout << "grid: C-alpha pairs within " << kCutoff << " A" << std::endl
+            << boost::format("%8s %10s %10s %10s") % "n" % "pairs" % "scan(s)" %
+               "grid(s)" << std::endl;
+
+  for (uint32 n = 1000; n <= 64000; n *= 4)
+  {
+    std::vector<MPoint> points;
+    random_points(n, points);
+
+    timer scanTimer;
+    uint32 scanPairs = 0;
+    for (uint32 i = 0; i + 1 < n; ++i)
+      for (uint32 j = i + 1; j < n; ++j)
+        if (Distance(points[i], points[j]) < kCutoff)
+          ++scanPairs;
+    double scanTime = scanTimer.elapsed();
+
+    timer gridTimer;
+    uint32 gridPairs = 0;
+    MPointGrid grid(points, kCutoff);
+    std::vector<uint32> candidates;
+    for (uint32 i = 0; i + 1 < n; ++i)
+    {
+      candidates.clear();
+      grid.GetCandidates(points[i], candidates);
+      for (uint32 k = 0; k < candidates.size(); ++k)
+      {
+        uint32 j = candidates[k];
+        if (j > i and Distance(points[i], points[j]) < kCutoff)
+          ++gridPairs;
+      }
+    }
+    double gridTime = gridTimer.elapsed();
+
+    if (scanPairs != gridPairs)
+      std::cout << "error: pair counts differ" << std::endl;
+
+    std::cout << boost::format("%8d %10d %10.4f %10.4f") % n % gridPairs %
+                 scanTime % gridTime << std::endl;
+  }
+}
+
+// --------------------------------------------------------------------
+// buffer versus lockfree_buffer, n producers and n consumers passing values
+// through a single queue. Consumers stop at the sentinel and put it back for
+// the others, as the users of buffer do.
+
+const uint32 kQueueSentinel = ~0U;
+
+template<class Queue>
+void queue_producer(Queue& ioQueue, uint32 inFirst, uint32 inCount)
+{
+  for (uint32 i = inFirst; i < inFirst + inCount; ++i)
+    ioQueue.put(i);
+}
+
+template<class Queue>
+void queue_consumer(Queue& ioQueue, boost::mutex& inLock, uint64& ioSum)
+{
+  uint64 sum = 0;
+  for (;;)
+  {
+    uint32 v = ioQueue.get();
+    if (v == kQueueSentinel)
+      break;
+    sum += v;
+  }
+
+  ioQueue.put(kQueueSentinel);
+
+  boost::mutex::scoped_lock lock(inLock);
+  ioSum += sum;
+}
+
+template<class Queue>
+double time_queue(uint32 inThreads, uint32 inItems)
+{
+  Queue queue;
+  boost::mutex lock;
+  uint64 sum = 0;
+
+  timer t;
+
+  boost::thread_group consumers, producers;
+  for (uint32 i = 0; i < inThreads; ++i)
+    consumers.create_thread(boost::bind(&queue_consumer<Queue>,
+      boost::ref(queue), boost::ref(lock), boost::ref(sum)));
+
+  uint32 perThread = inItems / inThreads;
+  for (uint32 i = 0; i < inThreads; ++i)
+    producers.create_thread(boost::bind(&queue_producer<Queue>,
+      boost::ref(queue), i * perThread, perThread));
+
+  producers.join_all();
+  queue.put(kQueueSentinel);
+  consumers.join_all();
+
+  double result = t.elapsed();
+
+  uint64 n = uint64(perThread) * inThreads;
+  if (sum != n * (n - 1) / 2)
+    std::cout << "error: values lost in the queue" << std::endl;
+
+  return result;
+}
+
+void bench_queue()
+{
+  const uint32 kItems = 1 << 20;
+
+  std::cout << "queue: " << kItems << " values through buffer<uint32>"
+            << std::endl
+            << boost::format("%8s %12s %12s") % "threads" % "mutex(s)" %
+               "lockfree(s)" << std::endl;
+
+  for (uint32 n = 1; n <= 64; n *= 2)
+  {
+    double locked = time_queue<buffer<uint32> >(n, kItems);
+    double lockfree = time_queue<lockfree_buffer<uint32> >(n, kItems);
+
+    std::cout << boost::format("%8d %12.4f %12.4f") % n % locked % lockfree
+              << std::endl;
+  }
+}
+
+// --------------------------------------------------------------------
+// an mmCIF file with a large _atom_site loop: loading it, and reading the
+// fields of every atom by name and by column number
+
+void bench_cif()
+{
+  const char* kFields[] = {
+    "group_PDB", "id", "type_symbol", "label_atom_id", "label_alt_id",
+    "label_comp_id", "label_asym_id", "label_entity_id", "label_seq_id",
+    "pdbx_PDB_ins_code", "Cartn_x", "Cartn_y", "Cartn_z", "occupancy",
+    "B_iso_or_equiv", "pdbx_formal_charge", "auth_seq_id", "auth_comp_id",
+    "auth_asym_id", "auth_atom_id", "pdbx_PDB_model_num"
+  };
+  const uint32 kFieldCount = sizeof(kFields) / sizeof(char*);
+
+  std::cout << "cif: _atom_site loop with " << kFieldCount << " fields"
+            << std::endl
+            << boost::format("%8s %10s %10s %10s") % "atoms" % "load(s)" %
+               "name(s)" % "column(s)" << std::endl;
+
+  for (uint32 n = 10000; n <= 1000000; n *= 10)
+  {
+    std::string text = "data_BENCH\n#\n_entry.id BENCH\n#\nloop_\n";
+    for (uint32 f = 0; f < kFieldCount; ++f)
+      text += std::string("_atom_site.") + kFields[f] + '\n';
+
+    for (uint32 i = 0; i < n; ++i)
+    {
+      text += (boost::format(
+        "ATOM %d C CA . ALA A 1 %d ? %.3f %.3f %.3f 1.00 10.00 ? %d ALA A CA 1\n")
+        % (i + 1) % (i / 5 + 1) % (rand() % 100000 / 1000.0) %
+        (rand() % 100000 / 1000.0) % (rand() % 100000 / 1000.0) %
+        (i / 5 + 1)).str();
+    }
+
+    timer loadTimer;
+    mmCIF::file data(text.c_str(), text.c_str() + text.length());
+    const mmCIF::record& atoms = data["_atom_site"];
+    double loadTime = loadTimer.elapsed();
+
+    // sum the lengths of the values so none of the work is optimised away
+    uint64 byName = 0;
+    timer nameTimer;
+    for (mmCIF::record::iterator atom = atoms.begin(); atom != atoms.end();
+         ++atom)
+    {
+      for (uint32 f = 0; f < kFieldCount; ++f)
+        byName += (*atom)[kFields[f]].length();
+    }
+    double nameTime = nameTimer.elapsed();
+
+    uint64 byColumn = 0;
+    timer columnTimer;
+    int32 column[kFieldCount];
+    for (uint32 f = 0; f < kFieldCount; ++f)
+      column[f] = atoms.column(kFields[f]);
+    for (mmCIF::record::iterator atom = atoms.begin(); atom != atoms.end();
+         ++atom)
+    {
+      for (uint32 f = 0; f < kFieldCount; ++f)
+        byColumn += (*atom)[column[f]].length();
+    }
+    double columnTime = columnTimer.elapsed();
+
+    if (atoms.size() != n or byName != byColumn)
+      std::cout << "error: atoms or values lost" << std::endl;
+
+    std::cout << boost::format("%8d %10.4f %10.4f %10.4f") % n % loadTime %
+                 nameTime % columnTime << std::endl;
+  }
+}
+
+// --------------------------------------------------------------------
+
+struct benchmark
+{
+  const char*  name;
+  void    (*run)();
+};
+
+const benchmark kBenchmarks[] = {
+  { "grid", &bench_grid },
+  { "queue", &bench_queue },
+  { "cif", &bench_cif },
+};
+
+int main(int argc, char* argv[])
+{
+  for (uint32 i = 0; i < sizeof(kBenchmarks) / sizeof(benchmark); ++i)
+  {
+    bool run = argc == 1;
+    for (int a = 1; a < argc and not run; ++a)
+      run = kBenchmarks[i].name == std::string(argv[a]);
+
+    if (run)
+    {
+      kBenchmarks[i].run();
+      std::cout << std::endl;
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,59 @@
+#include "arena.h"
+
+#include <boost/test/unit_test.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+
+BOOST_AUTO_TEST_SUITE(test_arena_suite)
+
+BOOST_AUTO_TEST_CASE(test_arena_allocate)
+{
+  arena a;
+
+  char* previous = nullptr;
+  for (uint32 size = 1; size < 3 * arena::kBlockSize; size = size * 3 + 1)
+  {
+    char* p = static_cast<char*>(a.allocate(size));
+    BOOST_CHECK_EQUAL(reinterpret_cast<std::uintptr_t>(p) % 16, 0U);
+    BOOST_CHECK(p != previous);
+
+    // the memory must be writable over its full size
+    std::fill(p, p + size, 'x');
+    previous = p;
+  }
+
+  double* d = a.allocate<double>(3);
+  d[0] = d[1] = d[2] = 1.5;
+  BOOST_CHECK_EQUAL(d[0] + d[1] + d[2], 4.5);
+}
+
+BOOST_AUTO_TEST_CASE(test_arena_allocator)
+{
+  arena a;
+
+  std::vector<uint32, arena_allocator<uint32> > v((arena_allocator<uint32>(&a)));
+  std::deque<uint32, arena_allocator<uint32> > q((arena_allocator<uint32>(&a)));
+  for (uint32 i = 0; i < 10000; ++i)
+  {
+    v.push_back(i);
+    q.push_front(i);
+  }
+
+  BOOST_CHECK_EQUAL(v.size(), 10000U);
+  BOOST_CHECK_EQUAL(v[9999], 9999U);
+  BOOST_CHECK_EQUAL(q.front(), 9999U);
+  BOOST_CHECK_EQUAL(q.back(), 0U);
+  BOOST_CHECK(v.get_allocator() == q.get_allocator());
+
+  // a copy from a range in a default allocator lives on the free store
+  std::vector<uint32, arena_allocator<uint32> > c(v.begin(), v.end());
+  BOOST_CHECK(c.get_allocator().get_arena() == nullptr);
+  BOOST_CHECK(c.get_allocator() != v.get_allocator());
+  BOOST_CHECK(c == v);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
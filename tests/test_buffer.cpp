@@ -0,0 +1,106 @@
+#include "buffer.h"
+
+#include <boost/test/unit_test.hpp>
+#include <boost/thread/thread.hpp>
+
+#include <algorithm>
+#include <vector>
+
+
+BOOST_AUTO_TEST_SUITE(test_buffer_suite)
+
+BOOST_AUTO_TEST_CASE(test_lockfree_buffer_full_and_empty)
+{
+  lockfree_buffer<uint32, 4> b;
+  uint32 v;
+
+  BOOST_CHECK(not b.try_get(v));
+
+  for (uint32 i = 0; i < 4; ++i)
+    BOOST_CHECK(b.try_put(i));
+  BOOST_CHECK(not b.try_put(4));
+
+  BOOST_CHECK(b.try_get(v));
+  BOOST_CHECK_EQUAL(v, 0U);
+
+  // the freed cell can be written again
+  BOOST_CHECK(b.try_put(4));
+  BOOST_CHECK(not b.try_put(5));
+
+  for (uint32 i = 1; i <= 4; ++i)
+  {
+    BOOST_CHECK(b.try_get(v));
+    BOOST_CHECK_EQUAL(v, i);
+  }
+  BOOST_CHECK(not b.try_get(v));
+}
+
+BOOST_AUTO_TEST_CASE(test_lockfree_buffer_wraparound)
+{
+  lockfree_buffer<uint32, 3> b;
+
+  // many laps around the ring with a varying fill level
+  uint32 next = 0, expected = 0;
+  for (uint32 lap = 0; lap < 1000; ++lap)
+  {
+    for (uint32 i = 0; i <= lap % 3; ++i)
+      b.put(next++);
+    while (expected < next)
+      BOOST_CHECK_EQUAL(b.get(), expected++);
+  }
+
+  uint32 v;
+  BOOST_CHECK(not b.try_get(v));
+}
+
+BOOST_AUTO_TEST_CASE(test_lockfree_buffer_producers_consumers)
+{
+  const uint32 kThreads = 4, kItems = 20000;
+
+  // small, so producers and consumers run into a full and an empty buffer
+  lockfree_buffer<uint32, 8> b;
+
+  std::vector<std::vector<uint32> > received(kThreads);
+  boost::thread_group threads;
+
+  for (uint32 t = 0; t < kThreads; ++t)
+  {
+    threads.create_thread([&b, t]() {
+      for (uint32 i = 0; i < kItems; ++i)
+        b.put(t * kItems + i);
+    });
+
+    std::vector<uint32>& r = received[t];
+    threads.create_thread([&b, &r]() {
+      for (uint32 i = 0; i < kItems; ++i)
+        r.push_back(b.get());
+    });
+  }
+
+  threads.join_all();
+
+  // every value arrives once, and each consumer sees the values of a
+  // producer in the order they were put
+  std::vector<uint32> all;
+  for (uint32 t = 0; t < kThreads; ++t)
+  {
+    std::vector<uint32> last(kThreads, 0);
+    std::vector<bool> seen(kThreads, false);
+    for (uint32 i = 0; i < received[t].size(); ++i)
+    {
+      uint32 v = received[t][i], producer = v / kItems;
+      BOOST_REQUIRE_LT(producer, kThreads);
+      BOOST_CHECK(not seen[producer] or v > last[producer]);
+      last[producer] = v;
+      seen[producer] = true;
+    }
+    all.insert(all.end(), received[t].begin(), received[t].end());
+  }
+
+  std::sort(all.begin(), all.end());
+  BOOST_REQUIRE_EQUAL(all.size(), kThreads * kItems);
+  for (uint32 i = 0; i < all.size(); ++i)
+    BOOST_REQUIRE_EQUAL(all[i], i);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
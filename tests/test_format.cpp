@@ -0,0 +1,117 @@
+#include "format.h"
+
+#include <boost/format.hpp>
+#include <boost/random/mersenne_twister.hpp>
+#include <boost/random/uniform_int_distribution.hpp>
+#include <boost/random/uniform_real_distribution.hpp>
+#include <boost/test/unit_test.hpp>
+
+#include <limits>
+
+
+BOOST_AUTO_TEST_SUITE(test_format_suite)
+
+BOOST_AUTO_TEST_CASE(test_integer_matches_boost_format)
+{
+  const int64 kValues[] = { 0, 1, -1, 9, 10, 99999, 100000, -9999, -10000,
+                            2147483647LL, -2147483647LL - 1, 4294967295LL };
+
+  format_buffer b;
+  for (auto v : kValues)
+  {
+    b.clear();
+    BOOST_CHECK_EQUAL(b.integer(v, 5).str(),
+                      (boost::format("%5.5d") % v).str());
+    b.clear();
+    BOOST_CHECK_EQUAL(b.integer(v).str(), (boost::format("%d") % v).str());
+  }
+}
+
+BOOST_AUTO_TEST_CASE(test_fixed_matches_boost_format)
+{
+  const double kValues[] = { 0, -0.0, 0.05, 0.15, 0.25, -0.25, 0.35, 2.5,
+                             -0.04, 1e-300, 999.95, 360, -180, 1e20, -1e20,
+                             std::numeric_limits<double>::infinity(),
+                             std::numeric_limits<double>::quiet_NaN() };
+
+  const char* kFormats[] = { "%6.1f", "%6.3f", "%4.2f", "%5.2f", "%3.1f",
+                             "%8.1f" };
+  const uint32 kWidths[] = { 6, 6, 4, 5, 3, 8 };
+  const uint32 kPrecisions[] = { 1, 3, 2, 2, 1, 1 };
+
+  boost::random::mt19937 rng;
+  boost::random::uniform_real_distribution<double> real(-1000, 1000);
+  boost::random::uniform_int_distribution<int32> tenths(-10000, 10000);
+
+  std::vector<double> values(kValues,
+                             kValues + sizeof(kValues) / sizeof(double));
+  for (uint32 i = 0; i < 20000; ++i)
+  {
+    values.push_back(real(rng));
+    values.push_back(tenths(rng) / 20.0);   // many ties
+    values.push_back(static_cast<float>(real(rng)));
+  }
+
+  format_buffer b;
+  for (auto v : values)
+  {
+    for (uint32 f = 0; f < sizeof(kFormats) / sizeof(char*); ++f)
+    {
+      b.clear();
+      BOOST_CHECK_EQUAL(b.fixed(v, kWidths[f], kPrecisions[f]).str(),
+                        (boost::format(kFormats[f]) % v).str());
+    }
+  }
+}
+
+BOOST_AUTO_TEST_CASE(test_general_matches_boost_format)
+{
+  const double kValues[] = { 0, -0.0, 1, 12, 123, 1234, 9999, 10000, 12345,
+                             -5, 0.5, 99.5, 1e9, 1e30 };
+
+  format_buffer b;
+  for (auto v : kValues)
+  {
+    b.clear();
+    BOOST_CHECK_EQUAL(b.general(v, 4, 4).str(),
+                      (boost::format("%4.4d") % v).str());
+  }
+}
+
+BOOST_AUTO_TEST_CASE(test_string_and_tab_match_boost_format)
+{
+  const char* kValues[] = { "", "A", "AB", "ABCDE", "-12,-3.4",
+                            "ABCDEFGHIJKL" };
+
+  format_buffer b;
+  for (auto v : kValues)
+  {
+    std::string s(v);
+
+    b.clear();
+    BOOST_CHECK_EQUAL(b.string(s, 1, 1).str(),
+                      (boost::format("%1.1s") % s).str());
+    b.clear();
+    BOOST_CHECK_EQUAL(b.string(s, 4, 4).str(),
+                      (boost::format("%4.4s") % s).str());
+    b.clear();
+    BOOST_CHECK_EQUAL(b.string(s, 11).str(),
+                      (boost::format("%11s") % s).str());
+
+    b.clear();
+    b.put("first line\n").put(s).put(' ').tab(10).put('.');
+    BOOST_CHECK_EQUAL(b.str(),
+      "first line\n" + (boost::format("%1% %|10t|%2%") % s % '.').str());
+
+    // the tab counts from the start of the format, not of the line
+    std::string t = "two\n" + s;
+    b.clear();
+    b.put("first line\n");
+    std::string::size_type start = b.size();
+    b.put(t).put(' ').tab(10, start).put('.');
+    BOOST_CHECK_EQUAL(b.str(),
+      "first line\n" + (boost::format("%1% %|10t|%2%") % t % '.').str());
+  }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
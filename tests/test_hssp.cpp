@@ -0,0 +1,57 @@
+#include "hssp-nt.h"
+
+#include <boost/test/unit_test.hpp>
+
+#include <vector>
+
+
+BOOST_AUTO_TEST_SUITE(test_hssp_suite)
+
+// a gap column lookup that fails the test when it is asked for a position
+// outside the profile
+struct MGapColumns
+{
+  MGapColumns(const std::vector<bool>& inGaps) : mGaps(inGaps) {}
+
+  bool operator()(std::size_t inIndex) const
+  {
+    BOOST_REQUIRE_LT(inIndex, mGaps.size());
+    return mGaps[inIndex];
+  }
+
+  const std::vector<bool>& mGaps;
+};
+
+BOOST_AUTO_TEST_CASE(test_gap_proximity_ends)
+{
+  std::vector<bool> gaps(20, false);
+  MGapColumns isGap(gaps);
+
+  // the first residues are near the start, the start counts as a gap
+  BOOST_CHECK_EQUAL(HSSP::GapProximityFactor(0, gaps.size(), isGap), 2.f);
+  BOOST_CHECK_EQUAL(HSSP::GapProximityFactor(3, gaps.size(), isGap), 1.25f);
+  BOOST_CHECK_EQUAL(HSSP::GapProximityFactor(6, gaps.size(), isGap), 0.5f);
+
+  // and so are the last ones
+  BOOST_CHECK_EQUAL(HSSP::GapProximityFactor(19, gaps.size(), isGap), 2.f);
+  BOOST_CHECK_EQUAL(HSSP::GapProximityFactor(16, gaps.size(), isGap), 1.25f);
+
+  // 8 residues away from both ends there is no change
+  BOOST_CHECK_EQUAL(HSSP::GapProximityFactor(8, gaps.size(), isGap), 1.f);
+  BOOST_CHECK_EQUAL(HSSP::GapProximityFactor(11, gaps.size(), isGap), 1.f);
+}
+
+BOOST_AUTO_TEST_CASE(test_gap_proximity_gaps)
+{
+  std::vector<bool> gaps(40, false);
+  gaps[20] = true;
+  MGapColumns isGap(gaps);
+
+  BOOST_CHECK_EQUAL(HSSP::GapProximityFactor(20, gaps.size(), isGap), 2.25f);
+  BOOST_CHECK_EQUAL(HSSP::GapProximityFactor(18, gaps.size(), isGap), 1.75f);
+  BOOST_CHECK_EQUAL(HSSP::GapProximityFactor(23, gaps.size(), isGap), 1.5f);
+  BOOST_CHECK_EQUAL(HSSP::GapProximityFactor(12, gaps.size(), isGap), 1.f);
+  BOOST_CHECK_EQUAL(HSSP::GapProximityFactor(28, gaps.size(), isGap), 1.f);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,79 @@
+#include "iocif.h"
+
+#include <boost/test/unit_test.hpp>
+
+#include <string>
+#include <vector>
+
+
+BOOST_AUTO_TEST_SUITE(test_iocif_suite)
+
+const char kCIF[] =
+  "data_TEST\n"
+  "#\n"
+  "_entry.id TEST\n"
+  "#\n"
+  "_struct.title\n"
+  ";A title\n"
+  "on two lines\n"
+  ";\n"
+  "_struct.pdbx_descriptor 'Some \"descriptor\"'\n"
+  "#\n"
+  "loop_\n"
+  "_atom_site.id\n"
+  "_atom_site.label_atom_id\n"
+  "_atom_site.Cartn_x\n"
+  "1 N   1.000\n"
+  "2 CA  \"2.000\"\n"
+  "# a comment between the rows\n"
+  "3 'C' 3.000\n"
+  "#\n"
+  "loop_\n"
+  "_audit_author.name\n"
+  "'Doe, J.'\n"
+  "\"O'Brien, K.\"\n";
+
+BOOST_AUTO_TEST_CASE(test_cif_fields)
+{
+  std::string text(kCIF);
+  mmCIF::file data(text.c_str(), text.c_str() + text.length());
+
+  BOOST_CHECK_EQUAL(data.get("_entry.id"), "TEST");
+  BOOST_CHECK_EQUAL(data.get("_struct.title"), "A title\non two lines\n");
+  BOOST_CHECK_EQUAL(data.get("_struct.pdbx_descriptor"),
+                    "Some \"descriptor\"");
+  BOOST_CHECK_EQUAL(data.get("_struct.unknown"), "");
+  BOOST_CHECK_EQUAL(data.get("_unknown.id"), "");
+  BOOST_CHECK_EQUAL(data.get_joined("_audit_author.name", "; "),
+                    "Doe, J.; O'Brien, K.");
+}
+
+BOOST_AUTO_TEST_CASE(test_cif_loop_columns)
+{
+  std::string text(kCIF);
+  mmCIF::file data(text.c_str(), text.c_str() + text.length());
+
+  const mmCIF::record& atoms = data["_atom_site"];
+  BOOST_CHECK_EQUAL(atoms.size(), 3U);
+  BOOST_CHECK_EQUAL(atoms.column("id"), 0);
+  BOOST_CHECK_EQUAL(atoms.column("Cartn_x"), 2);
+  BOOST_CHECK_EQUAL(atoms.column("Cartn"), -1);
+  BOOST_CHECK_EQUAL(atoms.column("Cartn_x_esd"), -1);
+
+  const char* kNames[] = { "N", "CA", "C" };
+  const char* kX[] = { "1.000", "2.000", "3.000" };
+
+  uint32 n = 0;
+  for (mmCIF::record::iterator atom = atoms.begin(); atom != atoms.end();
+       ++atom, ++n)
+  {
+    BOOST_CHECK_EQUAL((*atom)["label_atom_id"], kNames[n]);
+    BOOST_CHECK_EQUAL((*atom)[atoms.column("Cartn_x")], kX[n]);
+    BOOST_CHECK_EQUAL((*atom)["unknown"], "");
+  }
+  BOOST_CHECK_EQUAL(n, 3U);
+
+  BOOST_CHECK(data["_unknown"].begin() == data["_unknown"].end());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
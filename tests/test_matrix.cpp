@@ -0,0 +1,82 @@
+#include "matrix.h"
+
+#include <boost/test/unit_test.hpp>
+
+
+BOOST_AUTO_TEST_SUITE(test_matrix_suite)
+
+BOOST_AUTO_TEST_CASE(test_diagonal_matrix_matches_matrix)
+{
+  const uint32 kDims[][2] = { { 1, 1 }, { 1, 7 }, { 7, 1 }, { 5, 9 }, { 9, 5 },
+                              { 6, 6 } };
+
+  for (auto& dims : kDims)
+  {
+    uint32 m = dims[0], n = dims[1];
+
+    matrix<int> a(m, n);
+    diagonal_matrix<int> b(m, n);
+
+    for (uint32 i = 0; i < m; ++i)
+      for (uint32 j = 0; j < n; ++j)
+        a(i, j) = b(i, j) = i * n + j;
+
+    for (uint32 i = 0; i < m; ++i)
+      for (uint32 j = 0; j < n; ++j)
+        BOOST_CHECK_EQUAL(a(i, j), b(i, j));
+
+    // the elements of an anti-diagonal are consecutive, ordered by i
+    for (uint32 d = 0; d + 1 < m + n; ++d)
+    {
+      const int* diagonal = b.diagonal(d);
+      for (int32 i = b.first(d); i <= b.last(d); ++i)
+        BOOST_CHECK_EQUAL(diagonal[i - b.first(d)], a(i, d - i));
+    }
+  }
+}
+
+BOOST_AUTO_TEST_CASE(test_banded_diagonal_matrix)
+{
+  const uint32 m = 9, n = 6;
+  const int32 kBands[][2] = { { -2, 1 }, { 3, 8 }, { -5, -4 }, { 0, 0 } };
+
+  for (auto& band : kBands)
+  {
+    int32 lo = band[0], hi = band[1];
+    diagonal_matrix<int> b(m, n, lo, hi, -1);
+
+    // every element in the band is on its anti-diagonal exactly once
+    uint32 count = 0;
+    for (uint32 d = 0; d + 1 < m + n; ++d)
+    {
+      for (int32 i = b.first(d); i <= b.last(d); ++i)
+      {
+        int32 j = d - i;
+        BOOST_CHECK(i >= 0 and i < int32(m) and j >= 0 and j < int32(n));
+        BOOST_CHECK(i - j >= lo and i - j <= hi);
+        ++count;
+      }
+    }
+
+    uint32 expected = 0;
+    for (uint32 i = 0; i < m; ++i)
+    {
+      for (uint32 j = 0; j < n; ++j)
+      {
+        if (b.in_band(i, j))
+        {
+          ++expected;
+          b(i, j) = i * n + j;
+        }
+      }
+    }
+    BOOST_CHECK_EQUAL(count, expected);
+
+    const diagonal_matrix<int>& c = b;
+    for (uint32 i = 0; i < m; ++i)
+      for (uint32 j = 0; j < n; ++j)
+        BOOST_CHECK_EQUAL(c(i, j), b.in_band(i, j) ? int(i * n + j) : 0);
+  }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,59 @@
+#include "primitives-3d.h"
+
+#include <boost/test/unit_test.hpp>
+
+#include <algorithm>
+#include <cstdlib>
+
+
+BOOST_AUTO_TEST_SUITE(test_primitives_suite)
+
+BOOST_AUTO_TEST_CASE(test_point_grid_finds_all_neighbours)
+{
+  srand(1);
+
+  std::vector<MPoint> points;
+  for (int i = 0; i < 2000; ++i)
+    points.push_back(MPoint(rand() % 10000 / 100.0, rand() % 10000 / 100.0,
+                            rand() % 5000 / 100.0));
+
+  const double kCutoff = 9.0;
+  MPointGrid grid(points, kCutoff);
+
+  for (uint32 i = 0; i < points.size(); i += 7)
+  {
+    std::vector<uint32> expected;
+    for (uint32 j = 0; j < points.size(); ++j)
+      if (Distance(points[i], points[j]) < kCutoff)
+        expected.push_back(j);
+
+    std::vector<uint32> candidates, found;
+    grid.GetCandidates(points[i], candidates);
+    for (uint32 k = 0; k < candidates.size(); ++k)
+      if (Distance(points[i], points[candidates[k]]) < kCutoff)
+        found.push_back(candidates[k]);
+    sort(found.begin(), found.end());
+
+    BOOST_CHECK(found == expected);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(test_point_grid_sparse_points)
+{
+  std::vector<MPoint> points;
+  points.push_back(MPoint(0, 0, 0));
+  points.push_back(MPoint(5, 0, 0));
+  points.push_back(MPoint(1e6, 1e6, 1e6));
+
+  MPointGrid grid(points, 9.0);
+
+  std::vector<uint32> candidates;
+  grid.GetCandidates(points[0], candidates);
+  sort(candidates.begin(), candidates.end());
+
+  BOOST_CHECK(candidates.size() >= 2);
+  BOOST_CHECK_EQUAL(candidates[0], 0);
+  BOOST_CHECK_EQUAL(candidates[1], 1);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,75 @@
+#include "structure.h"
+
+#include <boost/test/unit_test.hpp>
+
+#include <sstream>
+#include <string>
+
+
+BOOST_AUTO_TEST_SUITE(test_structure_suite)
+
+const char kModels[] =
+  "HEADER    TEST\n"
+  "MODEL        1\n"
+  "ATOM      1  N   MET A   1      27.340  24.430   2.614  1.00  9.67           N\n"
+  "ENDMDL\n"
+  "MODEL        2\n"
+  "ATOM      1  N   MET A   1      27.341  24.431   2.615  1.00  9.67           N\n"
+  "TER\n"
+  "ENDMDL\n"
+  "MODEL        7\n"
+  "ATOM      1  N   MET A   1      27.342  24.432   2.616  1.00  9.67           N\n"
+  "HETATM    2  O   HOH A   2      20.000  20.000  20.000  1.00  9.67           O\n"
+  "END\n";
+
+BOOST_AUTO_TEST_CASE(test_pdb_model_reader)
+{
+  std::istringstream data(kModels);
+  MPDBModelReader models(data);
+
+  std::string records;
+  uint32 model;
+
+  // the first model with everything in front of it
+  BOOST_REQUIRE(models.Next(records, model));
+  BOOST_CHECK_EQUAL(model, 1U);
+  BOOST_CHECK_EQUAL(records,
+    "HEADER    TEST\n"
+    "MODEL        1\n"
+    "ATOM      1  N   MET A   1      27.340  24.430   2.614  1.00  9.67           N\n"
+    "ENDMDL\n");
+
+  // then only the atoms
+  BOOST_REQUIRE(models.Next(records, model));
+  BOOST_CHECK_EQUAL(model, 2U);
+  BOOST_CHECK_EQUAL(records,
+    "ATOM      1  N   MET A   1      27.341  24.431   2.615  1.00  9.67           N\n");
+
+  // the last model has no ENDMDL
+  BOOST_REQUIRE(models.Next(records, model));
+  BOOST_CHECK_EQUAL(model, 7U);
+  BOOST_CHECK_EQUAL(records,
+    "ATOM      1  N   MET A   1      27.342  24.432   2.616  1.00  9.67           N\n"
+    "HETATM    2  O   HOH A   2      20.000  20.000  20.000  1.00  9.67           O\n");
+
+  BOOST_CHECK(not models.Next(records, model));
+}
+
+BOOST_AUTO_TEST_CASE(test_pdb_model_reader_single_model)
+{
+  std::istringstream data(
+    "HEADER    TEST\n"
+    "ATOM      1  N   MET A   1      27.340  24.430   2.614  1.00  9.67           N\n"
+    "END\n");
+  MPDBModelReader models(data);
+
+  std::string records;
+  uint32 model;
+
+  BOOST_REQUIRE(models.Next(records, model));
+  BOOST_CHECK_EQUAL(model, 1U);
+  BOOST_CHECK(records.find("ATOM") != std::string::npos);
+  BOOST_CHECK(not models.Next(records, model));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,55 @@
+#include "thread-pool.h"
+
+#include <boost/test/unit_test.hpp>
+
+#include <algorithm>
+#include <stdexcept>
+#include <vector>
+
+
+BOOST_AUTO_TEST_SUITE(test_thread_pool_suite)
+
+BOOST_AUTO_TEST_CASE(test_parallel_for_visits_all_indices)
+{
+  std::vector<uint32> visits(10000, 0);
+
+  ParallelFor(visits.size(), [&visits](uint32 i) { ++visits[i]; });
+
+  BOOST_CHECK(std::count(visits.begin(), visits.end(), 1) ==
+              static_cast<long>(visits.size()));
+}
+
+void SumTree(uint32 inDepth, boost::detail::atomic_count& ioLeaves)
+{
+  if (inDepth == 0)
+    ++ioLeaves;
+  else
+  {
+    MTaskGroup group;
+    group.Run([inDepth, &ioLeaves]() { SumTree(inDepth - 1, ioLeaves); });
+    group.Run([inDepth, &ioLeaves]() { SumTree(inDepth - 1, ioLeaves); });
+    group.Wait();
+  }
+}
+
+BOOST_AUTO_TEST_CASE(test_nested_task_groups)
+{
+  boost::detail::atomic_count leaves(0);
+  SumTree(10, leaves);
+
+  BOOST_CHECK_EQUAL(long(leaves), 1024);
+}
+
+BOOST_AUTO_TEST_CASE(test_task_group_rethrows)
+{
+  MTaskGroup group;
+  for (uint32 i = 0; i < 8; ++i)
+    group.Run([i]() {
+      if (i == 5)
+        throw std::runtime_error("task failed");
+    });
+
+  BOOST_CHECK_THROW(group.Wait(), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,71 @@
+#include "utils.h"
+
+#include <boost/filesystem.hpp>
+#include <boost/test/unit_test.hpp>
+#include <boost/thread/thread.hpp>
+
+#include <fstream>
+#include <string>
+
+#include <sys/stat.h>
+
+namespace fs = boost::filesystem;
+
+
+BOOST_AUTO_TEST_SUITE(test_utils_suite)
+
+// a few hundred kilobytes of ATOM lines, more than any first guess of the
+// size of a stream
+std::string TestStructure()
+{
+  std::string result;
+  for (uint32 i = 0; i < 4000; ++i)
+    result += "ATOM      1  N   MET A   1      27.340  24.430   2.614  1.00"
+              "  9.67           N  \n";
+  return result;
+}
+
+BOOST_AUTO_TEST_CASE(test_input_buffer_file)
+{
+  const std::string text = TestStructure();
+  fs::path file = fs::temp_directory_path() / fs::unique_path();
+
+  {
+    std::ofstream out(file.string().c_str(), std::ios_base::binary);
+    out << text;
+  }
+
+  {
+    input_buffer in(file.string());
+    BOOST_CHECK_EQUAL(in.size(), text.length());
+    BOOST_CHECK(std::string(in.begin(), in.end()) == text);
+    BOOST_CHECK_EQUAL(*in.end(), 0);
+  }
+
+  fs::remove(file);
+}
+
+BOOST_AUTO_TEST_CASE(test_input_buffer_pipe)
+{
+  const std::string text = TestStructure();
+  fs::path fifo = fs::temp_directory_path() / fs::unique_path();
+  BOOST_REQUIRE_EQUAL(mkfifo(fifo.string().c_str(), 0600), 0);
+
+  // opening a FIFO for writing waits for the reader
+  boost::thread writer([&fifo, &text]() {
+    std::ofstream out(fifo.string().c_str(), std::ios_base::binary);
+    out << text;
+  });
+
+  {
+    input_buffer in(fifo.string());
+    BOOST_CHECK_EQUAL(in.size(), text.length());
+    BOOST_CHECK(std::string(in.begin(), in.end()) == text);
+    BOOST_CHECK_EQUAL(*in.end(), 0);
+  }
+
+  writer.join();
+  fs::remove(fifo);
+}
+
+BOOST_AUTO_TEST_SUITE_END()